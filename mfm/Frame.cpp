@@ -56,7 +56,7 @@ namespace mfm
  * @param _byteOrder Byte order of the frame to create.
  */
 Frame::Frame(FrameKind _kind, utl::Endianness _byteOrder)
-	: serializer_(_byteOrder)
+	: serializer_(_byteOrder), frameTableValid_(false)
 {
 	// Build header
 	if (BLOB == _kind)
@@ -85,7 +85,7 @@ Frame::Frame(FrameKind _kind, utl::Endianness _byteOrder)
  *  all data beyond the said header being initialize to zero.
  */
 Frame::Frame(Header const & _header)
-	: serializer_(_header.endianness())
+	: serializer_(_header.endianness()), frameTableValid_(false)
 {
 	// Build header
 	Header* h = _header.clone();
@@ -112,7 +112,7 @@ Frame::Frame(Header const & _header)
  * @param _serializer The serializer from which the frame to create will read and write its data.
  */
 Frame::Frame(Serializer const & _serializer)
-	: serializer_(_serializer)
+	: serializer_(_serializer), frameTableValid_(false)
 {
 	// Load header from buffer into cache
 	loadHeader();
@@ -125,10 +125,23 @@ Frame::Frame(Serializer const & _serializer)
  * @param _frame Original frame to copy.
  */
 Frame::Frame(Frame const & _frame)
-	: serializer_(_frame.serializer_)
+	: serializer_(_frame.serializer_), viewHeader_(_frame.viewHeader_), frameTableValid_(false)
 {
-	// Load header from buffer into cache
-	loadHeader();
+	// Load header from buffer into cache, unless a view is copied
+	if (not viewHeader_)
+		loadHeader();
+}
+//______________________________________________________________________
+/**
+ * Constructs a view of an embedded frame.
+ * Neither the data nor the header are copied.
+ * @param _serializer View of the parent buffer holding the embedded frame.
+ * @param _header Header of the embedded frame, decoded by the parent frame.
+ */
+Frame::Frame(Serializer const & _serializer, std::shared_ptr< Header const > const & _header)
+	: serializer_(_serializer), viewHeader_(_header), frameTableValid_(false)
+{
+	;
 }
 //______________________________________________________________________
 Frame::~Frame()
@@ -146,8 +159,15 @@ Frame::~Frame()
 Frame& Frame::operator=(const Frame & r)
 {
 	serializer_ = r.serializer();
-	// Load header from buffer into cache
-	loadHeader();
+	viewHeader_ = r.viewHeader_;
+	// Load header from buffer into cache, unless a view is copied
+	if (viewHeader_)
+	{
+		headerPtr_.reset();
+		frameTableValid_ = false;
+	}
+	else
+		loadHeader();
 	return *this;
 }
 //______________________________________________________________________
@@ -226,6 +246,10 @@ uint64_t Frame::itemOffset(size_t itemIndex) const
 	{
 		offset += itemIndex*header().itemSize_B();
 	}
+	else if (header().isLayeredFrame())
+	{
+		offset = frameOffset(itemIndex);
+	}
 	else
 	{
 		for (size_t i=0; i < itemIndex; ++i)
@@ -235,10 +259,16 @@ uint64_t Frame::itemOffset(size_t itemIndex) const
 }
 //______________________________________________________________________
 /**
- * @fn std::auto_ptr< mfm::Header> & Frame::headerPtr()
  * Returns a reference to the auto pointer holding the cached header of this frame.
+ * A view sharing the header of its parent frame gets its own header first, as the caller may modify it.
  * @return A reference to the auto pointer holding the cached header of this frame.
  */
+std::auto_ptr< mfm::Header> & Frame::headerPtr()
+{
+	if (0 == headerPtr_.get())
+		loadHeader();
+	return headerPtr_;
+}
 //______________________________________________________________________
 /**
  * Reads encoded header and stores its contents into cached header.
@@ -247,6 +277,8 @@ void Frame::loadHeader()
 {
 	std::auto_ptr<Header> headerPtr = Header::decodeHeader(serializer().inputStream());
 	headerPtr_ = headerPtr;
+	viewHeader_.reset();
+	frameTableValid_ = false;
 }
 //______________________________________________________________________
 /**
@@ -333,22 +365,57 @@ uint64_t Frame::frameOffset(size_t const & frameIndex) const
 	if (frameIndex >= frameCount())
 		throw OutOfRangeError();
 
+	return frameOffsets()[frameIndex];
+}
+//______________________________________________________________________
+/**
+ * Returns the offsets where the embedded frames start within this layered frame.
+ * The table is built on first access by walking the primary headers once.
+ * @return Offsets [Bytes] of all embedded frames, in order.
+ */
+std::vector<uint64_t> const & Frame::frameOffsets() const
+{
+	buildFrameTable();
+	return frameOffsets_;
+}
+//______________________________________________________________________
+/**
+ * Returns the sizes of the frames embedded within this layered frame.
+ * @return Sizes [Bytes] of all embedded frames, in order.
+ */
+std::vector<uint64_t> const & Frame::frameSizes() const
+{
+	buildFrameTable();
+	return frameSizes_;
+}
+//______________________________________________________________________
+/**
+ * Decodes the header of each embedded frame once and caches them with their offsets and sizes.
+ * Does nothing if the table is up to date with the cached header.
+ */
+void Frame::buildFrameTable() const
+{
+	if (frameTableValid_)
+		return;
+	if (not header().isLayeredFrame())
+		throw Exception("Operation frameAt() is only supported for frames of the Layered kind!");
+
+	size_t const count = frameCount();
+	frameOffsets_.resize(count);
+	frameSizes_.resize(count);
+	frameHeaders_.resize(count);
+
 	// First embedded frame starts after end of header
 	uint64_t currentOffset = header().headerSize_B();
-	size_t currentIndex = 0;
-	std::auto_ptr<PrimaryHeader> primaryHeader;
-
-	// Loop over embedded frames
-	while (currentIndex < frameIndex)
+	for (size_t i=0; i < count; ++i)
 	{
-		// Decode primary header to find out frame size
-		// Hack for VxWorks which does not support assignment from return
-		std::auto_ptr<PrimaryHeader> tmp = PrimaryHeader::decodePrimaryHeader(serializer().inputStream(currentOffset));
-		primaryHeader = tmp;
-		currentOffset += primaryHeader->frameSize_B();
-		currentIndex++;
+		// Decode header to find out frame size, and keep it for the views of the frame
+		frameHeaders_[i].reset(Header::decodeHeader(serializer().inputStream(currentOffset)).release());
+		frameOffsets_[i] = currentOffset;
+		frameSizes_[i] = frameHeaders_[i]->frameSize_B();
+		currentOffset += frameSizes_[i];
 	}
-	return currentOffset;
+	frameTableValid_ = true;
 }
 //______________________________________________________________________
 /**
@@ -378,10 +445,12 @@ uint64_t Frame::frameSize_B(size_t const & /* frameIndex */, size_t const & fram
  */
 uint64_t Frame::frameSize_B(size_t const & frameIndex) const
 {
-	// Get frame offset
-	uint64_t offset = frameOffset(frameIndex);
-	// Decode frame primary header and return size
-	return frameSize_B(frameIndex, offset);
+	if (not header().isLayeredFrame())
+		throw Exception("Operation frameAt() is only supported for frames of the Layered kind!");
+	if (frameIndex >= frameCount())
+		throw OutOfRangeError();
+
+	return frameSizes()[frameIndex];
 }
 //______________________________________________________________________
 /** Returns a copy of the frame with given index embedded within this layered frame.
@@ -396,6 +465,20 @@ std::auto_ptr<Frame> Frame::frameAt(size_t const frameIndex)
 	return Frame::read(serializer().inputStream(offset));
 }
 //______________________________________________________________________
+/** Returns a view of the frame with given index embedded within this layered frame.
+ * No data is copied: the returned frame shares the buffer of this frame and
+ * is only valid as long as this frame's buffer is neither modified nor released.
+ * No header is decoded either: the view shares the header cached in the frame table.
+ * @param frameIndex Index of the embedded frame to access.
+ * @return Returns a frame referencing the bytes of the given embedded frame.
+ * @throws Throws an exception for non-layered frames or if index is out of range.
+ */
+Frame Frame::frameViewAt(size_t const frameIndex)
+{
+	uint64_t const offset = frameOffset(frameIndex);
+	return Frame(Serializer(serializer(), frameSizes_[frameIndex], offset), frameHeaders_[frameIndex]);
+}
+//______________________________________________________________________
 /**
  * Embeds a frame at the end of the frame.
  * Allocates space for a new embedded frame at the end of this layered frame and updates header accordingly.
@@ -410,6 +493,11 @@ void Frame::addFrame(Frame const & embeddedFrame)
 
 	uint64_t const newItemSize_B = embeddedFrame.header().frameSize_B();
 
+	// New embedded frame starts where the last one ends
+	uint64_t newItemOffset_B = header().headerSize_B();
+	if (frameCount() > 0)
+		newItemOffset_B = frameOffsets().back() + frameSizes().back();
+
 	// Update header
 	headerPtr()->addItem(newItemSize_B);
 
@@ -419,9 +507,11 @@ void Frame::addFrame(Frame const & embeddedFrame)
 
 	// Re-encode header into buffer
 	updateHeader();
+	frameOffsets_.push_back(newItemOffset_B);
+	frameSizes_.push_back(newItemSize_B);
+	frameHeaders_.push_back(std::shared_ptr< Header const >(embeddedFrame.header().clone()));
 
 	// Set contents of new embedded frame
-	uint64_t const newItemOffset_B = frameOffset(frameCount()-1);
 	Serializer embeddedFrameSerializer(serializer(), newItemSize_B, newItemOffset_B);
 	embeddedFrameSerializer.read(embeddedFrame.serializer().inputStream(), newItemSize_B);
 }
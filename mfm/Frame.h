@@ -48,6 +48,7 @@
 #include <mfm/AbstractFieldContainer.h>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace mfm {
 //______________________________________________________________________
@@ -68,7 +69,7 @@ public:
 	Frame& operator=(const Frame & r);
     virtual Frame* clone() const;
 	Frame const & frame() const;
-	Header const & header() const { return *headerPtr_; }
+	Header const & header() const { return headerPtr_.get() ? *headerPtr_ : *viewHeader_; }
 	uint64_t offset_B() const { return 0u; }
 
 	std::string fieldName(size_t const & offset_B, size_t const & size_B) const;
@@ -93,7 +94,10 @@ public:
 	uint64_t frameSize_B(size_t const & frameIndex) const;
 	uint64_t frameSize_B(size_t const & /* frameIndex */, size_t const & frameOffset_B) const;
 	uint64_t frameOffset(size_t const & frameIndex) const;
+	std::vector<uint64_t> const & frameOffsets() const;
+	std::vector<uint64_t> const & frameSizes() const;
 	std::auto_ptr<Frame> frameAt(size_t const frameIndex);
+	Frame frameViewAt(size_t const frameIndex);
 	void addFrame(Frame const & embeddedFrame);
 	///@}
 
@@ -114,15 +118,22 @@ public:
 	FrameFormat const & findFormat() const;
 	Serializer & serializer() { return serializer_; }
 private:
-	std::auto_ptr< mfm::Header> & headerPtr() { return headerPtr_; }
+	Frame(Serializer const &, std::shared_ptr< mfm::Header const > const &);
+	std::auto_ptr< mfm::Header> & headerPtr();
 	void loadHeader();
 	void updateHeader();
+	void buildFrameTable() const;
 	Serializer const & serializer() const { return serializer_; }
 	/// Returns the dictionary of all known frame formats.
 	static FrameDictionary & dictionary();
 private:
 	Serializer serializer_; ///< Serializer encapsulating all of the frame data.
 	std::auto_ptr< mfm::Header> headerPtr_; ///< Cached header
+	std::shared_ptr< mfm::Header const > viewHeader_; ///< Header shared with the frame table of the parent frame, for views without a cached header
+	mutable bool frameTableValid_; ///< Whether the embedded frame table below matches the header
+	mutable std::vector<uint64_t> frameOffsets_; ///< Cached offsets [Bytes] of the embedded frames
+	mutable std::vector<uint64_t> frameSizes_; ///< Cached sizes [Bytes] of the embedded frames
+	mutable std::vector< std::shared_ptr< mfm::Header const > > frameHeaders_; ///< Cached headers of the embedded frames
 };
 //______________________________________________________________________
 } /* namespace mfm */
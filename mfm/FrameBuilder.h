@@ -52,7 +52,7 @@ class FrameBuilder
 public:
 	FrameBuilder();
 	virtual ~FrameBuilder();
-	void addDataChunk(const mfm::Byte* begin, const mfm::Byte* end);
+	virtual void addDataChunk(const mfm::Byte* begin, const mfm::Byte* end);
 	virtual void reset();
 protected:
 	virtual void processFrame(mfm::Frame & frame) = 0;
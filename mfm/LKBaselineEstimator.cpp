@@ -0,0 +1,90 @@
+#include "LKBaselineEstimator.h"
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+bool LKBaselineEstimator::SetMethod(int method)
+{
+    if (method < kSideBandMean || method > kTrimmedMean)
+        return false;
+    fMethod = method;
+    return true;
+}
+
+double LKBaselineEstimator::Estimate(const int *samples, int numBuckets, int offset, int peakBucket) const
+{
+    if (fMethod == kMode)
+        return Mode(samples, numBuckets);
+
+    int selected[kMaxSideBandSamples];
+    int const numSelected = SelectSideBands(samples, numBuckets, offset, peakBucket, selected);
+    if (numSelected == 0)
+        return 0;
+
+    if (fMethod == kSideBandMedian) {
+        int *middle = selected + numSelected/2;
+        std::nth_element(selected, middle, selected + numSelected);
+        if (numSelected % 2 == 1)
+            return *middle;
+        return 0.5 * (*middle + *std::max_element(selected, middle));
+    }
+
+    if (fMethod == kTrimmedMean) {
+        std::sort(selected, selected + numSelected);
+        int numTrimmed = int(fTrimFraction * numSelected);
+        if (2*numTrimmed >= numSelected)
+            numTrimmed = (numSelected - 1) / 2;
+        int64_t sum = 0;
+        for (int i=numTrimmed; i<numSelected-numTrimmed; ++i)
+            sum += selected[i];
+        return double(sum) / (numSelected - 2*numTrimmed);
+    }
+
+    int64_t sum = 0;
+    for (int i=0; i<numSelected; ++i)
+        sum += selected[i];
+    return double(sum / numSelected);
+}
+
+int LKBaselineEstimator::SelectSideBands(const int *samples, int numBuckets, int offset, int peakBucket, int *selected) const
+{
+    int const bgmin = 50 + offset;
+    int const bgmax = numBuckets + offset - 50;
+
+    // [first, last) ranges of the side bands
+    int ranges[2][2] = {{0, 0}, {0, 0}};
+    if (peakBucket > bgmin && peakBucket < bgmax) {
+        ranges[0][0] = bgmin - 29; ranges[0][1] = bgmin - 20;
+        ranges[1][0] = bgmax + 21; ranges[1][1] = bgmax + 30;
+    }
+    else if (peakBucket < bgmin) {
+        ranges[0][0] = bgmax + 1;  ranges[0][1] = bgmax + 20;
+    }
+    else if (peakBucket > bgmax) {
+        ranges[0][0] = bgmin - 19; ranges[0][1] = bgmin;
+    }
+
+    int numSelected = 0;
+    for (auto &range : ranges) {
+        int const first = std::max(range[0], 0);
+        int const last = std::min(range[1], numBuckets);
+        for (int buck=first; buck<last && numSelected<kMaxSideBandSamples; ++buck)
+            selected[numSelected++] = samples[buck];
+    }
+    return numSelected;
+}
+
+double LKBaselineEstimator::Mode(const int *samples, int numBuckets) const
+{
+    uint16_t counts[kModeNumBins] = {};
+    int maxBin = 0;
+    for (int buck=0; buck<numBuckets; ++buck) {
+        int const bin = samples[buck] / kModeBinWidth;
+        if (bin < 0 || bin >= kModeNumBins)
+            continue;
+        if (++counts[bin] > counts[maxBin])
+            maxBin = bin;
+    }
+    return (maxBin + 0.5) * kModeBinWidth;
+}
@@ -0,0 +1,41 @@
+#ifndef LKBASELINEESTIMATOR_H
+#define LKBASELINEESTIMATOR_H
+
+/*
+ * Baseline of a FPN corrected waveform, without allocation and without fit.
+ * The side-band methods use the buckets before and/or after the pulse, chosen from the peak bucket
+ * as LKFrameBuilder::GetBaseline always did: 10 buckets on each side when the peak is inside [50, bucketmax-50]
+ * (shifted by 256 buckets for the decay part of 2p mode data), otherwise 20 buckets on the free side.
+ *   kSideBandMean   : integer mean of the side bands (the result GetBaseline used to return)
+ *   kSideBandMedian : median of the side bands
+ *   kMode           : center of the most populated 4 ADC wide bin of all buckets
+ *   kTrimmedMean    : mean of the side bands without the lowest and highest trim fraction
+ */
+class LKBaselineEstimator
+{
+    public:
+        enum Method { kSideBandMean = 0, kSideBandMedian = 1, kMode = 2, kTrimmedMean = 3 };
+
+        LKBaselineEstimator() {}
+
+        /// Returns false for an unknown method, which leaves the method unchanged
+        bool SetMethod(int method);
+        int GetMethod() const { return fMethod; }
+        void SetTrimFraction(double fraction) { fTrimFraction = fraction; }
+
+        /// samples[0, numBuckets), offset is the first bucket of the (decay) window
+        double Estimate(const int *samples, int numBuckets, int offset, int peakBucket) const;
+
+    private:
+        static const int kMaxSideBandSamples = 64;
+        static const int kModeBinWidth = 4;
+        static const int kModeNumBins = 1024;
+
+        int SelectSideBands(const int *samples, int numBuckets, int offset, int peakBucket, int *selected) const;
+        double Mode(const int *samples, int numBuckets) const;
+
+        int fMethod = kSideBandMean;
+        double fTrimFraction = 0.25;
+};
+
+#endif
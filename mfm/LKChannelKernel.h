@@ -0,0 +1,99 @@
+#ifndef LKCHANNELKERNEL_H
+#define LKCHANNELKERNEL_H
+
+#include <cstdint>
+
+/// Features of a corrected waveform, all in the shifted (non-negative) scale of the stored waveform
+struct LKChannelFeatures
+{
+    int shift = 0;          ///< minimum of the corrected samples if negative (subtracted from all samples), otherwise 0
+    int maxValue = -1000;   ///< maximum in the search window, -1000 if the window is empty
+    int maxBucket = 0;      ///< first bucket of the maximum
+    int64_t sum = 0;        ///< sum of all samples
+};
+
+/*
+ * FPN subtraction, polarity, minimum shift, maximum search and sum of a channel waveform in a single traversal.
+ * The polarity of the AGET selects how the corrected sample is made from the raw sample and the averaged FPN sample:
+ *   kNegative      : raw - fpn
+ *   kPositive      : fpn - raw
+ *   kPositiveFixed : 4096 - raw (FPN not used)
+ * The buckets before, inside and after the maximum search window are three branch-free loops over the same pass,
+ * so the compiler can vectorize the outer two. Only when the minimum is negative the stored samples are shifted,
+ * like LKFrameBuilder::GetCorrWaveform always did.
+ */
+class LKChannelKernel
+{
+    public:
+        enum Polarity { kNegative = 0, kPositive = 1, kPositiveFixed = 2 };
+
+        /// corrected[0, numBuckets) from raw and fpn, maximum searched in [maxFirst, maxLast)
+        template <typename Sample>
+        static void Process(int polarity, const Sample *raw, const Sample *fpn, int *corrected, int numBuckets,
+                int maxFirst, int maxLast, LKChannelFeatures &features) {
+            if (polarity == kPositive)
+                ProcessPolarity<kPositive>(raw, fpn, corrected, numBuckets, maxFirst, maxLast, features);
+            else if (polarity == kPositiveFixed)
+                ProcessPolarity<kPositiveFixed>(raw, fpn, corrected, numBuckets, maxFirst, maxLast, features);
+            else
+                ProcessPolarity<kNegative>(raw, fpn, corrected, numBuckets, maxFirst, maxLast, features);
+        }
+
+    private:
+        template <int P, typename Sample>
+        static int Correct(const Sample *raw, const Sample *fpn, int bucket) {
+            if (P == kNegative) return int(raw[bucket]) - int(fpn[bucket]);
+            if (P == kPositive) return int(fpn[bucket]) - int(raw[bucket]);
+            return 4096 - int(raw[bucket]);
+        }
+
+        template <int P, typename Sample>
+        static void ProcessPolarity(const Sample *raw, const Sample *fpn, int *corrected, int numBuckets,
+                int maxFirst, int maxLast, LKChannelFeatures &features) {
+            maxFirst = maxFirst < 0 ? 0 : (maxFirst > numBuckets ? numBuckets : maxFirst);
+            maxLast = maxLast < maxFirst ? maxFirst : (maxLast > numBuckets ? numBuckets : maxLast);
+
+            int minValue = 10000;
+            int64_t sum = 0;
+            for (int bucket=0; bucket<maxFirst; ++bucket) {
+                int const value = Correct<P>(raw, fpn, bucket);
+                corrected[bucket] = value;
+                minValue = value < minValue ? value : minValue;
+                sum += value;
+            }
+            int maxValue = features.maxValue = -1000;
+            int maxBucket = features.maxBucket = 0;
+            if (maxFirst < maxLast) {
+                maxValue = Correct<P>(raw, fpn, maxFirst);
+                maxBucket = maxFirst;
+            }
+            for (int bucket=maxFirst; bucket<maxLast; ++bucket) {
+                int const value = Correct<P>(raw, fpn, bucket);
+                corrected[bucket] = value;
+                minValue = value < minValue ? value : minValue;
+                sum += value;
+                if (value > maxValue) {
+                    maxValue = value;
+                    maxBucket = bucket;
+                }
+            }
+            for (int bucket=maxLast; bucket<numBuckets; ++bucket) {
+                int const value = Correct<P>(raw, fpn, bucket);
+                corrected[bucket] = value;
+                minValue = value < minValue ? value : minValue;
+                sum += value;
+            }
+
+            features.shift = minValue < 0 ? minValue : 0;
+            if (features.shift != 0)
+                for (int bucket=0; bucket<numBuckets; ++bucket)
+                    corrected[bucket] -= features.shift;
+            features.sum = sum - int64_t(numBuckets) * features.shift;
+            if (maxFirst < maxLast) {
+                features.maxValue = maxValue - features.shift;
+                features.maxBucket = maxBucket;
+            }
+        }
+};
+
+#endif
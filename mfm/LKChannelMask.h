@@ -0,0 +1,62 @@
+#ifndef LKCHANNELMASK_H
+#define LKCHANNELMASK_H
+
+#include <cstdint>
+
+/*
+ * Fired channels of one AGET (68 channels, up to 128) as two 64 bit words.
+ * Range-for visits the set channels only, in increasing order, with count-trailing-zeros:
+ *   for (UInt_t chan : mask.WithoutFPN()) ...
+ * The iterator works on a copy of the words, so channels may be reset inside the loop.
+ */
+class LKChannelMask
+{
+    public:
+        class Iterator
+        {
+            public:
+                Iterator(uint64_t low, uint64_t high) : fLow(low), fHigh(high) {}
+                unsigned int operator*() const { return fLow != 0 ? __builtin_ctzll(fLow) : 64 + __builtin_ctzll(fHigh); }
+                Iterator &operator++() {
+                    if (fLow != 0) fLow &= fLow - 1;
+                    else fHigh &= fHigh - 1;
+                    return *this;
+                }
+                bool operator!=(const Iterator &other) const { return fLow != other.fLow || fHigh != other.fHigh; }
+
+            private:
+                uint64_t fLow;
+                uint64_t fHigh;
+        };
+
+        LKChannelMask() {}
+        LKChannelMask(uint64_t low, uint64_t high) : fLow(low), fHigh(high) {}
+
+        void Set(unsigned int chan) { Word(chan) |= Bit(chan); }
+        void Reset(unsigned int chan) { Word(chan) &= ~Bit(chan); }
+        bool Test(unsigned int chan) const { return (chan < 64 ? fLow : fHigh) & Bit(chan); }
+        void Clear() { fLow = fHigh = 0; }
+        bool Any() const { return (fLow | fHigh) != 0; }
+        int Count() const { return __builtin_popcountll(fLow) + __builtin_popcountll(fHigh); }
+
+        uint64_t GetLow() const { return fLow; }
+        uint64_t GetHigh() const { return fHigh; }
+
+        /// Same mask without the FPN channels 11, 22, 45 and 56
+        LKChannelMask WithoutFPN() const { return LKChannelMask(fLow & ~kFPNLow, fHigh); }
+        bool AnyFPN() const { return (fLow & kFPNLow) != 0; }
+
+        Iterator begin() const { return Iterator(fLow, fHigh); }
+        Iterator end() const { return Iterator(0, 0); }
+
+    private:
+        static constexpr uint64_t kFPNLow = (1ull << 11) | (1ull << 22) | (1ull << 45) | (1ull << 56);
+
+        static uint64_t Bit(unsigned int chan) { return 1ull << (chan & 63); }
+        uint64_t &Word(unsigned int chan) { return chan < 64 ? fLow : fHigh; }
+
+        uint64_t fLow = 0;  ///< channels 0-63
+        uint64_t fHigh = 0; ///< channels 64-127
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "LKCoBoFrameDecoder.h"
+
+// The vector decoders are compiled for their instruction set with the target attribute and chosen
+// at run time from the CPU, so that a default build (no -m flags) uses them as well.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define LK_COBO_DECODER_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+inline uint16_t LoadBigEndian16(const uint8_t *p)
+{
+    return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+inline uint32_t LoadBigEndian32(const uint8_t *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+enum InstructionSet { kScalar, kSSSE3, kSSE41, kAVX2 };
+
+InstructionSet DetectInstructionSet()
+{
+#ifdef LK_COBO_DECODER_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return kAVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return kSSE41;
+    if (__builtin_cpu_supports("ssse3"))
+        return kSSSE3;
+#endif
+    return kScalar;
+}
+
+/// Instruction set of the CPU, detected on the first call
+InstructionSet GetCPUInstructionSet()
+{
+    static const InstructionSet instructionSet = DetectInstructionSet();
+    return instructionSet;
+}
+
+#ifdef LK_COBO_DECODER_DISPATCH
+/// Returns the number of items decoded, the rest is left to the scalar loop
+__attribute__((target("avx2")))
+size_t DecodeFullReadoutAVX2(const uint8_t *data, size_t nItems, uint16_t *agetIdx, uint16_t *sample)
+{
+    const __m256i swap16 = _mm256_setr_epi8(
+            1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+            1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+    const __m256i sampleMask = _mm256_set1_epi16(0x0fff);
+    size_t i = 0;
+    for (; i + 16 <= nItems; i += 16) {
+        __m256i words = _mm256_loadu_si256((const __m256i *) (data + 2*i));
+        words = _mm256_shuffle_epi8(words, swap16);
+        _mm256_storeu_si256((__m256i *) (agetIdx + i), _mm256_srli_epi16(words, 14));
+        _mm256_storeu_si256((__m256i *) (sample + i), _mm256_and_si256(words, sampleMask));
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+size_t DecodeFullReadoutSSSE3(const uint8_t *data, size_t nItems, uint16_t *agetIdx, uint16_t *sample)
+{
+    const __m128i swap16 = _mm_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+    const __m128i sampleMask = _mm_set1_epi16(0x0fff);
+    size_t i = 0;
+    for (; i + 8 <= nItems; i += 8) {
+        __m128i words = _mm_loadu_si128((const __m128i *) (data + 2*i));
+        words = _mm_shuffle_epi8(words, swap16);
+        _mm_storeu_si128((__m128i *) (agetIdx + i), _mm_srli_epi16(words, 14));
+        _mm_storeu_si128((__m128i *) (sample + i), _mm_and_si128(words, sampleMask));
+    }
+    return i;
+}
+
+/// With AVX2 the pack works per 128-bit lane, so the 64-bit quarters are put back in order
+__attribute__((target("avx2")))
+size_t DecodePartialReadoutAVX2(const uint8_t *data, size_t nItems,
+        uint16_t *agetIdx, uint16_t *chanIdx, uint16_t *buckIdx, uint16_t *sample)
+{
+    const __m256i swap32 = _mm256_setr_epi8(
+            3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+            3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+    const __m256i chanMask = _mm256_set1_epi32(0x7f);
+    const __m256i buckMask = _mm256_set1_epi32(0x1ff);
+    const __m256i sampleMask = _mm256_set1_epi32(0x0fff);
+    size_t i = 0;
+    for (; i + 16 <= nItems; i += 16) {
+        __m256i lo = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (data + 4*i)), swap32);
+        __m256i hi = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (data + 4*i + 32)), swap32);
+#define LK_PACK_STORE(dest, expLo, expHi) \
+        _mm256_storeu_si256((__m256i *) (dest + i), \
+                _mm256_permute4x64_epi64(_mm256_packus_epi32(expLo, expHi), 0xd8))
+        LK_PACK_STORE(agetIdx, _mm256_srli_epi32(lo, 30), _mm256_srli_epi32(hi, 30));
+        LK_PACK_STORE(chanIdx, _mm256_and_si256(_mm256_srli_epi32(lo, 23), chanMask), _mm256_and_si256(_mm256_srli_epi32(hi, 23), chanMask));
+        LK_PACK_STORE(buckIdx, _mm256_and_si256(_mm256_srli_epi32(lo, 14), buckMask), _mm256_and_si256(_mm256_srli_epi32(hi, 14), buckMask));
+        LK_PACK_STORE(sample, _mm256_and_si256(lo, sampleMask), _mm256_and_si256(hi, sampleMask));
+#undef LK_PACK_STORE
+    }
+    return i;
+}
+
+/// The unsigned 32 to 16 bit pack needs SSE4.1, an SSSE3 CPU uses the scalar loop
+__attribute__((target("sse4.1")))
+size_t DecodePartialReadoutSSE41(const uint8_t *data, size_t nItems,
+        uint16_t *agetIdx, uint16_t *chanIdx, uint16_t *buckIdx, uint16_t *sample)
+{
+    const __m128i swap32 = _mm_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+    const __m128i chanMask = _mm_set1_epi32(0x7f);
+    const __m128i buckMask = _mm_set1_epi32(0x1ff);
+    const __m128i sampleMask = _mm_set1_epi32(0x0fff);
+    size_t i = 0;
+    for (; i + 8 <= nItems; i += 8) {
+        __m128i lo = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 4*i)), swap32);
+        __m128i hi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 4*i + 16)), swap32);
+#define LK_PACK_STORE(dest, expLo, expHi) \
+        _mm_storeu_si128((__m128i *) (dest + i), _mm_packus_epi32(expLo, expHi))
+        LK_PACK_STORE(agetIdx, _mm_srli_epi32(lo, 30), _mm_srli_epi32(hi, 30));
+        LK_PACK_STORE(chanIdx, _mm_and_si128(_mm_srli_epi32(lo, 23), chanMask), _mm_and_si128(_mm_srli_epi32(hi, 23), chanMask));
+        LK_PACK_STORE(buckIdx, _mm_and_si128(_mm_srli_epi32(lo, 14), buckMask), _mm_and_si128(_mm_srli_epi32(hi, 14), buckMask));
+        LK_PACK_STORE(sample, _mm_and_si128(lo, sampleMask), _mm_and_si128(hi, sampleMask));
+#undef LK_PACK_STORE
+    }
+    return i;
+}
+#endif
+
+}
+
+const char* LKCoBoFrameDecoder::GetInstructionSet()
+{
+    switch (GetCPUInstructionSet()) {
+        case kAVX2:  return "AVX2";
+        case kSSE41: return "SSE4.1";
+        case kSSSE3: return "SSSE3";
+        default:     return "scalar";
+    }
+}
+
+void LKCoBoFrameDecoder::DecodeFullReadout(const uint8_t *data, size_t nItems, uint16_t *agetIdx, uint16_t *sample)
+{
+    size_t i = 0;
+
+#ifdef LK_COBO_DECODER_DISPATCH
+    InstructionSet const instructionSet = GetCPUInstructionSet();
+    if (instructionSet == kAVX2)
+        i = DecodeFullReadoutAVX2(data, nItems, agetIdx, sample);
+    else if (instructionSet != kScalar)
+        i = DecodeFullReadoutSSSE3(data, nItems, agetIdx, sample);
+#endif
+
+    for (; i < nItems; ++i) {
+        uint16_t word = LoadBigEndian16(data + 2*i);
+        agetIdx[i] = word >> 14;
+        sample[i] = word & 0x0fff;
+    }
+}
+
+/**
+ * The four fields are extracted from 32-bit lanes and packed to 16 bits before the store.
+ */
+void LKCoBoFrameDecoder::DecodePartialReadout(const uint8_t *data, size_t nItems,
+        uint16_t *agetIdx, uint16_t *chanIdx, uint16_t *buckIdx, uint16_t *sample)
+{
+    size_t i = 0;
+
+#ifdef LK_COBO_DECODER_DISPATCH
+    InstructionSet const instructionSet = GetCPUInstructionSet();
+    if (instructionSet == kAVX2)
+        i = DecodePartialReadoutAVX2(data, nItems, agetIdx, chanIdx, buckIdx, sample);
+    else if (instructionSet == kSSE41)
+        i = DecodePartialReadoutSSE41(data, nItems, agetIdx, chanIdx, buckIdx, sample);
+#endif
+
+    for (; i < nItems; ++i) {
+        uint32_t word = LoadBigEndian32(data + 4*i);
+        agetIdx[i] = word >> 30;
+        chanIdx[i] = (word >> 23) & 0x7f;
+        buckIdx[i] = (word >> 14) & 0x1ff;
+        sample[i] = word & 0x0fff;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef LKCOBOFRAMEDECODER_H
+#define LKCOBOFRAMEDECODER_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Bulk decoders for the data section of CoBo frames.
+ * The items of a whole frame are byte-swapped and split into their fields in one pass
+ * (AVX2, SSE4.1 or SSSE3 as the CPU supports them, chosen at run time; plain C++ otherwise),
+ * instead of going through mfm::Item / mfm::BitField for every sample.
+ * Output arrays must hold at least nItems entries.
+ */
+class LKCoBoFrameDecoder
+{
+    public:
+        /// Number of items decoded per call by the callers in LKFrameBuilder (fits on the stack)
+        static const size_t kBlockSize = 4096;
+
+        /// Full readout (frameType 2): 16-bit items, agetIdx in bits 14-15, sample in bits 0-11
+        static void DecodeFullReadout(const uint8_t *data, size_t nItems, uint16_t *agetIdx, uint16_t *sample);
+
+        /// Partial readout (frameType 1): 32-bit items, agetIdx in bits 30-31, chanIdx in bits 23-29,
+        /// buckIdx in bits 14-22 and sample in bits 0-11
+        static void DecodePartialReadout(const uint8_t *data, size_t nItems,
+                uint16_t *agetIdx, uint16_t *chanIdx, uint16_t *buckIdx, uint16_t *sample);
+
+        /// Name of the instruction set used by the decoders on this CPU, for the log
+        static const char* GetInstructionSet();
+};
+
+#endif
@@ -0,0 +1,43 @@
+#include "LKCoBoFrameRouter.h"
+
+#include <sstream>
+
+bool LKCoBoFrameRouter::AddRule(const std::string &pattern, Action action)
+{
+    uint32_t fields[3];
+    std::istringstream stream(pattern);
+    std::string field;
+    for (int i=0; i<3; ++i) {
+        if (!std::getline(stream, field, ':') || field.empty())
+            return false;
+        if (field == "*")
+            fields[i] = kAny;
+        else {
+            size_t end = 0;
+            try { fields[i] = std::stoul(field, &end); }
+            catch (const std::exception&) { return false; }
+            if (end != field.size())
+                return false;
+        }
+    }
+    if (std::getline(stream, field))
+        return false;
+
+    fRules.push_back({fields[0], fields[1], fields[2], action});
+    for (uint32_t cobo=0; cobo<kMaxCobo; ++cobo)
+        for (uint32_t asad=0; asad<kMaxAsad; ++asad)
+            for (uint32_t type=0; type<kMaxFrameType; ++type)
+                fTable[(cobo*kMaxAsad + asad)*kMaxFrameType + type] = Match(cobo, asad, type);
+    return true;
+}
+
+LKCoBoFrameRouter::Action LKCoBoFrameRouter::Match(uint32_t coboIdx, uint32_t asadIdx, uint32_t frameType) const
+{
+    Action action = kKeep;
+    for (auto &rule : fRules)
+        if ((rule.coboIdx == kAny || rule.coboIdx == coboIdx)
+            && (rule.asadIdx == kAny || rule.asadIdx == asadIdx)
+            && (rule.frameType == kAny || rule.frameType == frameType))
+            action = rule.action;
+    return action;
+}
@@ -0,0 +1,50 @@
+#ifndef LKCOBOFRAMEROUTER_H
+#define LKCOBOFRAMEROUTER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+ * Decides from the header of a CoBo frame (coboIdx, asadIdx, frameType) whether its items are decoded.
+ * Frames can be kept, dropped, or diverted (handed over as they are, e.g. to be written to another file).
+ * Rules are "cobo:asad:frameType" patterns where each field is a number or * and the last matching rule wins.
+ * The rules are expanded once into a lookup table, so routing a frame costs one table read.
+ */
+class LKCoBoFrameRouter
+{
+    public:
+        enum Action : uint8_t { kKeep = 0, kDrop = 1, kDivert = 2 };
+
+        LKCoBoFrameRouter() {}
+
+        /// Returns false if the pattern cannot be parsed
+        bool AddRule(const std::string &pattern, Action action);
+        bool IsActive() const { return !fRules.empty(); }
+
+        Action Route(uint32_t coboIdx, uint32_t asadIdx, uint32_t frameType) {
+            Action const action = (coboIdx < kMaxCobo && asadIdx < kMaxAsad && frameType < kMaxFrameType)
+                ? (Action) fTable[(coboIdx*kMaxAsad + asadIdx)*kMaxFrameType + frameType]
+                : Match(coboIdx, asadIdx, frameType);
+            ++fNumFrames[action];
+            return action;
+        }
+
+        uint64_t GetNumFrames(Action action) const { return fNumFrames[action]; }
+
+    private:
+        static const uint32_t kAny = UINT32_MAX;
+        static const uint32_t kMaxCobo = 32;
+        static const uint32_t kMaxAsad = 4;
+        static const uint32_t kMaxFrameType = 4;
+
+        struct Rule { uint32_t coboIdx, asadIdx, frameType; Action action; };
+
+        Action Match(uint32_t coboIdx, uint32_t asadIdx, uint32_t frameType) const;
+
+        std::vector<Rule> fRules;
+        uint8_t fTable[kMaxCobo*kMaxAsad*kMaxFrameType] = {};
+        uint64_t fNumFrames[3] = {};
+};
+
+#endif
@@ -0,0 +1,43 @@
+#include "LKCoBoHeader.h"
+#include "mfm/Frame.h"
+
+#include <map>
+#include <mutex>
+
+constexpr LKCoBoHeaderLayout LKCoBoHeader::kLayout;
+
+LKCoBoHeader::LKCoBoHeader(mfm::Frame &frame)
+: fData((const uint8_t *) frame.data()), fLayout(FindLayout(frame))
+{
+}
+
+const LKCoBoHeaderLayout* LKCoBoHeader::FindLayout(mfm::Frame &frame)
+{
+    uint16_t const frameType = frame.header().frameType();
+    uint8_t const revision = frame.header().revision();
+    if (revision == kRevision && (frameType == 1u || frameType == 2u))
+        return &kLayout;
+
+    static std::map<uint32_t, LKCoBoHeaderLayout> layouts;
+    static std::mutex layoutsMutex;
+    std::lock_guard<std::mutex> lock(layoutsMutex);
+
+    uint32_t const key = (uint32_t(frameType) << 8) | revision;
+    auto found = layouts.find(key);
+    if (found != layouts.end())
+        return &found->second;
+
+    auto resolve = [&frame](const char *name) {
+        size_t pos = 0, size = 0;
+        frame.findHeaderField(name, pos, size);
+        return LKCoBoHeaderField{(uint16_t) pos, (uint16_t) size};
+    };
+    LKCoBoHeaderLayout layout;
+    layout.frameSize = resolve("frameSize");
+    layout.itemSize  = resolve("itemSize");
+    layout.eventTime = resolve("eventTime");
+    layout.eventIdx  = resolve("eventIdx");
+    layout.coboIdx   = resolve("coboIdx");
+    layout.asadIdx   = resolve("asadIdx");
+    return &(layouts[key] = layout);
+}
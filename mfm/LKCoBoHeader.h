@@ -0,0 +1,80 @@
+#ifndef LKCOBOHEADER_H
+#define LKCOBOHEADER_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mfm { class Frame; }
+
+/// Position and size [Bytes] of a header field w.r.t. the beginning of the frame
+struct LKCoBoHeaderField
+{
+    uint16_t pos;
+    uint16_t size;
+};
+
+/// Header fields of a CoBo frame read by LKFrameBuilder
+struct LKCoBoHeaderLayout
+{
+    LKCoBoHeaderField frameSize;
+    LKCoBoHeaderField itemSize;
+    LKCoBoHeaderField eventTime;
+    LKCoBoHeaderField eventIdx;
+    LKCoBoHeaderField coboIdx;
+    LKCoBoHeaderField asadIdx;
+};
+
+/*
+ * Direct access to the header fields of a CoBo frame.
+ * The layout of revision 5, which is the one written by our CoBo firmware, is a compile-time constant.
+ * Layouts of other (frameType, revision) pairs are resolved by name through the frame dictionary
+ * the first time they are met and kept for the rest of the run.
+ * Reading a field then costs a few byte loads instead of a dictionary lookup per frame.
+ */
+class LKCoBoHeader
+{
+    public:
+        static constexpr uint8_t kRevision = 5;
+        static constexpr LKCoBoHeaderLayout kLayout = {
+            {1, 3}, {10, 2}, {16, 6}, {22, 4}, {26, 1}, {27, 1}
+        };
+        /// The 72 bit hit pattern of each AGET: 1 Byte for channels 64-71 followed by 8 Bytes for channels 0-63
+        static constexpr uint16_t kHitPatternPos = 31;
+        static constexpr uint16_t kHitPatternStride = 9;
+
+        LKCoBoHeader(mfm::Frame &frame);
+        /// Raw CoBo frame of revision kRevision, e.g. from a memory mapped file
+        LKCoBoHeader(const uint8_t *data) : fData(data), fLayout(&kLayout) {}
+
+        uint32_t GetFrameSize() const { return (uint32_t) Load(fLayout->frameSize); }
+        uint32_t GetItemSize()  const { return (uint32_t) Load(fLayout->itemSize); }
+        uint64_t GetEventTime() const { return Load(fLayout->eventTime); }
+        uint32_t GetEventIdx()  const { return (uint32_t) Load(fLayout->eventIdx); }
+        uint32_t GetCoboIdx()   const { return (uint32_t) Load(fLayout->coboIdx); }
+        uint32_t GetAsadIdx()   const { return (uint32_t) Load(fLayout->asadIdx); }
+
+        /// Hit pattern of channels 0-63 of the given AGET
+        uint64_t GetHitPatternLow(int agetIdx) const {
+            return Load({(uint16_t) (kHitPatternPos + kHitPatternStride*agetIdx + 1), 8});
+        }
+        /// Hit pattern of channels 64-71 of the given AGET
+        uint64_t GetHitPatternHigh(int agetIdx) const {
+            return Load({(uint16_t) (kHitPatternPos + kHitPatternStride*agetIdx), 1});
+        }
+
+    private:
+        uint64_t Load(LKCoBoHeaderField field) const {
+            uint64_t value = 0;
+            for (int i=0; i<field.size; ++i)
+                value = (value << 8) | fData[field.pos + i];
+            return value;
+        }
+
+        static const LKCoBoHeaderLayout* FindLayout(mfm::Frame &frame);
+
+    private:
+        const uint8_t *fData;
+        const LKCoBoHeaderLayout *fLayout;
+};
+
+#endif
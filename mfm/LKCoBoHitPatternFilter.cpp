@@ -0,0 +1,63 @@
+#include "LKCoBoHitPatternFilter.h"
+#include "LKCoBoHeader.h"
+
+#include <sstream>
+#include <vector>
+
+/// Decimal index without sign, so that "-1" is not taken for all AGETs
+static bool ParseIndex(const std::string &field, uint32_t &index)
+{
+    if (field.empty() || field.size() > 9 || field.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    index = std::stoul(field);
+    return true;
+}
+
+bool LKCoBoHitPatternFilter::AddRule(const std::string &rule)
+{
+    std::vector<std::string> fields;
+    std::istringstream stream(rule);
+    std::string field;
+    while (std::getline(stream, field, ':'))
+        fields.push_back(field);
+    if (fields.size() != 4 || fields[3].empty() || fields[3].size() > 18)
+        return false;
+
+    uint32_t cobo, asad, aget = 0;
+    bool const allAgets = (fields[2] == "*");
+    if (!ParseIndex(fields[0], cobo) || !ParseIndex(fields[1], asad) || (!allAgets && !ParseIndex(fields[2], aget)))
+        return false;
+    if (cobo >= kMaxCobo || asad >= kMaxAsad || aget > 3)
+        return false;
+
+    // Last 16 hexadecimal digits are channels 0-63, the at most 2 before are channels 64-71.
+    // Only hex digits: stoull would also take a sign ("-1" for all channels) or a 0x prefix.
+    const std::string &hex = fields[3];
+    if (hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+        return false;
+    size_t const split = hex.size() > 16 ? hex.size() - 16 : 0;
+    if (split > 2)
+        return false;
+    uint64_t const low = std::stoull(hex.substr(split), nullptr, 16);
+    uint64_t const high = split > 0 ? std::stoull(hex.substr(0, split), nullptr, 16) : 0;
+
+    for (uint32_t a=0; a<4; ++a) {
+        if (!allAgets && a != aget)
+            continue;
+        fMaskLow[cobo][asad][a] |= low;
+        fMaskHigh[cobo][asad][a] |= (uint8_t) high;
+    }
+    fActive = true;
+    return true;
+}
+
+bool LKCoBoHitPatternFilter::Pass(uint32_t coboIdx, uint32_t asadIdx, const LKCoBoHeader &header) const
+{
+    if (coboIdx >= kMaxCobo || asadIdx >= kMaxAsad)
+        return false;
+    for (int aget=0; aget<4; ++aget)
+        if ((header.GetHitPatternLow(aget) & fMaskLow[coboIdx][asadIdx][aget])
+            || (header.GetHitPatternHigh(aget) & fMaskHigh[coboIdx][asadIdx][aget]))
+            return true;
+    return false;
+}
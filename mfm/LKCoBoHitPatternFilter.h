@@ -0,0 +1,37 @@
+#ifndef LKCOBOHITPATTERNFILTER_H
+#define LKCOBOHITPATTERNFILTER_H
+
+#include <string>
+#include <cstdint>
+
+class LKCoBoHeader;
+
+/*
+ * Pre-trigger filter on the AGET hit patterns of the CoBo frame headers.
+ * Each rule "cobo:asad:aget:mask" (aget may be *) gives a 72 bit channel mask in hexadecimal,
+ * channel 0 being the lowest bit, e.g. 1:0:*:EFFEFFDFFFFFBFF7FF for the Si channels without FPN (SiMask).
+ * A frame passes if any of its AGETs has a hit channel inside the mask of its (cobo, asad, aget),
+ * and LKFrameBuilder keeps or drops all frames of an event together: the event passes if any of its frames does.
+ * Masks of rules on the same AGET are merged when they are added, so a frame costs at most four 64+8 bit ANDs.
+ */
+class LKCoBoHitPatternFilter
+{
+    public:
+        LKCoBoHitPatternFilter() {}
+
+        /// Returns false if the rule cannot be parsed
+        bool AddRule(const std::string &rule);
+        bool IsActive() const { return fActive; }
+
+        bool Pass(uint32_t coboIdx, uint32_t asadIdx, const LKCoBoHeader &header) const;
+
+    private:
+        static const uint32_t kMaxCobo = 32;
+        static const uint32_t kMaxAsad = 4;
+
+        bool fActive = false;
+        uint64_t fMaskLow[kMaxCobo][kMaxAsad][4] = {};   ///< channels 0-63
+        uint8_t  fMaskHigh[kMaxCobo][kMaxAsad][4] = {};  ///< channels 64-71
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "LKDeconvolutionEngine.h"
+
+#include <cmath>
+#include <algorithm>
+
+void LKDeconvolutionEngine::SetSize(int responseLength)
+{
+    if (responseLength == fResponseLength)
+        return;
+    fResponseLength = responseLength;
+    fSize = 1;
+    int numBits = 0;
+    while (fSize < 2*responseLength) {
+        fSize <<= 1;
+        ++numBits;
+    }
+
+    fBitReversed.assign(fSize, 0);
+    for (int i=0; i<fSize; ++i)
+        for (int bit=0; bit<numBits; ++bit)
+            if (i & (1 << bit))
+                fBitReversed[i] |= 1 << (numBits - 1 - bit);
+
+    fTwiddles.resize(fSize/2);
+    for (int i=0; i<fSize/2; ++i)
+        fTwiddles[i] = std::polar(1., -2. * M_PI * i / fSize);
+
+    fWork.assign(fSize, 0);
+    fFilters.clear();
+    fShifts.clear();
+}
+
+/// In place radix-2 FFT of fSize points, without the 1/fSize of the inverse
+void LKDeconvolutionEngine::Transform(std::complex<double> *data, bool inverse) const
+{
+    for (int i=0; i<fSize; ++i)
+        if (i < fBitReversed[i])
+            std::swap(data[i], data[fBitReversed[i]]);
+
+    for (int half=1; half<fSize; half<<=1) {
+        int const stride = fSize / (2*half);
+        for (int first=0; first<fSize; first+=2*half) {
+            for (int i=0; i<half; ++i) {
+                std::complex<double> twiddle = fTwiddles[i*stride];
+                if (inverse)
+                    twiddle = std::conj(twiddle);
+                std::complex<double> const odd = data[first+i+half] * twiddle;
+                data[first+i+half] = data[first+i] - odd;
+                data[first+i] += odd;
+            }
+        }
+    }
+}
+
+void LKDeconvolutionEngine::SetResponse(int type, const double *response, int length)
+{
+    if (type < 0 || length <= 0)
+        return;
+    SetSize(length);
+    if (type >= (int) fFilters.size()) {
+        fFilters.resize(type+1);
+        fShifts.resize(type+1, 0);
+    }
+
+    std::fill(fWork.begin(), fWork.end(), 0);
+    int shift = 0;
+    for (int i=0; i<length; ++i) {
+        fWork[i] = response[i];
+        if (response[i] > response[shift])
+            shift = i;
+    }
+    fShifts[type] = shift;
+    Transform(fWork.data(), false);
+
+    double maxPower = 0;
+    for (int i=0; i<fSize; ++i)
+        maxPower = std::max(maxPower, std::norm(fWork[i]));
+    auto &filter = fFilters[type];
+    filter.assign(fSize, 0);
+    if (maxPower == 0)
+        return;
+    double const epsilon = fRegularization * maxPower;
+    for (int i=0; i<fSize; ++i)
+        filter[i] = std::conj(fWork[i]) / ((std::norm(fWork[i]) + epsilon) * fSize);
+}
+
+void LKDeconvolutionEngine::Deconvolve(int type, double *const *waveforms, int numWaveforms, int length)
+{
+    if (!HasResponse(type))
+        return;
+    length = std::min(length, fResponseLength);
+    auto const &filter = fFilters[type];
+    int const shift = fShifts[type];
+
+    // The filter is the spectrum of a real kernel, so two real waveforms deconvolve as one complex waveform
+    for (int pair=0; pair<numWaveforms; pair+=2) {
+        double *real = waveforms[pair];
+        double *imag = (pair+1 < numWaveforms) ? waveforms[pair+1] : nullptr;
+        for (int i=0; i<length; ++i)
+            fWork[i] = std::complex<double>(real[i], imag ? imag[i] : 0.);
+        std::fill(fWork.begin() + length, fWork.end(), 0);
+
+        Transform(fWork.data(), false);
+        for (int i=0; i<fSize; ++i)
+            fWork[i] *= filter[i];
+        Transform(fWork.data(), true);
+
+        for (int i=0; i<length; ++i) {
+            int const from = i - shift;
+            std::complex<double> const value = (from >= 0) ? fWork[from] : 0.;
+            real[i] = std::max(value.real(), 0.);
+            if (imag)
+                imag[i] = std::max(value.imag(), 0.);
+        }
+    }
+}
@@ -0,0 +1,173 @@
+#include "LKEventReorderBuffer.h"
+#include "LKCoBoHeader.h"
+#include "mfm/Frame.h"
+
+#include <sstream>
+#include <algorithm>
+
+LKEventReorderBuffer::LKEventReorderBuffer()
+{
+}
+
+LKEventReorderBuffer::~LKEventReorderBuffer()
+{
+    Clear();
+}
+
+bool LKEventReorderBuffer::AddExpected(const std::string &pattern)
+{
+    uint32_t fields[2];
+    bool any[2];
+    std::istringstream stream(pattern);
+    std::string field;
+    for (int i=0; i<2; ++i) {
+        if (!std::getline(stream, field, ':') || field.empty())
+            return false;
+        any[i] = (field == "*");
+        if (!any[i]) {
+            size_t end = 0;
+            try { fields[i] = std::stoul(field, &end); }
+            catch (const std::exception&) { return false; }
+            if (end != field.size() || fields[i] >= (i == 0 ? kMaxCobo : kMaxAsad))
+                return false;
+        }
+    }
+    if (std::getline(stream, field))
+        return false;
+
+    for (uint32_t cobo=0; cobo<kMaxCobo; ++cobo)
+        for (uint32_t asad=0; asad<kMaxAsad; ++asad)
+            if ((any[0] || fields[0] == cobo) && (any[1] || fields[1] == asad))
+                fExpected.set(cobo*kMaxAsad + asad);
+    return true;
+}
+
+bool LKEventReorderBuffer::Add(mfm::Frame &frame)
+{
+    LKCoBoHeader header(frame);
+    uint32_t const eventIdx = header.GetEventIdx();
+    if (fEmitted && int32_t(eventIdx - fLastEmittedIdx) <= 0) {
+        ++fNumLateFrames;
+        return false;
+    }
+
+    auto inserted = fEvents.emplace(eventIdx, OpenEvent());
+    OpenEvent &event = inserted.first->second;
+    if (inserted.second && fTimeout > 0)
+        event.firstFrameTime = std::chrono::steady_clock::now();
+    ReleaseHook release;
+    if (fRetainCallback)
+        release = fRetainCallback(frame);
+    if (release)
+        event.frames.emplace_back(new mfm::Frame(frame));
+    else
+        event.frames.emplace_back(CopyFrame(frame, release));
+    event.releases.push_back(release);
+    uint32_t const coboIdx = header.GetCoboIdx();
+    uint32_t const asadIdx = header.GetAsadIdx();
+    if (coboIdx < kMaxCobo && asadIdx < kMaxAsad)
+        event.received.set(coboIdx*kMaxAsad + asadIdx);
+    if (fEvents.size() > fMaxOpenEvents)
+        fMaxOpenEvents = fEvents.size();
+
+    EmitReady();
+    return true;
+}
+
+void LKEventReorderBuffer::Flush()
+{
+    while (!fEvents.empty())
+        Emit(fEvents.begin());
+}
+
+void LKEventReorderBuffer::Clear()
+{
+    for (auto &event : fEvents) {
+        event.second.frames.clear();
+        Release(event.second.releases);
+    }
+    fEvents.clear();
+}
+
+/// Copies the frame to the current slab, or to a slab whose frames were all released if it is full
+mfm::Frame *LKEventReorderBuffer::CopyFrame(mfm::Frame &frame, ReleaseHook &release)
+{
+    size_t const size = frame.header().frameSize_B();
+    if (fCurrent == nullptr || fCurrent->tail + size > fCurrent->capacity) {
+        fCurrent = nullptr;
+        for (auto &slab : fSlabs) {
+            if (slab->numFrames == 0 && slab->capacity >= size) {
+                fCurrent = slab.get();
+                break;
+            }
+        }
+        if (fCurrent == nullptr) {
+            fSlabs.emplace_back(new Slab());
+            fCurrent = fSlabs.back().get();
+            fCurrent->capacity = std::max(kSlabSize, size);
+            fCurrent->data.setCapacity(fCurrent->capacity);
+            fCurrent->data.set_size_B(fCurrent->capacity);
+        }
+        fCurrent->tail = 0;
+    }
+
+    Slab *slab = fCurrent;
+    size_t const offset = slab->tail;
+    slab->data.read(size, frame.data(), offset);
+    slab->tail += size;
+    ++slab->numFrames;
+    release = [slab]() {
+        if (--slab->numFrames == 0)
+            slab->tail = 0;
+    };
+    return new mfm::Frame(mfm::Serializer(slab->data, size, offset));
+}
+
+/// Runs the release hooks once the views of their frames are gone
+void LKEventReorderBuffer::Release(std::vector<ReleaseHook> &releases)
+{
+    for (auto &release : releases)
+        release();
+    releases.clear();
+}
+
+/// Emits the oldest events as long as they are complete, overflow the window or timed out
+void LKEventReorderBuffer::EmitReady()
+{
+    bool const checkComplete = fExpected.any();
+    auto const now = (fTimeout > 0) ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    while (!fEvents.empty())
+    {
+        auto event = fEvents.begin();
+        bool const complete = checkComplete && (event->second.received & fExpected) == fExpected;
+        bool const overflow = fEvents.size() > (size_t) fWindow;
+        bool const timedOut = fTimeout > 0 && std::chrono::duration<double>(now - event->second.firstFrameTime).count() >= fTimeout;
+        if (!complete && !overflow && !timedOut)
+            break;
+        Emit(event);
+    }
+}
+
+void LKEventReorderBuffer::Emit(EventMap::iterator event)
+{
+    if (fExpected.any() && (event->second.received & fExpected) != fExpected)
+        ++fNumIncompleteEvents;
+    uint32_t const eventIdx = event->first;
+    FrameList frames = std::move(event->second.frames);
+    std::vector<ReleaseHook> releases = std::move(event->second.releases);
+    fEvents.erase(event);
+
+    fEmitted = true;
+    fLastEmittedIdx = eventIdx;
+    ++fNumEvents;
+    try {
+        if (fEmitCallback)
+            fEmitCallback(eventIdx, frames);
+    }catch (...){
+        frames.clear();
+        Release(releases);
+        throw;
+    }
+    frames.clear();
+    Release(releases);
+}
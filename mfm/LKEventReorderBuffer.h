@@ -0,0 +1,116 @@
+#ifndef LKEVENTREORDERBUFFER_H
+#define LKEVENTREORDERBUFFER_H
+
+#include <map>
+#include <bitset>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+#include "mfm/Serializer.h"
+
+namespace mfm { class Frame; }
+
+/*
+ * Collects the CoBo (sub) frames of each eventIdx across all CoBos and AsAds before they are unpacked,
+ * so that interleaved or slightly out of order frames do not split an event.
+ * Events are handed to the emit callback as a whole and in increasing eventIdx, the oldest open event being emitted
+ * - when all expected (cobo, asad) pairs have sent a frame (if an expected set is given),
+ * - when more than window events are open, or
+ * - when it has been open longer than the timeout (if a timeout is given).
+ * Frames of an event which was already emitted are late: they are counted and dropped.
+ * The timeout is checked when a frame is added and by Poll(), which the reader calls while it waits for data.
+ * eventIdx is compared as a serial number (RFC 1982), so the order survives the wrap of the 32 bit counter
+ * as long as the open events span less than 2^31 eventIdx.
+ * Frames are held as views with a release hook, which runs once their event is emitted: in place if the retain
+ * callback of the source keeps them (e.g. the slabs of LKMFMFrameSplitter), otherwise in slabs of the buffer
+ * they are copied to, which are reused once their frames are released.
+ */
+class LKEventReorderBuffer
+{
+    public:
+        typedef std::vector<std::unique_ptr<mfm::Frame>> FrameList;
+        typedef std::function<void()> ReleaseHook;
+
+        LKEventReorderBuffer();
+        virtual ~LKEventReorderBuffer();
+
+        /// Maximum number of open events, 0 to pass the frames through without buffering
+        void SetWindow(int numEvents) { fWindow = numEvents; }
+        void SetTimeout(double seconds) { fTimeout = seconds; }
+        /// "cobo:asad" pattern (fields may be *) of the AsAds every complete event has a frame from
+        bool AddExpected(const std::string &pattern);
+        void SetEmitCallback(std::function<void(uint32_t, FrameList &)> callback) { fEmitCallback = callback; }
+        /// Called by Add to keep the bytes of the frame valid after the call. Returns the hook releasing them,
+        /// or an empty hook if they cannot be kept, in which case the frame is copied
+        void SetRetainCallback(std::function<ReleaseHook(mfm::Frame &)> callback) { fRetainCallback = callback; }
+        bool IsActive() const { return fWindow > 0; }
+
+        /// Keeps a view of the frame. Returns false if the frame is late and dropped.
+        bool Add(mfm::Frame &frame);
+        /// Emits the events which timed out while no frame was added
+        void Poll() { EmitReady(); }
+        /// Emits every open event
+        void Flush();
+        /// Drops every open event, e.g. before the source of the retained frames goes away
+        void Clear();
+
+        uint64_t GetNumEvents() const { return fNumEvents; }
+        uint64_t GetNumIncompleteEvents() const { return fNumIncompleteEvents; }
+        uint64_t GetNumLateFrames() const { return fNumLateFrames; }
+        size_t GetMaxOpenEvents() const { return fMaxOpenEvents; }
+
+    private:
+        static const uint32_t kMaxCobo = 32;
+        static const uint32_t kMaxAsad = 4;
+
+        /// a before b in serial number arithmetic
+        struct SerialLess {
+            bool operator()(uint32_t a, uint32_t b) const { return int32_t(a - b) < 0; }
+        };
+
+        /// Buffer the frames which cannot be retained are copied to
+        struct Slab {
+            mfm::Serializer data{0};
+            size_t capacity = 0;
+            size_t tail = 0; ///< byte after the last frame copied
+            int numFrames = 0; ///< frames not yet released
+        };
+        static const size_t kSlabSize = 1u << 20;
+
+        struct OpenEvent {
+            FrameList frames;
+            std::vector<ReleaseHook> releases;
+            std::bitset<kMaxCobo*kMaxAsad> received;
+            std::chrono::steady_clock::time_point firstFrameTime;
+        };
+
+        void EmitReady();
+        typedef std::map<uint32_t, OpenEvent, SerialLess> EventMap;
+
+        void Emit(EventMap::iterator event);
+        mfm::Frame *CopyFrame(mfm::Frame &frame, ReleaseHook &release);
+        static void Release(std::vector<ReleaseHook> &releases);
+
+        int fWindow = 0;
+        double fTimeout = 0; ///< [s], 0 for no timeout
+        std::bitset<kMaxCobo*kMaxAsad> fExpected;
+        std::function<void(uint32_t, FrameList &)> fEmitCallback;
+        std::function<ReleaseHook(mfm::Frame &)> fRetainCallback;
+        std::vector<std::unique_ptr<Slab>> fSlabs;
+        Slab *fCurrent = nullptr; ///< slab the frames are copied to
+
+        EventMap fEvents;
+        bool fEmitted = false;
+        uint32_t fLastEmittedIdx = 0;
+
+        uint64_t fNumEvents = 0;
+        uint64_t fNumIncompleteEvents = 0;
+        uint64_t fNumLateFrames = 0;
+        size_t fMaxOpenEvents = 0;
+};
+
+#endif
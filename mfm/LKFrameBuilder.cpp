@@ -6,11 +6,16 @@
 #include "mfm/Field.h"
 #include "mfm/Frame.h"
 #include "mfm/FrameBuilder.h"
+#include "mfm/SlabFrameBuilder.h"
+#include "mfm/LKCoBoFrameDecoder.h"
+#include "mfm/LKCoBoHeader.h"
 #include "mfm/FrameDictionary.h"
 #include "mfm/Item.h"
 #include <sstream>
+#include <mutex>
 #include <cstdio>
 #include <boost/utility/binary.hpp>
+#include <TBranch.h>
 const int no_cobos=3;
 using namespace std;
 
@@ -90,9 +95,35 @@ MapChanToX6::~MapChanToX6() {
 
 LKFrameBuilder::LKFrameBuilder(int port) {
     spectra_ = new GSpectra();
-    serv_ = new GNetServerRoot(port,spectra_);
-
-    serv_->StartServer();
+    serv_ = nullptr;
+
+    // port <= 0 : no histogram server, e.g. for the builders of a sharded conversion
+    if(port>0){
+        serv_ = new GNetServerRoot(port,spectra_);
+        serv_->StartServer();
+    }
+
+    // Events of the reorder buffer arrive as a whole, so UnpackFrame sees their frames back to back
+    // and an event failing the hit pattern filter is dropped before any of its frames is unpacked
+    fEventBuffer.SetEmitCallback([this](uint32_t, LKEventReorderBuffer::FrameList &frames) {
+        if(fHitPatternFilter.IsActive()){
+            bool passed = false;
+            for(size_t i=0;i<frames.size() && !passed;i++){
+                LKCoBoHeader header(*frames[i]);
+                passed = fHitPatternFilter.Pass(header.GetCoboIdx(), header.GetAsadIdx(), header);
+            }
+            if(!passed){
+                ++fNumFilteredEvents;
+                return;
+            }
+        }
+        for(size_t i=0;i<frames.size();i++){
+            waveforms->frameIdx = i;
+            UnpackFrame(*frames[i]);
+            RootWConvert();
+            ResetWaveforms();
+        }
+    });
 }
 
 LKFrameBuilder::~LKFrameBuilder() {
@@ -121,12 +152,21 @@ void LKFrameBuilder::processFrame(mfm::Frame &frame)
         goodsievt=1;
         goodicevt=1;
 
+        // An event-built (layered) frame is a whole event: if none of its sub-frames passes, it is neither unpacked nor converted
+        if(fHitPatternFilter.IsActive() && frame.header().isLayeredFrame() && !fHitPatternPassed){
+            ++fNumFilteredEvents;
+            return;
+        }
+
         if(goodsievt==1)
         {
             goodmmevt=1;
             //XXX
             Event(frame);
         }
+
+        // The frame counts for the event it was unpacked into, after the previous event was written
+        if(fHitPatternPassed) fEventHitPatternPassed = true;
     }
 }
 
@@ -142,9 +182,11 @@ void LKFrameBuilder::Init(int mode, int d2pmode) {
     enablehist = 0;
     enableupdatefast = 0;
     maxasad = 4;
+    InitCorrPolarity();
     FirsteventIdx = 0;
     IsFirstevent = true;
     LasteventIdx = 0;
+    reventIdx = 0;
     weventIdx = 0;
     weventTime = 0;
     coboIC=2;
@@ -186,41 +228,28 @@ void LKFrameBuilder::Init(int mode, int d2pmode) {
     cout<<"MODE: "<<mode<<endl;
 
     if(mode==1){
-        mfm::FrameDictionary::instance().addFormats("/usr/local/get/share/get-bench/format/CoboFormats.xcfg");
+        // The dictionary is shared by all builders
+        static std::once_flag formatsAdded;
+        std::call_once(formatsAdded, []() {
+            mfm::FrameDictionary::instance().addFormats("/usr/local/get/share/get-bench/format/CoboFormats.xcfg");
+        });
         waveforms = new WaveForms();
         InitWaveforms();
     }
 }
 
 void LKFrameBuilder::InitWaveforms() {
-    waveforms->waveform.resize(maxasad*4);
-    waveforms->hasSignal.resize(maxasad*4);
+    // The conversion keeps the samples of the fired channels only, see LKWaveformArena
+    waveforms->arena.Init(maxasad*4, 68, bucketmax);
     waveforms->hasHit.resize(maxasad*4); //default set to false
     waveforms->hasFPN.resize(maxasad*4); //default set to false
     waveforms->doneFPN.resize(maxasad*4); //default set to false
-    for(int i=0;i<maxasad;i++){
-        for(int j=0;j<4;j++){
-            waveforms->waveform[i*4+j].resize(68);
-            waveforms->hasSignal[i*4+j].resize(68); //default set to false
-            for(int k=0;k<68;k++){
-                waveforms->waveform[i*4+j][k].resize(bucketmax);
-            }
-        }
-    }
 }
 
 void LKFrameBuilder::ResetWaveforms() {
+    waveforms->arena.Reset();
     for(int i=0;i<maxasad;i++){
         for(int j=0;j<4;j++){
-            if(waveforms->hasHit[i*4+j] || waveforms->hasFPN[i*4+j]){
-                for(int k=0;k<68;k++){
-                    if(waveforms->hasSignal[i*4+j][k]){
-                        waveforms->hasSignal[i*4+j][k] = false;
-                        fill(waveforms->waveform[i*4+j][k].begin(),
-                                waveforms->waveform[i*4+j][k].end(),0);
-                    }
-                }
-            }
             waveforms->hasHit[i*4+j] = false;
             waveforms->hasFPN[i*4+j] = false;
             waveforms->doneFPN[i*4+j] = false;
@@ -238,19 +267,14 @@ void LKFrameBuilder::ResetWaveforms() {
 void LKFrameBuilder::ValidateEvent(mfm::Frame& frame)
 {
     lk_debug << "[ValidateEvent]" << endl;
+    fHitPatternPassed = false;
     if(frame.header().isLayeredFrame()) {
-        unique_ptr<mfm::Frame> subFrame;
         for(int i = 0;i<frame.itemCount();i++) {
             try{
-                try{
-                    subFrame = frame.frameAt(i);
-                }catch (const std::exception& e){
-                    lk_debug << "error" << endl;
-                    cout << e.what() << endl;
-                    return;
-                }
-                if((*subFrame.get()).itemCount()>0){ //Make sure we have data
-                    ValidateFrame(*subFrame.get());
+                // View into the event buffer, the sub-frame is not copied
+                mfm::Frame subFrame = frame.frameViewAt(i);
+                if(subFrame.itemCount()>0){ //Make sure we have data
+                    ValidateFrame(subFrame);
                 }else{
                     //cout << "1no subframe" << endl;
                 }
@@ -269,9 +293,10 @@ void LKFrameBuilder::ValidateEvent(mfm::Frame& frame)
 
 void LKFrameBuilder::ValidateFrame(mfm::Frame& frame)
 {
-    UInt_t coboIdx = frame.headerField("coboIdx").value<UInt_t>();
-    UInt_t asadIdx = frame.headerField("asadIdx").value<UInt_t>();
-    UInt_t ceventIdx = (Int_t)frame.headerField("eventIdx").value<UInt_t>();
+    LKCoBoHeader header(frame);
+    UInt_t coboIdx = header.GetCoboIdx();
+    UInt_t asadIdx = header.GetAsadIdx();
+    UInt_t ceventIdx = (Int_t)header.GetEventIdx();
 
     //unsigned short SiMask = BOOST_BINARY( 111011111111111011111111110111111111111111111111101111111111011111111111 );
     ULong_t SiMask = 0xFEFFDFFFFFBFF7FF; //LSB 8byte
@@ -283,10 +308,13 @@ void LKFrameBuilder::ValidateFrame(mfm::Frame& frame)
     ULong_t IcMask = 0x13; // Channel 19
 
     //cout << coboIdx << " " << asadIdx << "(LSB):" << endl;
-    ULong_t hitPat_0 = frame.headerField(32u, 8u).value<ULong_t>();
-    ULong_t hitPat_1 = frame.headerField(41u, 8u).value<ULong_t>();
-    ULong_t hitPat_2 = frame.headerField(50u, 8u).value<ULong_t>();
-    ULong_t hitPat_3 = frame.headerField(59u, 8u).value<ULong_t>();
+    if(fHitPatternFilter.IsActive() && !fHitPatternPassed)
+        fHitPatternPassed = fHitPatternFilter.Pass(coboIdx, asadIdx, header);
+
+    ULong_t hitPat_0 = header.GetHitPatternLow(0);
+    ULong_t hitPat_1 = header.GetHitPatternLow(1);
+    ULong_t hitPat_2 = header.GetHitPatternLow(2);
+    ULong_t hitPat_3 = header.GetHitPatternLow(3);
     //cout << "HitPattern 0: " << hex << hitPat_0 << endl;
     //cout << "HitPattern 1: " << hex << hitPat_1 << endl;
     //cout << "HitPattern 2: " << hex << hitPat_2 << endl;
@@ -308,10 +336,10 @@ void LKFrameBuilder::ValidateFrame(mfm::Frame& frame)
     }
 
     //cout << coboIdx << " " << asadIdx << "(USB):" << endl;
-    hitPat_0 = frame.headerField(31u, 1u).value<ULong_t>();
-    hitPat_1 = frame.headerField(40u, 1u).value<ULong_t>();
-    hitPat_2 = frame.headerField(49u, 1u).value<ULong_t>();
-    hitPat_3 = frame.headerField(58u, 1u).value<ULong_t>();
+    hitPat_0 = header.GetHitPatternHigh(0);
+    hitPat_1 = header.GetHitPatternHigh(1);
+    hitPat_2 = header.GetHitPatternHigh(2);
+    hitPat_3 = header.GetHitPatternHigh(3);
     //cout << "HitPattern 0: " << hex << hitPat_0 << endl;
     //cout << "HitPattern 1: " << hex << hitPat_1 << endl;
     //cout << "HitPattern 2: " << hex << hitPat_2 << endl;
@@ -351,11 +379,16 @@ void LKFrameBuilder::Event(mfm::Frame& frame)
             waveforms->frameIdx = 0;
             waveforms->decayIdx = 0;
             try{
-                auto_ptr<mfm::Frame> subFrame = frame.frameAt(i);
-                if((*subFrame.get()).itemCount()>0){ //Make sure we have data
+                mfm::Frame subFrame = frame.frameViewAt(i);
+                if(subFrame.itemCount()>0){ //Make sure we have data
+                    if(!RouteFrame(subFrame)) continue;
+                    if(fEventBuffer.IsActive()){
+                        fEventBuffer.Add(subFrame);
+                        continue;
+                    }
                     //cout << "2isLayered=" << frame.header().isLayeredFrame() << ", itemCount=" << frame.itemCount() << ", frameIndex=" << i << endl;
                     waveforms->frameIdx = i;
-                    UnpackFrame(*subFrame.get());
+                    UnpackFrame(subFrame);
                     RootWConvert();
                     ResetWaveforms();
                 }else{
@@ -369,6 +402,11 @@ void LKFrameBuilder::Event(mfm::Frame& frame)
     } else {
         try{
             if(frame.itemCount()>0){ //Make sure we have data
+                if(!RouteFrame(frame)) return;
+                if(fEventBuffer.IsActive()){
+                    fEventBuffer.Add(frame);
+                    return;
+                }
                 //cout << "Not Layered Frame" << endl;
                 UnpackFrame(frame);
                 RootWConvert();
@@ -383,17 +421,28 @@ void LKFrameBuilder::Event(mfm::Frame& frame)
     }
 }
 
+/// Returns false if the frame router drops or diverts the frame, which is then not unpacked at all
+bool LKFrameBuilder::RouteFrame(mfm::Frame& frame)
+{
+    if(!fFrameRouter.IsActive()) return true;
+    LKCoBoHeader header(frame);
+    auto action = fFrameRouter.Route(header.GetCoboIdx(), header.GetAsadIdx(), frame.header().frameType());
+    if(action==LKCoBoFrameRouter::kDivert && fDivertCallback) fDivertCallback(frame);
+    return action==LKCoBoFrameRouter::kKeep;
+}
+
 void LKFrameBuilder::UnpackFrame(mfm::Frame& frame)
 {
     //XXX
-    UInt_t coboIdx = frame.headerField("coboIdx").value<UInt_t>();
-    UInt_t asadIdx = frame.headerField("asadIdx").value<UInt_t>();
+    LKCoBoHeader header(frame);
+    UInt_t coboIdx = header.GetCoboIdx();
+    UInt_t asadIdx = header.GetAsadIdx();
     Int_t prevweventIdx = weventIdx;
-    UInt_t frameSize = frame.headerField("frameSize").value<UInt_t>();
-    UInt_t itemSize = frame.headerField("itemSize").value<UInt_t>();
-    weventIdx = (Int_t)frame.headerField("eventIdx").value<UInt_t>();
+    UInt_t frameSize = header.GetFrameSize();
+    UInt_t itemSize = header.GetItemSize();
+    weventIdx = (Int_t)header.GetEventIdx();
     UInt_t prevweventTime = weventTime;
-    weventTime = (UInt_t)frame.headerField("eventTime").value<UInt_t>();
+    weventTime = (UInt_t)header.GetEventTime();
     //cout<<"weventIdx=" << weventIdx << ", prevweventIdx+1=" << (prevweventIdx+1) << endl;
     //if(weventIdx>prevweventIdx+1) return;
     if(IsFirstevent){
@@ -471,23 +520,13 @@ void LKFrameBuilder::UnpackFrame(mfm::Frame& frame)
     //    return;
     //  }
 
-    mfm::Item item = frame.itemAt(0u);
-    mfm::Field field = item.field("");
-
     const size_t numSamples = frame.itemCount();
 
     const size_t numChannels = 68u;
     const size_t numChips = 4u;
-    vector<uint32_t> chanIdx_(numChips, 0u);
-    vector<uint32_t> buckIdx_(numChips, 0u);
+    uint32_t chanIdx_[numChips] = {0u, 0u, 0u, 0u};
+    uint32_t buckIdx_[numChips] = {0u, 0u, 0u, 0u};
     if(frame.header().frameType() == 1u) {
-        mfm::Item item = frame.itemAt(0u);
-        mfm::Field field = item.field("");
-        mfm::BitField agetIdxField = field.bitField("agetIdx");
-        mfm::BitField chanIdxField = field.bitField("chanIdx");
-        mfm::BitField buckIdxField = field.bitField("buckIdx");
-        mfm::BitField sampleValueField = field.bitField("sample");
-
         if(enable2pmode==1){
             if(IsTrig[coboIdx*4+asadIdx]>0){
                 IsTrig[coboIdx*4+asadIdx]=2;
@@ -501,33 +540,33 @@ void LKFrameBuilder::UnpackFrame(mfm::Frame& frame)
             waveforms->decayIdx = 0;
         }
         //cout << "Type:" << frame.header().frameType() << " " <<  weventIdx << "  " << frameSize << " " << coboIdx << " " << asadIdx << " " << waveforms->frameIdx << " " << waveforms->decayIdx << " " << frame.itemCount() << endl;
-        int lastaget=-1;
-        for(UInt_t i=0; i<frame.itemCount(); i++) {
-            item = frame.itemAt(i);
-            field = item.field(field);
-            agetIdxField = field.bitField(agetIdxField);
-            chanIdxField = field.bitField(chanIdxField);
-            buckIdxField = field.bitField(buckIdxField);
-            sampleValueField =field.bitField(sampleValueField);
-
-            UInt_t agetIdx = agetIdxField.value<UInt_t>();
-            //if(agetIdx==lastaget) break;
-            lastaget=agetIdx;
-            if(agetIdx<0 || agetIdx>3) return;
-            UInt_t chanIdx = chanIdxField.value<UInt_t>();
-            UInt_t buckIdx = buckIdxField.value<UInt_t>();
-            UInt_t sampleValue = sampleValueField.value<UInt_t>();
-
+        if(numSamples>0) {
             waveforms->coboIdx = coboIdx;
             waveforms->asadIdx = asadIdx;
-
-            if((ignoremm==0) || (ignoremm==1 && coboIdx>0)){ // skip MM waveform data
-                waveforms->hasSignal[asadIdx*4+agetIdx][chanIdx] = true;
-                //      cout<<"BEEP "<<coboIdx<<"\t"<<asadIdx<<"\t"<<agetIdx<<"\t"<<chanIdx<<endl;
-                if((chanIdx==11||chanIdx==22||chanIdx==45||chanIdx==56)) waveforms->hasFPN[asadIdx*4+agetIdx] = true;
-                else waveforms->hasHit[asadIdx*4+agetIdx] = true;
-                waveforms->waveform[asadIdx*4+agetIdx][chanIdx][buckIdx] = sampleValue;
-                //cout << "Type:" << frame.header().frameType() << " " <<  weventIdx << "  " << frameSize << " " << coboIdx << " " << asadIdx << " " << agetIdx << " " << chanIdx << " " << buckIdx <<  " " << sampleValue << endl;
+        }
+        if((ignoremm==0) || (ignoremm==1 && coboIdx>0)){ // skip MM waveform data
+            // Zero-suppressed items carry their own channel and bucket, scatter them as decoded
+            const uint8_t *itemData = frame.data() + frame.header().headerSize_B();
+            uint16_t agetBlock[LKCoBoFrameDecoder::kBlockSize];
+            uint16_t chanBlock[LKCoBoFrameDecoder::kBlockSize];
+            uint16_t buckBlock[LKCoBoFrameDecoder::kBlockSize];
+            uint16_t sampleBlock[LKCoBoFrameDecoder::kBlockSize];
+            for(size_t first=0; first<numSamples; first+=LKCoBoFrameDecoder::kBlockSize) {
+                const size_t nBlock = min(numSamples-first, LKCoBoFrameDecoder::kBlockSize);
+                LKCoBoFrameDecoder::DecodePartialReadout(itemData + 4*first, nBlock, agetBlock, chanBlock, buckBlock, sampleBlock);
+                for(size_t j=0; j<nBlock; ++j) {
+                    const uint32_t agetIdx = agetBlock[j];
+                    const uint32_t chanIdx = chanBlock[j];
+                    const uint32_t buckIdx = buckBlock[j];
+                    if(chanIdx>=numChannels || buckIdx>=(uint32_t)bucketmax) continue;
+
+                    uint16_t *row = waveforms->arena.GetRow(asadIdx*4+agetIdx, chanIdx);
+                    if(row==nullptr) continue;
+                    //      cout<<"BEEP "<<coboIdx<<"\t"<<asadIdx<<"\t"<<agetIdx<<"\t"<<chanIdx<<endl;
+                    if((chanIdx==11||chanIdx==22||chanIdx==45||chanIdx==56)) waveforms->hasFPN[asadIdx*4+agetIdx] = true;
+                    else waveforms->hasHit[asadIdx*4+agetIdx] = true;
+                    row[buckIdx] = sampleBlock[j];
+                }
             }
         }
 
@@ -546,48 +585,35 @@ void LKFrameBuilder::UnpackFrame(mfm::Frame& frame)
             waveforms->decayIdx = 0;
         }
         //cout << "Type:" << frame.header().frameType() << " " <<  weventIdx << " " << frameSize << " " << coboIdx << " " << asadIdx << " " << waveforms->frameIdx << " " << waveforms->decayIdx << " " << endl;
-        // Decode first item
         if(numSamples>0) {
-            mfm::Item item = frame.itemAt(0u);
-            mfm::Field field = item.field("");
-            mfm::BitField agetIdxField = field.bitField("agetIdx");
-            mfm::BitField sampleValueField = field.bitField("sample");
-
-            const uint32_t agetIdx = agetIdxField.value<uint32_t>();
-            const uint32_t sampleValue = sampleValueField.value<uint32_t>();
-
             waveforms->coboIdx = coboIdx;
             waveforms->asadIdx = asadIdx;
-
-            if((ignoremm==0) || (ignoremm==1 && coboIdx>0)){ // skip MM waveform data
-                waveforms->hasSignal[asadIdx*4+agetIdx][chanIdx_[agetIdx]] = true;
-                if((chanIdx_[agetIdx]==11||chanIdx_[agetIdx]==22||chanIdx_[agetIdx]==45||chanIdx_[agetIdx]==56)) waveforms->hasFPN[asadIdx*4+agetIdx] = true;
-                else waveforms->hasHit[asadIdx*4+agetIdx] = true;
-                waveforms->waveform[asadIdx*4+agetIdx][chanIdx_[agetIdx]][buckIdx_[agetIdx]] = sampleValue;
-            }
         }
-        // Loop through other items
-        for(size_t itemId=1; itemId<numSamples; ++itemId) {
-            item = frame.itemAt(itemId);
-            field = item.field(field);
-            mfm::BitField agetIdxField = field.bitField(agetIdxField);
-            mfm::BitField sampleValueField = field.bitField(sampleValueField);
-
-            if((ignoremm==0) || (ignoremm==1 && coboIdx>0)){ // skip MM waveform data
-                const uint32_t agetIdx = agetIdxField.value<uint32_t>();
-                if(chanIdx_[agetIdx]>=numChannels) {
-                    chanIdx_[agetIdx] = 0u;
-                    buckIdx_[agetIdx]++;
+        if((ignoremm==0) || (ignoremm==1 && coboIdx>0)){ // skip MM waveform data
+            // Items are decoded in blocks straight from the frame buffer and scattered
+            // in readout order: channels 0-67 of each AGET, then the next bucket.
+            const uint8_t *itemData = frame.data() + frame.header().headerSize_B();
+            uint16_t agetBlock[LKCoBoFrameDecoder::kBlockSize];
+            uint16_t sampleBlock[LKCoBoFrameDecoder::kBlockSize];
+            for(size_t first=0; first<numSamples; first+=LKCoBoFrameDecoder::kBlockSize) {
+                const size_t nBlock = min(numSamples-first, LKCoBoFrameDecoder::kBlockSize);
+                LKCoBoFrameDecoder::DecodeFullReadout(itemData + 2*first, nBlock, agetBlock, sampleBlock);
+                for(size_t j=0; j<nBlock; ++j) {
+                    const uint32_t agetIdx = agetBlock[j];
+                    if(chanIdx_[agetIdx]>=numChannels) {
+                        chanIdx_[agetIdx] = 0u;
+                        buckIdx_[agetIdx]++;
+                    }
+                    const uint32_t chanIdx = chanIdx_[agetIdx]++;
+                    const uint32_t buckIdx = buckIdx_[agetIdx];
+                    if(buckIdx>=(uint32_t)bucketmax) continue;
+
+                    uint16_t *row = waveforms->arena.GetRow(asadIdx*4+agetIdx, chanIdx);
+                    if(row==nullptr) continue;
+                    if((chanIdx==11||chanIdx==22||chanIdx==45||chanIdx==56)) waveforms->hasFPN[asadIdx*4+agetIdx] = true;
+                    else waveforms->hasHit[asadIdx*4+agetIdx] = true;
+                    row[buckIdx] = sampleBlock[j];
                 }
-                const uint32_t sampleValue = sampleValueField.value<uint32_t>();
-
-                //if(itemId>57120) cout << itemId << " " << numSamples << " " << coboIdx << " " << asadIdx << " " << agetIdx << " " << chanIdx_[agetIdx] << " " << buckIdx_[agetIdx] << " " << sampleValue << endl;
-
-                waveforms->hasSignal[asadIdx*4+agetIdx][chanIdx_[agetIdx]] = true;
-                if((chanIdx_[agetIdx]==11||chanIdx_[agetIdx]==22||chanIdx_[agetIdx]==45||chanIdx_[agetIdx]==56)) waveforms->hasFPN[asadIdx*4+agetIdx] = true;
-                else waveforms->hasHit[asadIdx*4+agetIdx] = true;
-                waveforms->waveform[asadIdx*4+agetIdx][chanIdx_[agetIdx]][buckIdx_[agetIdx]] = sampleValue;
-                chanIdx_[agetIdx]++;
             }
         }
     }
@@ -652,364 +678,283 @@ void LKFrameBuilder::RootFindEvent()
 }
 
 void LKFrameBuilder::RootReadEvent()
+{
+    RootReadBegin();
+    for(Long64_t entry=0; entry<fNumberEvents; entry++){
+        RootReadEntry(entry);
+    }
+    RootReadEnd();
+}
+
+/// Connects the input tree and prepares the response waveforms, before the entries are read
+void LKFrameBuilder::RootReadBegin()
+{
+    L1Aflag = 0;
+    fReadOldBucketMax = bucketmax;
+    if(enable2pmode==1){
+        bucketmax = bucketmax/2;
+        cout << "bucketmax set to " << bucketmax << endl;
+    }
+    RootRInit();
+    if(readmode>0){
+        SetResponseWaveform();
+        GetMaxResponseWaveform();
+        GetSigmaResponseWaveform();
+    }
+}
+
+/// Analyses one entry of the input tree. All the state it changes belongs to this builder
+void LKFrameBuilder::RootReadEntry(Long64_t entry)
 {
     Int_t frameIdx = 0;
     Int_t decayIdx = 0;
-    L1Aflag = 0;
     Int_t coboIdx = 0;
     Int_t asadIdx = 0;
     Int_t agetIdx = 0;
     Int_t chanIdx = 0;
-    UInt_t percent = 0;
-    UInt_t Entries = 1;
-    UInt_t oldbucketmax = bucketmax;
-    if(enable2pmode==1){
-        bucketmax = bucketmax/2;
-        cout << "bucketmax set to " << bucketmax << endl;
-    }
     ostringstream s4out;
     ostringstream s5out;
     ofstream f4out;
     ofstream f5out;
-    RootRInit();
+
     if(readmode>0){
-        if(fNumberEvents>0){
-            Entries = fNumberEvents;
-            percent = Entries/10;
+        fInputFile->cd();
+        fInputTree->GetEntry(entry);
+        if(RootRRecovered()){
+            if(LasteventIdx>=reventIdx) return;
+            else LasteventIdx = reventIdx;
+        }else{
+            LasteventIdx = reventIdx;
         }
-        SetResponseWaveform();
-        GetMaxResponseWaveform();
-        GetSigmaResponseWaveform();
     }
-    for(int i=0;i<fNumberEvents;i++){
-        if(readmode>0){
-            fInputFile->cd();
-            fInputTree->GetEntry(i);
-            if(RootRRecovered()){
-                if(LasteventIdx>=reventIdx) continue;
-                else LasteventIdx = reventIdx;
-            }else{
-                LasteventIdx = reventIdx;
-            }
-        }
-        reventIdx = rGETEventIdx;
-        goodsicsievt=0;
-        goodsicsipevt=0;
-        if(IsFirstevent){
-            //cout<<"SET FIRST EVENT"<<endl;
-            FirsteventIdx = reventIdx;
-            evtcounter=0;
-            goodevtcounter=0;
-            gatedevtcounter=0;
-            badevtcounter=0;
-            IsFirstevent=false;
-            IsDecayEvt=false;
-            RootRResetWaveforms();
-        }else{
-            if(enable2pmode==0){
-                evtcounter++;
-            }else if(enable2pmode==1 && IsDecayEvt==true){
-                evtcounter++;
-            }
-            IsDecayEvt=false;
-            RootRResetWaveforms();
+    reventIdx = rGETEventIdx;
+    goodsicsievt=0;
+    goodsicsipevt=0;
+    if(IsFirstevent){
+        //cout<<"SET FIRST EVENT"<<endl;
+        FirsteventIdx = reventIdx;
+        evtcounter=0;
+        goodevtcounter=0;
+        gatedevtcounter=0;
+        badevtcounter=0;
+        IsFirstevent=false;
+        IsDecayEvt=false;
+        RootRResetWaveforms();
+    }else{
+        if(enable2pmode==0){
+            evtcounter++;
+        }else if(enable2pmode==1 && IsDecayEvt==true){
+            evtcounter++;
         }
+        IsDecayEvt=false;
+        RootRResetWaveforms();
+    }
 
-        if(enableskipevent==1 && reventIdx<firsteventno) continue;
-        if(enableskipevent==2 && reventIdx<maxevtno){
-            if(!evtmask[reventIdx]) continue;
-        }else if(enableskipevent==2 && reventIdx>=maxevtno){
-            cout << Form("reventIdx >= %d!",maxevtno) << endl;
-        }
+    if(enableskipevent==1 && reventIdx<firsteventno) return;
+    if(enableskipevent==2 && reventIdx<maxevtno){
+        if(!evtmask[reventIdx]) return;
+    }else if(enableskipevent==2 && reventIdx>=maxevtno){
+        cout << Form("reventIdx >= %d!",maxevtno) << endl;
+    }
 
-        //if((reventIdx-FirsteventIdx)%1000==0)
-        if((reventIdx-FirsteventIdx)%50==0)
-        {
-            if(reventIdx==FirsteventIdx){
-                //cout << Form("M%d:Starting from Event No. %d.",readmode,reventIdx) << endl;
-            }else{
-                //cout << Form("M%d:Upto Event No. %d Processed (from %d)..",readmode,reventIdx, FirsteventIdx) << endl;
-            }
+    //if((reventIdx-FirsteventIdx)%1000==0)
+    if((reventIdx-FirsteventIdx)%50==0)
+    {
+        if(reventIdx==FirsteventIdx){
+            //cout << Form("M%d:Starting from Event No. %d.",readmode,reventIdx) << endl;
+        }else{
+            //cout << Form("M%d:Upto Event No. %d Processed (from %d)..",readmode,reventIdx, FirsteventIdx) << endl;
         }
+    }
 
-        //cout << rGETEventIdx << " " << rGETD2PTime << " " << rGETMul << endl;
-        rd2ptime = rGETD2PTime;
-        //cout<<rd2ptime<<endl;
-        rtstmp = rGETTimeStamp;
-        if(rd2ptime>30000000) continue;
-        int goodX6counter=0;
-        int goodFWfcounter=0;
-        int goodFWbcounter=0;
-
-        int L0time=0;
-        if(enable2pmode==1){
-            if(rd2ptime>0) hMM_D2PTime->Fill(rd2ptime);
-            //else cout << reventIdx << " " << rd2ptime << " " << rGETMul << endl;
-
-            printed=0;
+    //cout << rGETEventIdx << " " << rGETD2PTime << " " << rGETMul << endl;
+    rd2ptime = rGETD2PTime;
+    //cout<<rd2ptime<<endl;
+    rtstmp = rGETTimeStamp;
+    if(rd2ptime>30000000) return;
+    int goodX6counter=0;
+    int goodFWfcounter=0;
+    int goodFWbcounter=0;
 
-            for(Int_t i=0; i<rGETMul; i++){
-                frameIdx = rGETFrameNo[i];
-                decayIdx = rGETDecayNo[i];
-                coboIdx = rGETCobo[i];
-                asadIdx = rGETAsad[i];
-                agetIdx = rGETAget[i];
-                chanIdx = rGETChan[i];
+    int L0time=0;
+    if(enable2pmode==1){
+        if(rd2ptime>0) hMM_D2PTime->Fill(rd2ptime);
+        //else cout << reventIdx << " " << rd2ptime << " " << rGETMul << endl;
 
-                if(ignoremm==1 && coboIdx==0) continue;// skip MM waveform data
-                if(decayIdx==1) IsDecayEvt=true;
-                if(coboIdx==coboIC && asadIdx==asadIC && chanIdx==chanIC){
-                    for(int j=0;j<bucketmax;j++){
-                        if(rGETWaveformY[i][j] < valueIC_min){
-                            //            L1Aflag = frameIdx%2;
-                        }
-                    }
-                    //cout << reventIdx << " " << coboIdx << " " << asadIdx << " " << chanIdx << " " << frameIdx << " " << L1Aflag << " " << decayIdx << endl;
-                }else if(coboIdx==0){
-                    for(int j=0;j<bucketmax;j++){
-                        if(printed==0 && rGETWaveformY[i][j]>4000){
-                            //cout << "MM2: " << reventIdx << " " << coboIdx << " " << asadIdx << " " << chanIdx << " " << frameIdx << " " << decayIdx << endl;
-                            printed++;
-                        }
-                    }
-                }
-            }
-        }
+        printed=0;
 
         for(Int_t i=0; i<rGETMul; i++){
+            frameIdx = rGETFrameNo[i];
             decayIdx = rGETDecayNo[i];
             coboIdx = rGETCobo[i];
             asadIdx = rGETAsad[i];
             agetIdx = rGETAget[i];
             chanIdx = rGETChan[i];
 
-            if(coboIdx==2 && agetIdx!=3) goodX6counter++;
-            if(coboIdx==1 && asadIdx==0 && agetIdx==0) goodFWfcounter++;
-            if(coboIdx==1 && asadIdx==0 && agetIdx==1) goodFWbcounter++;
-            if(coboIdx==1 && asadIdx==1 && agetIdx==3 && chanIdx==19) {
-                int maxval=0;
-                for(int t=0;t<100;t++) {
-                    if(rGETWaveformY[i][t]>maxval) {
-                        maxval=rGETWaveformY[i][t];
-                        L0time=t;
-                    }
-                }
-            }
-
             if(ignoremm==1 && coboIdx==0) continue;// skip MM waveform data
-            wfmaxvalue[i]=-10000;
-            wfminvalue[i]=10000;
-            wfbaseline[i] = 0;
-            Int_t baselinecounter = 0;
-            wfdvalue[i] = 0;
-            for(int j=0;j<bucketmax;j++){
-                if(rGETWaveformY[i][j]>0 && rGETWaveformY[i][j]<4095){
-                    if(wfmaxvalue[i]<rGETWaveformY[i][j]) wfmaxvalue[i] = rGETWaveformY[i][j];
-                    if(wfminvalue[i]>rGETWaveformY[i][j]) wfminvalue[i] = rGETWaveformY[i][j];
-                    if(j>=20+decayIdx*256 && j<30+decayIdx*256){
-                        wfbaseline[i] += rGETWaveformY[i][j];
-                        baselinecounter++;
+            if(decayIdx==1) IsDecayEvt=true;
+            if(coboIdx==coboIC && asadIdx==asadIC && chanIdx==chanIC){
+                for(int j=0;j<bucketmax;j++){
+                    if(rGETWaveformY[i][j] < valueIC_min){
+                        //            L1Aflag = frameIdx%2;
                     }
                 }
-            }
-            if(baselinecounter>0) wfbaseline[i] /= baselinecounter;
-            wfdvalue[i] = wfmaxvalue[i] - wfminvalue[i];
-            //if(coboIdx==0 && (wfdvalue[i]>(wfmaxvalue[i]-wfbaseline[i]+200))) wfdvalue[i] = -1;
-            //if(coboIdx==1 && asadIdx==0 && (agetIdx==1||agetIdx==3) && (wfdvalue[i]>(wfmaxvalue[i]-wfbaseline[i]+100))) wfdvalue[i] = -1;
-            //cout << reventIdx << ", asadIdx=" << asadIdx << ", wfdvalue[" << i << "]= " << wfdvalue[i] << ",  wfbaseline[" << i << "]= " << wfbaseline[i] << " " << (wfmaxvalue[i]-wfbaseline[i]+300) << endl;
-        }
-        goodsievt=0;
-        //if((goodX6counter!=3 && (goodFWbcounter+goodFWfcounter)!=2)||(goodFWbcounter!=1 && goodFWfcounter!=1)) {evtcounter--; continue;} // for X6 and Fwd Si. condition
-        //if(goodX6counter!=3 || (L0time<29 || L0time>33)) {evtcounter--; return;}
-        //if(goodX6counter<3) {evtcounter--; return;}
-        goodsievt=1;
-        //std::cout<<"Good event no: "<<reventIdx<< ", Mult=" << rGETMul << std::endl;
-        for(Int_t i=0; i<rGETMul; i++){
-            //if(wfdvalue[i]>40)
-            if(wfdvalue[i]>0)
-            {
-                decayIdx = rGETDecayNo[i];
-                frameIdx = rGETFrameNo[i];
-                coboIdx = rGETCobo[i];
-                asadIdx = rGETAsad[i];
-                agetIdx = rGETAget[i];
-                chanIdx = rGETChan[i];
-                if(ignoremm==1 && coboIdx==0) continue;// skip MM waveform data
-                if(enable2pmode==1){
-                    //          if(coboIdx==coboIC && asadIdx==asadIC && chanIdx==chanIC){
-                    //              decayIdx=0;
-                    //          }else{
-                    //            if(frameIdx%2 == L1Aflag){
-                    //              decayIdx=0;
-                    //            }else{
-                    //              decayIdx=1;
-                    //            }
-                    //          }
-                }else{
-                    //          decayIdx=0;
-                }
-                rwaveforms[decayIdx][coboIdx]->decayIdx = decayIdx;
-                rwaveforms[decayIdx][coboIdx]->hasHit[asadIdx*4+agetIdx] = true;
-                if((chanIdx==11||chanIdx==22||chanIdx==45||chanIdx==56)){
-                    rwaveforms[decayIdx][coboIdx]->hasFPN[asadIdx*4+agetIdx] = true;
-                }
-                //cout << reventIdx << " " << coboIdx << " " << asadIdx << " " << agetIdx << " " << chanIdx << " " << rwaveforms[decayIdx][coboIdx]->isDecay[asadIdx*4+agetIdx][chanIdx] << endl;
-                if(enable2pmode==0){
-                    for(int j=0;j<bucketmax;j++){
-                        rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][j] = rGETWaveformY[i][j];
-                        //cout << coboIdx << " " << asadIdx << " " << agetIdx << " " << j << " " << rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][j] << " " << rGETWaveformY[i][j] << endl;
-                    }
-                }else{
-                    //if(decayIdx==1) cout << "Yo:" << reventIdx << " " << decayIdx << " " << coboIdx << " " << asadIdx << " " << agetIdx << " " << chanIdx << " " << rwaveforms[decayIdx][coboIdx]->isDecay[asadIdx*4+agetIdx][chanIdx] << endl;
-                    for(int j=0;j<bucketmax;j++){
-                        rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][j] = rGETWaveformY[i][j];
-                        //if(coboIdx==1 && rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][j]>0)cout << j << " " << rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][j] << " " << rGETWaveformY[i][j-decayIdx*256] << endl;
+                //cout << reventIdx << " " << coboIdx << " " << asadIdx << " " << chanIdx << " " << frameIdx << " " << L1Aflag << " " << decayIdx << endl;
+            }else if(coboIdx==0){
+                for(int j=0;j<bucketmax;j++){
+                    if(printed==0 && rGETWaveformY[i][j]>4000){
+                        //cout << "MM2: " << reventIdx << " " << coboIdx << " " << asadIdx << " " << chanIdx << " " << frameIdx << " " << decayIdx << endl;
+                        printed++;
                     }
                 }
-                /*
-                   if(coboIdx==1&&asadIdx==0){
-                   s4out << reventIdx << " " << coboIdx << " " << asadIdx << " " << agetIdx << " " << chanIdx << " 4" << endl;
-                   }else if(coboIdx==1&&asadIdx==1&&chanIdx==33){
-                   s5out << reventIdx << " " << coboIdx << " " << asadIdx << " " << agetIdx << " " << chanIdx << " 5" << endl;
-                   }
-                 */
             }
         }
+    }
 
-        /*
-           if(s4out.str().size()!=0){
-           f4out.open("silabels.txt", std::ofstream::out|std::ofstream::app);
-           f4out << s4out.str() << endl;
-           f4out.close();
-           s4out.clear();
-           s4out.str("");
-           }
-           if(s5out.str().size()!=0){
-           f5out.open("iclabels.txt", std::ofstream::out|std::ofstream::app);
-           f5out << s5out.str() << endl;
-           f5out.close();
-           s5out.clear();
-           s5out.str("");
-           }
-         */
-        //cout << "Done with reading events from root tree" << endl;
-
-        Int_t lcwaveforms[6][512];
-        Int_t lccounter[6];
-        Int_t dchanIdx=0;
-        Int_t Beam_med = 180; //low
-        Int_t Beam_er = 150; //low
-        Int_t Bi = Beam_med-Beam_er;
-        Int_t Bf = Beam_med+Beam_er;
-        Int_t Beam_window = 40; //event window
-        Int_t Particle_window = 150; //event window
-        Int_t btime[6];
-        Int_t bestbtime;
-        Int_t bmax[6];
-        for(Int_t i=0;i<6;i++){
-            for(Int_t buck=0; buck<512; buck++) lcwaveforms[i][buck]=0;
-            lccounter[i]=0;
-            bmax[i]=0;
-        }
-        for(Int_t i=0; i<rGETMul; i++){
-            if(wfdvalue[i]>300){
-                coboIdx = rGETCobo[i];
-                if(ignoremm==1 && coboIdx==0) continue;// skip MM waveform data
-                if(coboIdx==0){
-                    asadIdx = rGETAsad[i];
-                    agetIdx = rGETAget[i];
-                    chanIdx = rGETChan[i];
-                    if(chanIdx==11 || chanIdx==22 || chanIdx==45 || chanIdx==56) continue; // We want to skip the FPN channels.
-                    if(chanIdx<11) {
-                        dchanIdx = chanIdx;
-                    }else if(chanIdx>11 && chanIdx<22) {
-                        dchanIdx = chanIdx - 1;
-                    }else if(chanIdx>22 && chanIdx<45) {
-                        dchanIdx = chanIdx - 2;
-                    }else if(chanIdx>45 && chanIdx<56) {
-                        dchanIdx = chanIdx - 3;
-                    }else if(chanIdx>56) {
-                        dchanIdx = chanIdx - 4;
-                    }
-                    if(mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]==64){
-                        for(Int_t buck=Bi; buck<Bf; buck++) lcwaveforms[0][buck]+=rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][buck];
-                        lccounter[0]++;
-                    }else if(mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]==65){
-                        for(Int_t buck=Bi; buck<Bf; buck++) lcwaveforms[1][buck]+=rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][buck];
-                        lccounter[1]++;
-                    }else if(mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]==66){
-                        for(Int_t buck=Bi; buck<Bf; buck++) lcwaveforms[2][buck]+=rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][buck];
-                        lccounter[2]++;
-                    }else if(mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]==67){
-                        for(Int_t buck=Bi; buck<Bf; buck++) lcwaveforms[3][buck]+=rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][buck];
-                        lccounter[3]++;
-                    }else if(mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]==68){
-                        for(Int_t buck=Bi; buck<Bf; buck++) lcwaveforms[4][buck]+=rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][buck];
-                        lccounter[4]++;
-                    }else if(mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]==69){
-                        for(Int_t buck=Bi; buck<Bf; buck++) lcwaveforms[5][buck]+=rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][buck];
-                        lccounter[5]++;
-                    }
+    for(Int_t i=0; i<rGETMul; i++){
+        decayIdx = rGETDecayNo[i];
+        coboIdx = rGETCobo[i];
+        asadIdx = rGETAsad[i];
+        agetIdx = rGETAget[i];
+        chanIdx = rGETChan[i];
+
+        if(coboIdx==2 && agetIdx!=3) goodX6counter++;
+        if(coboIdx==1 && asadIdx==0 && agetIdx==0) goodFWfcounter++;
+        if(coboIdx==1 && asadIdx==0 && agetIdx==1) goodFWbcounter++;
+        if(coboIdx==1 && asadIdx==1 && agetIdx==3 && chanIdx==19) {
+            int maxval=0;
+            for(int t=0;t<100;t++) {
+                if(rGETWaveformY[i][t]>maxval) {
+                    maxval=rGETWaveformY[i][t];
+                    L0time=t;
                 }
             }
         }
-        if(enable2pmode==0){
-            for(Int_t pxidx=0;pxidx<6;pxidx++){
-                if(lccounter[pxidx]>0){
-                    for(Int_t buck=Bi; buck<Bf; buck++){
-                        lcwaveforms[pxidx][buck]/=lccounter[pxidx];
-                    }
+
+        if(ignoremm==1 && coboIdx==0) continue;// skip MM waveform data
+        wfmaxvalue[i]=-10000;
+        wfminvalue[i]=10000;
+        wfbaseline[i] = 0;
+        Int_t baselinecounter = 0;
+        wfdvalue[i] = 0;
+        for(int j=0;j<bucketmax;j++){
+            if(rGETWaveformY[i][j]>0 && rGETWaveformY[i][j]<4095){
+                if(wfmaxvalue[i]<rGETWaveformY[i][j]) wfmaxvalue[i] = rGETWaveformY[i][j];
+                if(wfminvalue[i]>rGETWaveformY[i][j]) wfminvalue[i] = rGETWaveformY[i][j];
+                if(j>=20+decayIdx*256 && j<30+decayIdx*256){
+                    wfbaseline[i] += rGETWaveformY[i][j];
+                    baselinecounter++;
                 }
             }
-            for(Int_t pxidx=0;pxidx<6;pxidx++){
-                if(lccounter[pxidx]>0){
-                    for(Int_t buck=Bi; buck<Bf; buck++){
-                        if(bmax[pxidx]<lcwaveforms[pxidx][buck]){
-                            bmax[pxidx]=lcwaveforms[pxidx][buck];
-                            btime[pxidx]=buck;
-                        }
-                    }
-                }
+        }
+        if(baselinecounter>0) wfbaseline[i] /= baselinecounter;
+        wfdvalue[i] = wfmaxvalue[i] - wfminvalue[i];
+        //if(coboIdx==0 && (wfdvalue[i]>(wfmaxvalue[i]-wfbaseline[i]+200))) wfdvalue[i] = -1;
+        //if(coboIdx==1 && asadIdx==0 && (agetIdx==1||agetIdx==3) && (wfdvalue[i]>(wfmaxvalue[i]-wfbaseline[i]+100))) wfdvalue[i] = -1;
+        //cout << reventIdx << ", asadIdx=" << asadIdx << ", wfdvalue[" << i << "]= " << wfdvalue[i] << ",  wfbaseline[" << i << "]= " << wfbaseline[i] << " " << (wfmaxvalue[i]-wfbaseline[i]+300) << endl;
+    }
+    goodsievt=0;
+    //if((goodX6counter!=3 && (goodFWbcounter+goodFWfcounter)!=2)||(goodFWbcounter!=1 && goodFWfcounter!=1)) {evtcounter--; continue;} // for X6 and Fwd Si. condition
+    //if(goodX6counter!=3 || (L0time<29 || L0time>33)) {evtcounter--; return;}
+    //if(goodX6counter<3) {evtcounter--; return;}
+    goodsievt=1;
+    //std::cout<<"Good event no: "<<reventIdx<< ", Mult=" << rGETMul << std::endl;
+    for(Int_t i=0; i<rGETMul; i++){
+        //if(wfdvalue[i]>40)
+        if(wfdvalue[i]>0)
+        {
+            decayIdx = rGETDecayNo[i];
+            frameIdx = rGETFrameNo[i];
+            coboIdx = rGETCobo[i];
+            asadIdx = rGETAsad[i];
+            agetIdx = rGETAget[i];
+            chanIdx = rGETChan[i];
+            if(ignoremm==1 && coboIdx==0) continue;// skip MM waveform data
+            if(enable2pmode==1){
+                //          if(coboIdx==coboIC && asadIdx==asadIC && chanIdx==chanIC){
+                //              decayIdx=0;
+                //          }else{
+                //            if(frameIdx%2 == L1Aflag){
+                //              decayIdx=0;
+                //            }else{
+                //              decayIdx=1;
+                //            }
+                //          }
+            }else{
+                //          decayIdx=0;
+            }
+            rwaveforms[decayIdx][coboIdx]->decayIdx = decayIdx;
+            rwaveforms[decayIdx][coboIdx]->hasHit[asadIdx*4+agetIdx] = true;
+            if((chanIdx==11||chanIdx==22||chanIdx==45||chanIdx==56)){
+                rwaveforms[decayIdx][coboIdx]->hasFPN[asadIdx*4+agetIdx] = true;
             }
-            bestbtime = 0;
-            for(Int_t pxidx=0;pxidx<6;pxidx++){
-                if(lccounter[pxidx]>0){
-                    if(TMath::Abs(Beam_med-bestbtime)>TMath::Abs(Beam_med-btime[pxidx])) bestbtime=btime[pxidx];
+            //cout << reventIdx << " " << coboIdx << " " << asadIdx << " " << agetIdx << " " << chanIdx << " " << rwaveforms[decayIdx][coboIdx]->isDecay[asadIdx*4+agetIdx][chanIdx] << endl;
+            if(enable2pmode==0){
+                for(int j=0;j<bucketmax;j++){
+                    rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][j] = rGETWaveformY[i][j];
+                    //cout << coboIdx << " " << asadIdx << " " << agetIdx << " " << j << " " << rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][j] << " " << rGETWaveformY[i][j] << endl;
+                }
+            }else{
+                //if(decayIdx==1) cout << "Yo:" << reventIdx << " " << decayIdx << " " << coboIdx << " " << asadIdx << " " << agetIdx << " " << chanIdx << " " << rwaveforms[decayIdx][coboIdx]->isDecay[asadIdx*4+agetIdx][chanIdx] << endl;
+                for(int j=0;j<bucketmax;j++){
+                    rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][j] = rGETWaveformY[i][j];
+                    //if(coboIdx==1 && rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][j]>0)cout << j << " " << rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][j] << " " << rGETWaveformY[i][j-decayIdx*256] << endl;
                 }
             }
-
-            //for(Int_t pxidx=0;pxidx<6;pxidx++){
-            //  if(lccounter[pxidx]>0){
-            //    cout << reventIdx << " " << pxidx << " " << btime[pxidx] << " " << bestbtime << " " << bmax[pxidx] << endl;
-            //  }
-            //}
+            /*
+               if(coboIdx==1&&asadIdx==0){
+               s4out << reventIdx << " " << coboIdx << " " << asadIdx << " " << agetIdx << " " << chanIdx << " 4" << endl;
+               }else if(coboIdx==1&&asadIdx==1&&chanIdx==33){
+               s5out << reventIdx << " " << coboIdx << " " << asadIdx << " " << agetIdx << " " << chanIdx << " 5" << endl;
+               }
+             */
         }
+    }
 
-        for(Int_t i=0; i<rGETMul; i++){
-            if(wfdvalue[i]>40){
-                frameIdx = rGETFrameNo[i];
-                decayIdx = rGETDecayNo[i];
-                coboIdx = rGETCobo[i];
+    /*
+       if(s4out.str().size()!=0){
+       f4out.open("silabels.txt", std::ofstream::out|std::ofstream::app);
+       f4out << s4out.str() << endl;
+       f4out.close();
+       s4out.clear();
+       s4out.str("");
+       }
+       if(s5out.str().size()!=0){
+       f5out.open("iclabels.txt", std::ofstream::out|std::ofstream::app);
+       f5out << s5out.str() << endl;
+       f5out.close();
+       s5out.clear();
+       s5out.str("");
+       }
+     */
+    //cout << "Done with reading events from root tree" << endl;
+
+    Int_t lcwaveforms[6][512];
+    Int_t lccounter[6];
+    Int_t dchanIdx=0;
+    Int_t Beam_med = 180; //low
+    Int_t Beam_er = 150; //low
+    Int_t Bi = Beam_med-Beam_er;
+    Int_t Bf = Beam_med+Beam_er;
+    Int_t Beam_window = 40; //event window
+    Int_t Particle_window = 150; //event window
+    Int_t btime[6];
+    Int_t bestbtime;
+    Int_t bmax[6];
+    for(Int_t i=0;i<6;i++){
+        for(Int_t buck=0; buck<512; buck++) lcwaveforms[i][buck]=0;
+        lccounter[i]=0;
+        bmax[i]=0;
+    }
+    for(Int_t i=0; i<rGETMul; i++){
+        if(wfdvalue[i]>300){
+            coboIdx = rGETCobo[i];
+            if(ignoremm==1 && coboIdx==0) continue;// skip MM waveform data
+            if(coboIdx==0){
                 asadIdx = rGETAsad[i];
                 agetIdx = rGETAget[i];
                 chanIdx = rGETChan[i];
-                if(ignoremm==1 && coboIdx==0) continue;// skip MM waveform data
-                rwaveforms[decayIdx][coboIdx]->isDecay[asadIdx*4+agetIdx][chanIdx]=frameIdx%2;
-                if(enable2pmode==1){
-                    if(frameIdx%2 == L1Aflag){
-                        decayIdx=0;
-                    }else{
-                        decayIdx=1;
-                    }
-                }else{
-                    decayIdx=0;
-                }
-                rwaveforms[decayIdx][coboIdx]->frameIdx = frameIdx;
-                rwaveforms[decayIdx][coboIdx]->decayIdx = decayIdx;
-                //cout << coboIdx << " " << asadIdx << " " << agetIdx << " " << chanIdx <<endl;
-                //      if(decayIdx==1) cout<<"Why do we see them here but not after?"<<endl;
-                GetAverageFPN(decayIdx,coboIdx,asadIdx,agetIdx);
-
+                if(chanIdx==11 || chanIdx==22 || chanIdx==45 || chanIdx==56) continue; // We want to skip the FPN channels.
                 if(chanIdx<11) {
                     dchanIdx = chanIdx;
                 }else if(chanIdx>11 && chanIdx<22) {
@@ -1021,133 +966,345 @@ void LKFrameBuilder::RootReadEvent()
                 }else if(chanIdx>56) {
                     dchanIdx = chanIdx - 4;
                 }
-                bestbtime=180;
-                if(coboIdx==0 && mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]>=64 && mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]<=69){
-                    mm_mintime = bestbtime-Beam_window;
-                    mm_maxtime = bestbtime+Beam_window;
-                }else{
-                    mm_mintime = bestbtime-Particle_window;
-                    mm_maxtime = bestbtime+Particle_window;
-                }
-                GetEnergyTime(decayIdx,coboIdx,asadIdx,agetIdx,chanIdx);
-                if(coboIdx==1&&asadIdx==0&&rwaveforms[decayIdx][coboIdx]->energy[asadIdx*4+agetIdx][chanIdx]>3000){
-                    rwaveforms[decayIdx][coboIdx]->hasHit[asadIdx*4+agetIdx] = false;
-                    rwaveforms[decayIdx][0]->isRejected = true;
-                    rwaveforms[decayIdx][1]->isRejected = true;
-                }
-                if(enablehist==1 && rwaveforms[decayIdx][0]->isRejected == false){
+                if(mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]==64){
+                    for(Int_t buck=Bi; buck<Bf; buck++) lcwaveforms[0][buck]+=rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][buck];
+                    lccounter[0]++;
+                }else if(mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]==65){
+                    for(Int_t buck=Bi; buck<Bf; buck++) lcwaveforms[1][buck]+=rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][buck];
+                    lccounter[1]++;
+                }else if(mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]==66){
+                    for(Int_t buck=Bi; buck<Bf; buck++) lcwaveforms[2][buck]+=rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][buck];
+                    lccounter[2]++;
+                }else if(mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]==67){
+                    for(Int_t buck=Bi; buck<Bf; buck++) lcwaveforms[3][buck]+=rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][buck];
+                    lccounter[3]++;
+                }else if(mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]==68){
+                    for(Int_t buck=Bi; buck<Bf; buck++) lcwaveforms[4][buck]+=rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][buck];
+                    lccounter[4]++;
+                }else if(mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]==69){
+                    for(Int_t buck=Bi; buck<Bf; buck++) lcwaveforms[5][buck]+=rwaveforms[decayIdx][coboIdx]->waveform[asadIdx*4+agetIdx][chanIdx][buck];
+                    lccounter[5]++;
                 }
-                if(enablehist==1){
-                    //cout<<rwaveforms[decayIdx][coboIdx]->energy[asadIdx*4+agetIdx][chanIdx]<<endl;
-                    hGET_EHitPattern2D->Fill(coboIdx*2000+asadIdx*500+agetIdx*100+chanIdx,rwaveforms[decayIdx][coboIdx]->energy[asadIdx*4+agetIdx][chanIdx]);
-                    hGET_THitPattern2D->Fill(coboIdx*2000+asadIdx*500+agetIdx*100+chanIdx,rwaveforms[decayIdx][coboIdx]->time[asadIdx*4+agetIdx][chanIdx]);
+            }
+        }
+    }
+    if(enable2pmode==0){
+        for(Int_t pxidx=0;pxidx<6;pxidx++){
+            if(lccounter[pxidx]>0){
+                for(Int_t buck=Bi; buck<Bf; buck++){
+                    lcwaveforms[pxidx][buck]/=lccounter[pxidx];
                 }
-                //WaveletFilter(decayIdx,coboIdx);
-                //cout << "Done with energy/time" << endl;
-                if(enabledraww==1){
-                    DrawWaveForm(decayIdx,coboIdx,asadIdx,agetIdx,chanIdx);
-                    //          cout << "Done with drawing waveform for " << reventIdx<< endl;
+            }
+        }
+        for(Int_t pxidx=0;pxidx<6;pxidx++){
+            if(lccounter[pxidx]>0){
+                for(Int_t buck=Bi; buck<Bf; buck++){
+                    if(bmax[pxidx]<lcwaveforms[pxidx][buck]){
+                        bmax[pxidx]=lcwaveforms[pxidx][buck];
+                        btime[pxidx]=buck;
+                    }
                 }
-                ResetHitPattern();
-                DrawHitPattern(decayIdx, coboIdx);
             }
         }
-        if(enabledraww==1){
-            hWaveFormbyEvent[evtcounter%16]->SetTitle(Form("hWaveFormbyEvent(EvtNo=%d);ADC Channel;Counts [D2PTime=%d usec]",reventIdx,int(rd2ptime/1000)));
-            hCorrWaveFormbyEvent[evtcounter%16]->SetTitle(Form("hCorrWaveFormbyEvent(EvtNo=%d);ADC Channel;Counts [ D2PTime=%d usec]",reventIdx,int(rd2ptime/1000)));
+        bestbtime = 0;
+        for(Int_t pxidx=0;pxidx<6;pxidx++){
+            if(lccounter[pxidx]>0){
+                if(TMath::Abs(Beam_med-bestbtime)>TMath::Abs(Beam_med-btime[pxidx])) bestbtime=btime[pxidx];
+            }
+        }
+
+        //for(Int_t pxidx=0;pxidx<6;pxidx++){
+        //  if(lccounter[pxidx]>0){
+        //    cout << reventIdx << " " << pxidx << " " << btime[pxidx] << " " << bestbtime << " " << bmax[pxidx] << endl;
+        //  }
+        //}
+    }
+
+    // Called in the order of the hits once the fired channels of their AGET are deconvolved together
+    auto energyTimeDone = [this](const EnergyTimeChannel &channel){
+        const Int_t decayIdx = channel.decayIdx, coboIdx = channel.cobo, asadIdx = channel.asad, agetIdx = channel.aget, chanIdx = channel.chan;
+        if(coboIdx==1&&asadIdx==0&&rwaveforms[decayIdx][coboIdx]->energy[asadIdx*4+agetIdx][chanIdx]>3000){
+            rwaveforms[decayIdx][coboIdx]->hasHit[asadIdx*4+agetIdx] = false;
+            rwaveforms[decayIdx][0]->isRejected = true;
+            rwaveforms[decayIdx][1]->isRejected = true;
+        }
+        if(enablehist==1 && rwaveforms[decayIdx][0]->isRejected == false){
         }
+        if(enablehist==1){
+            //cout<<rwaveforms[decayIdx][coboIdx]->energy[asadIdx*4+agetIdx][chanIdx]<<endl;
+            hGET_EHitPattern2D->Fill(coboIdx*2000+asadIdx*500+agetIdx*100+chanIdx,rwaveforms[decayIdx][coboIdx]->energy[asadIdx*4+agetIdx][chanIdx]);
+            hGET_THitPattern2D->Fill(coboIdx*2000+asadIdx*500+agetIdx*100+chanIdx,rwaveforms[decayIdx][coboIdx]->time[asadIdx*4+agetIdx][chanIdx]);
+        }
+        //WaveletFilter(decayIdx,coboIdx);
         //cout << "Done with energy/time" << endl;
-        //WaveformShapeFilter(coboIdx);
-        //DrawPSDFilter(coboIdx);
-        //cout << "Done with filters" << endl;
+        if(enabledraww==1){
+            DrawWaveForm(decayIdx,coboIdx,asadIdx,agetIdx,chanIdx);
+            //          cout << "Done with drawing waveform for " << reventIdx<< endl;
+        }
+        ResetHitPattern();
+        DrawHitPattern(decayIdx, coboIdx);
+    };
+    for(Int_t i=0; i<rGETMul; i++){
+        if(wfdvalue[i]>40){
+            frameIdx = rGETFrameNo[i];
+            decayIdx = rGETDecayNo[i];
+            coboIdx = rGETCobo[i];
+            asadIdx = rGETAsad[i];
+            agetIdx = rGETAget[i];
+            chanIdx = rGETChan[i];
+            if(ignoremm==1 && coboIdx==0) continue;// skip MM waveform data
+            rwaveforms[decayIdx][coboIdx]->isDecay[asadIdx*4+agetIdx][chanIdx]=frameIdx%2;
+            if(enable2pmode==1){
+                if(frameIdx%2 == L1Aflag){
+                    decayIdx=0;
+                }else{
+                    decayIdx=1;
+                }
+            }else{
+                decayIdx=0;
+            }
+            rwaveforms[decayIdx][coboIdx]->frameIdx = frameIdx;
+            rwaveforms[decayIdx][coboIdx]->decayIdx = decayIdx;
+            //cout << coboIdx << " " << asadIdx << " " << agetIdx << " " << chanIdx <<endl;
+            //      if(decayIdx==1) cout<<"Why do we see them here but not after?"<<endl;
+            GetAverageFPN(decayIdx,coboIdx,asadIdx,agetIdx);
+
+            if(chanIdx<11) {
+                dchanIdx = chanIdx;
+            }else if(chanIdx>11 && chanIdx<22) {
+                dchanIdx = chanIdx - 1;
+            }else if(chanIdx>22 && chanIdx<45) {
+                dchanIdx = chanIdx - 2;
+            }else if(chanIdx>45 && chanIdx<56) {
+                dchanIdx = chanIdx - 3;
+            }else if(chanIdx>56) {
+                dchanIdx = chanIdx - 4;
+            }
+            bestbtime=180;
+            if(coboIdx==0 && mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]>=64 && mapchantomm->pxidx[asadIdx][agetIdx][dchanIdx]<=69){
+                mm_mintime = bestbtime-Beam_window;
+                mm_maxtime = bestbtime+Beam_window;
+            }else{
+                mm_mintime = bestbtime-Particle_window;
+                mm_maxtime = bestbtime+Particle_window;
+            }
+            QueueEnergyTime(i,decayIdx,coboIdx,asadIdx,agetIdx,chanIdx,energyTimeDone);
+        }
+    }
+    FlushEnergyTime(energyTimeDone);
+    if(enabledraww==1){
+        hWaveFormbyEvent[evtcounter%16]->SetTitle(Form("hWaveFormbyEvent(EvtNo=%d);ADC Channel;Counts [D2PTime=%d usec]",reventIdx,int(rd2ptime/1000)));
+        hCorrWaveFormbyEvent[evtcounter%16]->SetTitle(Form("hCorrWaveFormbyEvent(EvtNo=%d);ADC Channel;Counts [ D2PTime=%d usec]",reventIdx,int(rd2ptime/1000)));
+    }
+    //cout << "Done with energy/time" << endl;
+    //WaveformShapeFilter(coboIdx);
+    //DrawPSDFilter(coboIdx);
+    //cout << "Done with filters" << endl;
+
+    goodx6csievt=0;
+    goodx6evt=0;
+    FindX6Hits();
+    //if(goodx6csievt==0) { evtcounter--; continue; }
+    //if(goodx6evt==0) { evtcounter--; continue; }
+    //else {cout << "Check out the vigru!!" << endl; }
+    //if(si_tracks->hasX6L>0 || si_tracks->hasX6BL>0 || si_tracks->hasX6R>0 || si_tracks->hasX6BR>0)
+    if(si_tracks->hasFWC>0 || 1)
+    {
+        ResetTrackHist();
+        FillTrack();
+        //cout << "Done with filling tracks" << endl;
+        if(enabletrack==1){
+            FindBoxCorner();
+            //cout << "Done with finding corners using a box method" << endl;
+            //ReplaceEnergy();
+            //ReplaceEnergybyRatio();
+            //cout << "Done with replacing energy of strips/chain from slop information" << endl;
 
-        goodx6csievt=0;
-        goodx6evt=0;
-        FindX6Hits();
-        //if(goodx6csievt==0) { evtcounter--; continue; }
-        //if(goodx6evt==0) { evtcounter--; continue; }
-        //else {cout << "Check out the vigru!!" << endl; }
-        //if(si_tracks->hasX6L>0 || si_tracks->hasX6BL>0 || si_tracks->hasX6R>0 || si_tracks->hasX6BR>0)
-        if(si_tracks->hasFWC>0 || 1)
-        {
-            ResetTrackHist();
-            FillTrack();
-            //cout << "Done with filling tracks" << endl;
-            if(enabletrack==1){
-                FindBoxCorner();
-                //cout << "Done with finding corners using a box method" << endl;
-                //ReplaceEnergy();
-                //ReplaceEnergybyRatio();
-                //cout << "Done with replacing energy of strips/chain from slop information" << endl;
-
-                //if(mm_tracks->hasTrack>0 && si_tracks->hasTrack>0)
-                if(mm_tracks->hasTrack>0)
+            //if(mm_tracks->hasTrack>0 && si_tracks->hasTrack>0)
+            if(mm_tracks->hasTrack>0)
+            {
+                //if((!mm_tracks->hasOverflow)||
+                //(mm_tracks->hasOverflow && si_tracks->agetid==0 &&
+                //si_tracks->chanid!=1 && si_tracks->chanid!=20))
+                if(!mm_tracks->hasOverflow)
                 {
-                    //if((!mm_tracks->hasOverflow)||
-                    //(mm_tracks->hasOverflow && si_tracks->agetid==0 &&
-                    //si_tracks->chanid!=1 && si_tracks->chanid!=20))
-                    if(!mm_tracks->hasOverflow)
-                    {
-                        DrawSiEvsCsIE();
-                        //cout << "Done with drawing SiEvsCsIE" << endl;
-                        goodsicsipevt=1;
-                        if(IsDecayEvt==true || true){
-                            //cout<<"Decay event"<<endl;
-                            if(goodsicsipevt==1 || 1){
-                                goodsicsipevtidx++;
-                                if(enablecleantrack==1) CleanTrack();
-                                if(enable2pmode==1){
-                                    FillDecayFlag();
-                                    cout << "Done with filling decay flags" << endl;
-                                    Sum2pEnergy();
-                                }
-                                //cout << "Done with cleaning tracks" << endl;
-                                FilldEvsE();
-                                //cout << "Done with filling dE vs E" << endl;
-                                //cout << "Done with resetting track histograms" << endl;
-                                ChangeTrackHistTitle();
-                                //cout << "M2:Good Event Found! (Idx=" << goodsicsipevtidx << ", EvtNo=" << reventIdx << ")" << endl;
-                                DrawTrack();
-                                //cout << "Done with drawing tracks" << endl;
-                                DrawSumEnergyTrack();
-                                //cout << "Done with drawing sum energy tracks" << endl;
-                                DrawdEvsE();
-                                //cout << "Done with drawing dEvsE" << endl;
-                                if(enable2pmode==1){
-                                    cout<<"Drawing decay track"<<endl;
-                                    DrawTrack2pMode();
-                                }else{
-                                    //HoughTransform();
-                                    //cout << "Done with Hough Transformation" << endl;
-                                    //GetTrackPosYLimit();
-                                    //cout << "Done with getting track posy min/max" << endl;
-                                    //GetXYZTrack();
-                                    //cout << "Done with getting track" << endl;
-                                }
-                                if(goodx6csievt>0) {
-                                    cout<<"Good X6 CsI event"<<endl;
-                                    //      goodevtcounter++;
-                                }
-                                goodevtcounter++;
-
+                    DrawSiEvsCsIE();
+                    //cout << "Done with drawing SiEvsCsIE" << endl;
+                    goodsicsipevt=1;
+                    if(IsDecayEvt==true || true){
+                        //cout<<"Decay event"<<endl;
+                        if(goodsicsipevt==1 || 1){
+                            goodsicsipevtidx++;
+                            if(enablecleantrack==1) CleanTrack();
+                            if(enable2pmode==1){
+                                FillDecayFlag();
+                                cout << "Done with filling decay flags" << endl;
+                                Sum2pEnergy();
+                            }
+                            //cout << "Done with cleaning tracks" << endl;
+                            FilldEvsE();
+                            //cout << "Done with filling dE vs E" << endl;
+                            //cout << "Done with resetting track histograms" << endl;
+                            ChangeTrackHistTitle();
+                            //cout << "M2:Good Event Found! (Idx=" << goodsicsipevtidx << ", EvtNo=" << reventIdx << ")" << endl;
+                            DrawTrack();
+                            //cout << "Done with drawing tracks" << endl;
+                            DrawSumEnergyTrack();
+                            //cout << "Done with drawing sum energy tracks" << endl;
+                            DrawdEvsE();
+                            //cout << "Done with drawing dEvsE" << endl;
+                            if(enable2pmode==1){
+                                cout<<"Drawing decay track"<<endl;
+                                DrawTrack2pMode();
+                            }else{
+                                //HoughTransform();
+                                //cout << "Done with Hough Transformation" << endl;
+                                //GetTrackPosYLimit();
+                                //cout << "Done with getting track posy min/max" << endl;
+                                //GetXYZTrack();
+                                //cout << "Done with getting track" << endl;
+                            }
+                            if(goodx6csievt>0) {
+                                cout<<"Good X6 CsI event"<<endl;
+                                //      goodevtcounter++;
                             }
+                            goodevtcounter++;
+
                         }
-                        ResetTrack();
-                        //cout << "Done with resetting tracks" << endl;
-                    }else{
-                        badevtcounter++;
-                        ResetTrack();
                     }
+                    ResetTrack();
+                    //cout << "Done with resetting tracks" << endl;
                 }else{
                     badevtcounter++;
                     ResetTrack();
                 }
-                //cout << "Done with finding tracks" << endl;
+            }else{
+                badevtcounter++;
+                ResetTrack();
             }
-            ResetdEvsE();
+            //cout << "Done with finding tracks" << endl;
+        }
+        ResetdEvsE();
+    }
+}
+
+/**
+ * Sets what RootReadEntry carries from one entry to the next (first event number, duplicate entries of a recovered
+ * file, decay pairing of the 2p mode, event counter) as if the entries [0, entry) had been read, so that a range
+ * of entries read by LKParallelReplay gives the same events as a sequential replay.
+ * Only the event number, the D2P time and in 2p mode the decay flags of these entries are read.
+ */
+void LKFrameBuilder::RootReadSeed(Long64_t entry)
+{
+    if(readmode==0 || entry<=0) return;
+
+    TBranch *eventIdxBranch = fInputTree->GetBranch("mmEventIdx");
+    TBranch *d2pTimeBranch = fInputTree->GetBranch("mmD2PTime");
+    TBranch *mulBranch = fInputTree->GetBranch("mmMul");
+    TBranch *decayBranch = fInputTree->GetBranch("mmDecayNo");
+    TBranch *coboBranch = fInputTree->GetBranch("mmCobo");
+    bool const recovered = RootRRecovered();
+    fInputFile->cd();
+    for(Long64_t previous=0; previous<entry; previous++){
+        eventIdxBranch->GetEntry(previous);
+        if(recovered){
+            if(LasteventIdx>=reventIdx) continue;
+            else LasteventIdx = reventIdx;
+        }else{
+            LasteventIdx = reventIdx;
+        }
+        reventIdx = rGETEventIdx;
+        if(IsFirstevent){
+            FirsteventIdx = reventIdx;
+            evtcounter=0;
+            IsFirstevent=false;
+        }else{
+            if(enable2pmode==0){
+                evtcounter++;
+            }else if(enable2pmode==1 && IsDecayEvt==true){
+                evtcounter++;
+            }
+        }
+        IsDecayEvt=false;
+
+        if(enable2pmode!=1) continue;
+        if(enableskipevent==1 && reventIdx<firsteventno) continue;
+        if(enableskipevent==2 && reventIdx<maxevtno && !evtmask[reventIdx]) continue;
+        d2pTimeBranch->GetEntry(previous);
+        rd2ptime = rGETD2PTime;
+        if(rd2ptime>30000000) continue;
+        mulBranch->GetEntry(previous);
+        decayBranch->GetEntry(previous);
+        coboBranch->GetEntry(previous);
+        for(Int_t i=0; i<rGETMul; i++){
+            if(ignoremm==1 && rGETCobo[i]==0) continue;
+            if(rGETDecayNo[i]==1) IsDecayEvt=true;
         }
     }
-    bucketmax = oldbucketmax;
+}
+
+void LKFrameBuilder::RootReadEnd()
+{
+    bucketmax = fReadOldBucketMax;
+}
+
+void LKFrameBuilder::GetAccumulatedHistograms(vector<TH1*> &histograms)
+{
+    histograms.clear();
+    TH1 *singles[] = {
+        hWaveFormIC, hMM_TrackAll, hMMICenergyvsMME, hMM_EstripL, hMM_EstripR, hMM_EstripAll, hMM_TrackPosAll,
+        hMM_TrackdE1vsSiE, hMM_TrackdE1vsdE2, hMM_TrackPosXYAll, hMM_TrackPosXYTAll, hMM_TrackPosXZAll, hMM_TrackPosYZAll,
+        hMM_TimevsPxIDXPosAll, hMM_TimevsPxIDYAll, hMM_TimevsPxIDYPosAll, hMM_EnergyvsPxIDYALL, hMM_SiEvsCsIEAll,
+        hMM_X6EvsCsIEAll, hMM_SumEnergyMaxIDY, hMM_SumEnergyLastIDY, hMM_Pa_vs_Energy2D, hMM_Pa_vs_Time2D,
+        hSi_Pa_vs_Energy2D, hSi_Pa_vs_Time2D, hMM_D2PTime,
+        hGET_EHitPattern2D, hGET_THitPattern2D, hGET_Si16x16HitPattern2D, hGET_SiForwardHitPattern2D, hGET_SiForwardMult,
+        hGET_SivsCsIHitPattern2D, hGET_DecEHitPattern2D, hGET_DecTHitPattern2D, hGET_FitEHitPattern2D, hGET_FitTHitPattern2D,
+        hGET_DecdEMaxvsEMax2D, hGET_DecdTMaxvsTMax2D, hGET_FitdEMaxvsEMax2D, hGET_FitdTMaxvsTMax2D,
+        hBM_LR, hBM_Esum1vsPos, hBM_Esum2vsEsum1,
+        hX6_LRAll, hX6_EsumvsPosAll, hX6_EsumvsPosAllLeft, hX6_EsumvsPosAllRight, hX6_EbackAll,
+        hX6_LeftHitPattern, hX6_BottomHitPattern, hX6_RightHitPattern, hX6_OhmicHitPattern
+    };
+    histograms.insert(histograms.end(), std::begin(singles), std::end(singles));
+
+    // Arrays are added element by element, multi-dimensional ones through their first element
+    auto addArray = [&histograms](auto *array, int size) {
+        for(int i=0;i<size;i++) histograms.push_back(array[i]);
+    };
+    addArray(hFPNWaveFormAll, 64);
+    addArray(hMM_TrackdEvsEALL, 3);
+    addArray(&hMM_SiEvsCsIE[0][0], 10*11);
+    addArray(hMM_PSDIntegralvsMax, 64);
+    addArray(hMM_PSDRatiovsMax, 64);
+    addArray(hMM_PSDRatio, 64);
+    addArray(hMM_Sum2pEnergy, 4);
+    addArray(hGET_EALL, 64);
+    addArray(&hGET_E[0][0], 64*68);
+    addArray(hMM_a0, 4);
+    addArray(hMM_a1, 4);
+    addArray(hMM_b0, 4);
+    addArray(hMM_b1, 4);
+    addArray(&hX6_LR[0][0], 48*8);
+    addArray(&hX6_EsumvsPos[0][0], 48*8);
+    addArray(&hX6_Eback[0][0], 48*4);
+}
+
+void LKFrameBuilder::AddHistograms(LKFrameBuilder &other)
+{
+    vector<TH1*> histograms, otherHistograms;
+    GetAccumulatedHistograms(histograms);
+    other.GetAccumulatedHistograms(otherHistograms);
+    for(size_t i=0;i<histograms.size();i++){
+        if(histograms[i]!=nullptr && otherHistograms[i]!=nullptr) histograms[i]->Add(otherHistograms[i]);
+    }
+}
+
+void LKFrameBuilder::ResetHistograms()
+{
+    vector<TH1*> histograms;
+    GetAccumulatedHistograms(histograms);
+    for(auto histogram : histograms){
+        if(histogram!=nullptr) histogram->Reset();
+    }
 }
 
 void LKFrameBuilder::RootReadWriteEvent() {
@@ -1339,6 +1496,23 @@ void LKFrameBuilder::RootReadWriteEvent() {
     wGETEventIdx = rGETEventIdx;
     wGETD2PTime = rGETD2PTime;
     wGETTimeStamp = rGETTimeStamp;
+    // Called in the order of the hits once the fired channels of their AGET are deconvolved together
+    auto energyTimeDone = [this](const EnergyTimeChannel &channel){
+      const Int_t i = channel.index, decayIdx = channel.decayIdx, coboIdx = channel.cobo, asadIdx = channel.asad, agetIdx = channel.aget, chanIdx = channel.chan;
+      //WaveletFilter(decayIdx,coboIdx);
+      wGETFrameNo[i]=rGETFrameNo[i];
+      wGETDecayNo[i]=decayIdx;
+      wGETL1Aflag[i]=L1Aflag;
+      wGETCobo[i]=coboIdx;
+      wGETAsad[i]=asadIdx;
+      wGETAget[i]=agetIdx;
+      wGETChan[i]=chanIdx;
+      wGETEnergy[i]=rwaveforms[decayIdx][coboIdx]->energy[asadIdx*4+agetIdx][chanIdx];
+      wGETTime[i]=rwaveforms[decayIdx][coboIdx]->time[asadIdx*4+agetIdx][chanIdx];
+      wGETMul++;
+      if(chanIdx!=11&&chanIdx!=22&&chanIdx!=45&&chanIdx!=56) wGETHit++;
+      //cout << "Done with energy/time" << endl;
+    };
     for(Int_t i=0; i<rGETMul; i++){
       wfbaseline[i]=0;
       //cout << "wfdvalue[" << i << "]= " << wfdvalue[i] << endl;
@@ -1368,22 +1542,10 @@ void LKFrameBuilder::RootReadWriteEvent() {
         rwaveforms[decayIdx][coboIdx]->frameIdx = frameIdx;
         rwaveforms[decayIdx][coboIdx]->decayIdx = decayIdx;
         GetAverageFPN(decayIdx,coboIdx,asadIdx,agetIdx);
-        GetEnergyTime(decayIdx,coboIdx,asadIdx,agetIdx,chanIdx);
-        //WaveletFilter(decayIdx,coboIdx);
-        wGETFrameNo[i]=frameIdx;
-        wGETDecayNo[i]=decayIdx;
-        wGETL1Aflag[i]=L1Aflag;
-        wGETCobo[i]=coboIdx;
-        wGETAsad[i]=asadIdx;
-        wGETAget[i]=agetIdx;
-        wGETChan[i]=chanIdx;
-        wGETEnergy[i]=rwaveforms[decayIdx][coboIdx]->energy[asadIdx*4+agetIdx][chanIdx];
-        wGETTime[i]=rwaveforms[decayIdx][coboIdx]->time[asadIdx*4+agetIdx][chanIdx];
-        wGETMul++;
-        if(chanIdx!=11&&chanIdx!=22&&chanIdx!=45&&chanIdx!=56) wGETHit++;
-        //cout << "Done with energy/time" << endl;
+        QueueEnergyTime(i,decayIdx,coboIdx,asadIdx,agetIdx,chanIdx,energyTimeDone);
       }
     }
+    FlushEnergyTime(energyTimeDone);
     RootRWriteEvent();
     RootRWReset();
   }
@@ -1470,7 +1632,7 @@ void LKFrameBuilder::RootReadHistEvent()
             rwaveforms[decayIdx][coboIdx]->decayIdx = decayIdx;
             rwaveforms[decayIdx][coboIdx]->hasHit[asadIdx*4+agetIdx] = true;
 
-            rwaveforms[decayIdx][coboIdx]->hasSignal[asadIdx*4+agetIdx][chanIdx] = true;
+            rwaveforms[decayIdx][coboIdx]->hasSignal[asadIdx*4+agetIdx].Set(chanIdx);
             rwaveforms[decayIdx][coboIdx]->energy[asadIdx*4+agetIdx][chanIdx] = rGETEnergy[i];
             rwaveforms[decayIdx][coboIdx]->time[asadIdx*4+agetIdx][chanIdx] = rGETTime[i];
             if(coboIdx==1 && asadIdx==1 && agetIdx==1 && chanIdx==2) {
@@ -1586,7 +1748,7 @@ void LKFrameBuilder::DrawWaveForm(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t
     Int_t maxyval=0;
     Int_t baseline = rwaveforms[decayIdx][cobo]->baseline[asad*4+aget][chan];
     if(chan==11 || chan==22 || chan==45 || chan==56) return; // We want to skip the FPN channels.
-    if(!rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget][chan]) return; // skip signals that did not fire
+    if(!rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget].Test(chan)) return; // skip signals that did not fire
     //shaped waveform type
     if(cobo==0){
         rftype=0;
@@ -1666,145 +1828,107 @@ void LKFrameBuilder::DrawWaveForm(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t
         UInt_t nfound = 0;
         //UInt_t nfound = sCorrWaveForm[cobo*maxasad*4+asad*4+aget]->Search(hCorrWaveForm[cobo*maxasad*4+asad*4+aget],2,"",0.4);
         if(nfound>100){
-            rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget][chan] = 0;
+            rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget].Reset(chan);
         }
     }
 }
 
-void LKFrameBuilder::GetCorrWaveform(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan)
+/// Polarity of the corrected waveforms of each AGET, see LKChannelKernel
+void LKFrameBuilder::InitCorrPolarity()
 {
-    Int_t minvalue=10000;
-    if(enable2pmode==1) decayIdx = rwaveforms[decayIdx][cobo]->decayIdx;
-    for(UInt_t buck=0;buck<bucketmax;buck++){
-        // Flip
-        if(cobo==0) {
-            rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck] =  rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck] - rwaveforms[decayIdx][cobo]->fpnwaveform[asad*4+aget][buck]; // Subtract the averaged FPN value (Negative Polarity)
-
-        }
-        if(cobo==2) {//JEB
-            if(aget!=0){
-                rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck] =  -1*(rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck] - rwaveforms[decayIdx][cobo]->fpnwaveform[asad*4+aget][buck]); // Subtract the averaged FPN value (Positive polarity)
-            }
-            if(aget==0) {
-                rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck] =  rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck] - rwaveforms[decayIdx][cobo]->fpnwaveform[asad*4+aget][buck]; // Subtract the averaged FPN value (Negative Polarity)
-            }
-        }
-        if(cobo==1) {
-            if(asad==0) {
-                if(aget==0 || aget==2) {
-                    //rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck] =  -1*(rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck] - rwaveforms[decayIdx][cobo]->fpnwaveform[asad*4+aget][buck]); // Subtract the averaged FPN value (Positive polarity)
-                    rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck] =  -1*(rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck] - 4096); // Subtract the averaged FPN value (Positive polarity)
-                    //rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck] =  rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck] - rwaveforms[decayIdx][cobo]->fpnwaveform[asad*4+aget][buck]; // Subtract the averaged FPN value (Negative Polarity)
-                }else{
-                    //rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck] =  -1*(rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck] - rwaveforms[decayIdx][cobo]->fpnwaveform[asad*4+aget][buck]); // Subtract the averaged FPN value (Positive polarity)
-                    rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck] =  rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck] - rwaveforms[decayIdx][cobo]->fpnwaveform[asad*4+aget][buck]; // Subtract the averaged FPN value (Negative Polarity)
-                }
-            }else if(asad==2 || asad==3) {
-                if(aget==2 || aget==3) {
-                    rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck] =  -1*(rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck] - 4096); // Subtract the averaged FPN value (Positive polarity)
-                }
-                else {
-                    rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck] =  rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck] - rwaveforms[decayIdx][cobo]->fpnwaveform[asad*4+aget][buck]; // Subtract the averaged FPN value (Negative Polarity)
+    for(int cobo=0;cobo<3;cobo++){
+        for(int asad=0;asad<4;asad++){
+            for(int aget=0;aget<4;aget++){
+                Int_t polarity = LKChannelKernel::kNegative;
+                if(cobo==2 && aget!=0) polarity = LKChannelKernel::kPositive; //JEB
+                if(cobo==1){
+                    if(asad==0){
+                        if(aget==0 || aget==2) polarity = LKChannelKernel::kPositiveFixed;
+                    }else if(asad==2 || asad==3){
+                        if(aget==2 || aget==3) polarity = LKChannelKernel::kPositiveFixed;
+                    }else{
+                        polarity = LKChannelKernel::kPositive;
+                    }
                 }
-            }else{
-                rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck] =  -1*(rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck] - rwaveforms[decayIdx][cobo]->fpnwaveform[asad*4+aget][buck]); // Subtract the averaged FPN value (Positive polarity)
-                //rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck] =  rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck] - rwaveforms[decayIdx][cobo]->fpnwaveform[asad*4+aget][buck]; // Subtract the averaged FPN value (Negative Polarity)
+                fCorrPolarity[cobo][asad*4+aget] = polarity;
             }
         }
-        //    if(cobo==0 && (asad==0||asad==1) && aget>1) {
-        //      rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck] =  -1*(rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck] - rwaveforms[decayIdx][cobo]->fpnwaveform[asad*4+aget][buck]); // Subtract the averaged FPN value (Positive polarity)
-        //      }
-        //      cout<<buck<<"\t"<<cobo<<"\t"<<asad<<"\t"<<aget<<"\t"<<rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck]<<endl;
-
-        if(minvalue>rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck]){
-            minvalue = rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck];
-        }
-    }
-    if(minvalue<0){
-        for(UInt_t buck=0;buck<bucketmax;buck++){
-            rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck] -= minvalue;
-        }
     }
 }
 
-Double_t LKFrameBuilder::GetBaseline(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan)
+/// FPN subtraction and polarity flip (shifted to be non-negative) of the waveform, maximum searched in [maxFirst, maxLast)
+void LKFrameBuilder::CorrectWaveform(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan, Int_t maxFirst, Int_t maxLast, LKChannelFeatures &features)
 {
-    Double_t baseline;
-    Double_t dbaseline;
-    TF1* fWaveform;
-    TH1D* hWaveform;
-    Double_t sigma=10;
-
-    fWaveform = new TF1("fWaveform", "gaus", 0, 4096);
-    fWaveform->SetParameter(2,sigma);
-    fWaveform->SetParLimits(2, sigma*0.1, sigma*2);
-    hWaveform = new TH1D("hWaveform","hWaveform",1024,0,4096);
-    for(int buck=0;buck<512;buck++){
-        hWaveform->Fill(rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck]);
-    }
-    hWaveform->Fit("fWaveform","QN"); //Q=Quiet and N=Do not draw
-    dbaseline = TMath::Abs(fWaveform->GetMaximumX() - hWaveform->GetMaximumBin());
-    if(dbaseline<100){
-        baseline = fWaveform->GetMaximumX();
-    }else{
-        baseline = hWaveform->GetMaximumBin();
-    }
-    delete hWaveform;
-    delete fWaveform;
-
-    UInt_t bgmin=50+decayIdx*256;
-    UInt_t bgmax=bucketmax+decayIdx*256-50;
-    UInt_t backgroundSum=0;
-    UInt_t backgroundSamples=0;
-
-    for(UInt_t buck=0;buck<bucketmax;buck++){
-        if(maxValueBucket>bgmin && maxValueBucket<bgmax){
-            if(buck>(bgmin-30) && buck<(bgmin-20)){
-                backgroundSum += rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck];
-                backgroundSamples++;
-            }else if((buck>(bgmax+20) && buck<(bgmax+30))){
-                backgroundSum += rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck];
-                backgroundSamples++;
-            }
-        }else if(maxValueBucket<bgmin){
-            if((buck>bgmax && buck<(bgmax+20))){
-                backgroundSum += rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck];
-                backgroundSamples++;
-            }
-        }else if(maxValueBucket>bgmax){
-            if(buck>(bgmin-20) && buck<bgmin){
-                backgroundSum += rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck];
-                backgroundSamples++;
-            }
-        }
-    }
-    baseline = (backgroundSamples>0) ? round(backgroundSum/backgroundSamples) : 0;
+    WaveForms *wf = rwaveforms[decayIdx][cobo];
+    LKChannelKernel::Process(fCorrPolarity[cobo][asad*4+aget], wf->waveform[asad*4+aget][chan].data(), wf->fpnwaveform[asad*4+aget].data(),
+            wf->corrwaveform[asad*4+aget][chan].data(), bucketmax, maxFirst, maxLast, features);
+}
 
-    return baseline;
+void LKFrameBuilder::GetCorrWaveform(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan)
+{
+    if(enable2pmode==1) decayIdx = rwaveforms[decayIdx][cobo]->decayIdx;
+    LKChannelFeatures features;
+    CorrectWaveform(decayIdx,cobo,asad,aget,chan,0,0,features);
+}
+
+/// Baseline of the FPN corrected waveform around the pulse at maxValueBucket, see LKBaselineEstimator
+Double_t LKFrameBuilder::GetBaseline(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan)
+{
+    const vector<Int_t> &corrwaveform = rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan];
+    return fBaselineEstimator.Estimate(corrwaveform.data(), bucketmax, decayIdx*256, maxValueBucket);
 }
 
 void LKFrameBuilder::GetEnergyTime(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan)
 {
-    if(chan==11 || chan==22 || chan==45 || chan==56) return; // We want to skip the FPN channels.
-    Int_t maxvalue=10000;
-    Int_t minvalue=10000;
-    Int_t corrwaveformintegral = 0;
-    Double_t psdratio = 0;
-    Int_t baseline = 0;
+    auto nothing = [](const EnergyTimeChannel &){};
+    QueueEnergyTime(0,decayIdx,cobo,asad,aget,chan,nothing);
+    FlushEnergyTime(nothing);
+}
+
+void LKFrameBuilder::QueueEnergyTime(Int_t index, Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan, const std::function<void(const EnergyTimeChannel &)> &done)
+{
+    if(fNumEnergyTimeChannels>0){
+        const EnergyTimeChannel &last = fEnergyTimeChannels[fNumEnergyTimeChannels-1];
+        if(last.decayIdx!=decayIdx || last.cobo!=cobo || last.asad!=asad || last.aget!=aget) FlushEnergyTime(done);
+    }
+    if(fNumEnergyTimeChannels==fEnergyTimeChannels.size()) fEnergyTimeChannels.emplace_back();
+    EnergyTimeChannel &channel = fEnergyTimeChannels[fNumEnergyTimeChannels++];
+    channel.index = index;
+    channel.decayIdx = decayIdx;
+    channel.cobo = cobo;
+    channel.asad = asad;
+    channel.aget = aget;
+    channel.chan = chan;
+    PrepareEnergyTime(channel);
+}
+
+void LKFrameBuilder::FlushEnergyTime(const std::function<void(const EnergyTimeChannel &)> &done)
+{
+    if(fNumEnergyTimeChannels==0) return;
+    if(energymethod>0) DeconvolveWaveforms();
+    // The caller may already have set the time window of the channel that caused the flush
+    Int_t mintime = mm_mintime, maxtime = mm_maxtime;
+    for(size_t i=0;i<fNumEnergyTimeChannels;i++){
+        EnergyTimeChannel &channel = fEnergyTimeChannels[i];
+        if(channel.prepared) FinishEnergyTime(channel);
+        done(channel);
+    }
+    mm_mintime = mintime;
+    mm_maxtime = maxtime;
+    fNumEnergyTimeChannels = 0;
+}
 
-    corrwaveformintegral = 0;
-    psdratio = 0;
+void LKFrameBuilder::PrepareEnergyTime(EnergyTimeChannel &channel)
+{
+    const Int_t decayIdx = channel.decayIdx, cobo = channel.cobo, asad = channel.asad, aget = channel.aget, chan = channel.chan;
+    channel.prepared = false;
+    if(chan==11 || chan==22 || chan==45 || chan==56) return; // We want to skip the FPN channels.
+    channel.prepared = true;
 
     maxValue=-1000;
     maxValueBucket=0;
-    maxValuedec=-1000;
-    maxValueBucketdec=0;
-    maxValuefit=-1000;
-    maxValueBucketfit=0;
     rftype=0;
 
-    GetCorrWaveform(decayIdx,cobo,asad,aget,chan);
-
     Int_t mintime=0;
     Int_t maxtime=0;
     if(cobo==0){
@@ -1819,33 +1943,32 @@ void LKFrameBuilder::GetEnergyTime(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t
         maxtime=512;
     }
 
-    // Find the maximum
+    // Corrected waveform, its maximum in [mintime, maxtime) and its sum in one pass
+    LKChannelFeatures features;
+    CorrectWaveform(decayIdx,cobo,asad,aget,chan,mintime,maxtime,features);
+    if(features.maxValue>maxValue) {
+        maxValue = features.maxValue;
+        maxValueBucket = features.maxBucket;
+    }
+    // Buckets of the window beyond bucketmax (2p mode) are not part of the corrected waveform
     Int_t *samplecorrwf = rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan].data();
-    //for(UInt_t buck=0;buck<bucketmax;buck++)
-    for(UInt_t buck=mintime;buck<maxtime;buck++)
+    for(Int_t buck=TMath::Max(mintime,(Int_t)bucketmax);buck<maxtime && buck<512;buck++)
     {
-        //   if(cobo==1 && asad==1 && aget==3 && chan==19) std::cout<<buck<<"\t"<<samplecorrwf[buck]<<std::endl;
         if(maxValue<samplecorrwf[buck]) {
             maxValue = samplecorrwf[buck];
             maxValueBucket = buck;
         }
-        //if(maxValue<rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck]) {
-        //  maxValue = rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck];
-        //  maxValueBucket = buck;
-        //}
     }
 
     //Find baseline from corrwaveform
-    baseline = GetBaseline(decayIdx,cobo,asad,aget,chan);
+    Int_t baseline = GetBaseline(decayIdx,cobo,asad,aget,chan);
 
     //if(maxValue>3500) energymethod=2;
     //cout << cobo << " " << asad << " " << aget << " " << chan << " " << maxValue << endl;
 
     if(energymethod>0){
-        for(int i=0;i<512;i++){
-            corrwaveformdec[i]=0;
-            corrwaveformfit[i]=0;
-        }
+        Double_t *dec = channel.dec;
+        for(int i=0;i<512;i++) dec[i]=0;
 
         //shaped waveform type
         if(cobo==0){
@@ -1859,19 +1982,52 @@ void LKFrameBuilder::GetEnergyTime(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t
         }
         int min_val=405;
         for(UInt_t buck=0;buck<bucketmax;buck++){
-            corrwaveformdec[buck] = rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck]-baseline+decoffset;
-            if(corrwaveformdec[buck]<min_val && corrwaveformdec[buck]>0) min_val=corrwaveformdec[buck];
-            //    cout<<"IN1\t"<<buck<<"\t"<<corrwaveformdec[buck]<<"\t"<<min_val<<endl;
+            dec[buck] = rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck]-baseline+decoffset;
+            if(dec[buck]<min_val && dec[buck]>0) min_val=dec[buck];
+            //    cout<<"IN1\t"<<buck<<"\t"<<dec[buck]<<"\t"<<min_val<<endl;
 
         }
         min_val+=50;
         for(UInt_t buck=0;buck<bucketmax;buck++) {
-            corrwaveformdec[buck]-=min_val;
-            if(buck<100) corrwaveformdec[buck]=0;
-            //      cout<<"IN CORR RESPONSE\t"<<buck<<"\t"<<corrwaveformdec[buck]<<"\t"<<response[rftype][buck]<<endl;
+            dec[buck]-=min_val;
+            if(buck<100) dec[buck]=0;
+            //      cout<<"IN CORR RESPONSE\t"<<buck<<"\t"<<dec[buck]<<"\t"<<response[rftype][buck]<<endl;
+        }
+    }
+
+    channel.mintime = mintime;
+    channel.maxtime = maxtime;
+    channel.maxValue = maxValue;
+    channel.maxValueBucket = maxValueBucket;
+    channel.baseline = baseline;
+    channel.rftype = rftype;
+    channel.sum = features.sum;
+}
+
+void LKFrameBuilder::FinishEnergyTime(EnergyTimeChannel &channel)
+{
+    const Int_t decayIdx = channel.decayIdx, cobo = channel.cobo, asad = channel.asad, aget = channel.aget, chan = channel.chan;
+    const Int_t mintime = channel.mintime, maxtime = channel.maxtime, baseline = channel.baseline;
+    Int_t corrwaveformintegral = 0;
+    Double_t psdratio = 0;
+
+    if(cobo==0){
+        mm_mintime=mintime;
+        mm_maxtime=maxtime;
+    }
+    maxValue=channel.maxValue;
+    maxValueBucket=channel.maxValueBucket;
+    maxValuedec=-1000;
+    maxValueBucketdec=0;
+    maxValuefit=-1000;
+    maxValueBucketfit=0;
+    rftype=channel.rftype;
+
+    if(energymethod>0){
+        for(int i=0;i<512;i++){
+            corrwaveformdec[i]=channel.dec[i];
+            corrwaveformfit[i]=0;
         }
-        //    cout << "Deconvolution Result: " << sCorrWaveForm[cobo*maxasad*4+asad*4+aget]->Deconvolution(corrwaveformdec,response[rftype],bucketmax,deconvrep[rftype],deconviter[rftype],deconvboost[rftype]) << endl;
-        sCorrWaveForm[cobo*maxasad*4+asad*4+aget]->Deconvolution(corrwaveformdec,response[rftype],bucketmax,deconvrep[rftype],deconviter[rftype],deconvboost[rftype]);
         for(UInt_t buck=responsesample[rftype][6]*0.8+decayIdx*256;buck<bucketmax+decayIdx*256;buck++){
             //  cout<<buck<<"\t"<<corrwaveformdec[buck]<<endl;
             // Find the maximum
@@ -1881,7 +2037,6 @@ void LKFrameBuilder::GetEnergyTime(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t
             }
         }
         maxValuedec = rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][maxValueBucketdec];
-
         GetEnergybyFitWaveform(rftype,decayIdx,cobo,asad,aget,chan,maxValueBucket); //using ShaperF_Fusion method
         Int_t dBucket = TMath::Abs(maxValueBucket-maxValueBucketdec);
         if(maxValue>1000 && dBucket>2 && dBucket<100){
@@ -1922,16 +2077,14 @@ void LKFrameBuilder::GetEnergyTime(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t
     corrwaveformintegral=0;
     maxValue = maxValue-baseline;
     maxValueBucket = maxValueBucket;
-    for(UInt_t buck=0;buck<bucketmax;buck++){
-        corrwaveformintegral+=(rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck]-baseline);
-    }
+    corrwaveformintegral = channel.sum - (Long64_t)bucketmax*baseline;
     psdratio = ((Double_t)maxValue/(Double_t)corrwaveformintegral);
 
     //if(maxValue>mm_minenergy && maxValue<mm_maxenergy && maxValueBucket>mintime && maxValueBucket<maxtime)
     if((cobo==0&&maxValue>mm_minenergy && maxValue<mm_maxenergy && maxValueBucket>mintime && maxValueBucket<maxtime)||cobo>0)
     {
         rwaveforms[decayIdx][cobo]->hasHit[asad*4+aget] = true;
-        rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget][chan] = true;
+        rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget].Set(chan);
         rwaveforms[decayIdx][cobo]->energy[asad*4+aget][chan] = maxValue;
         if(decayIdx>0) cout<<"DECAY MODE TIME"<<maxValueBucket<<"\t"<<decayIdx<<endl;
         rwaveforms[decayIdx][cobo]->time[asad*4+aget][chan] = maxValueBucket;// - decayIdx*256;
@@ -1954,6 +2107,54 @@ void LKFrameBuilder::GetEnergyTime(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t
     }
 }
 
+/// Deconvolves the waveforms of the queued channels, all of one AGET, by response[rftype] with the method set by
+/// SetDeconvolutionMethod. The FFT engine takes them in one call
+void LKFrameBuilder::DeconvolveWaveforms()
+{
+    fDeconvolutionWaveforms.clear();
+    for(size_t i=0;i<fNumEnergyTimeChannels;i++)
+        if(fEnergyTimeChannels[i].prepared) fDeconvolutionWaveforms.push_back(fEnergyTimeChannels[i].dec);
+    if(fDeconvolutionWaveforms.empty()) return;
+
+    const EnergyTimeChannel &first = fEnergyTimeChannels[0];
+    const Int_t type = first.rftype, decayIdx = first.decayIdx;
+    const Int_t spectrumIdx = first.cobo*maxasad*4+first.asad*4+first.aget;
+    const Int_t numWaveforms = fDeconvolutionWaveforms.size();
+    if(fDeconvolutionMethod>0 && !fDeconvolutionEngine.HasResponse(type))
+        fDeconvolutionEngine.SetResponse(type, response[type], 512);
+
+    if(fDeconvolutionMethod==0){
+        for(Double_t *dec : fDeconvolutionWaveforms)
+            sCorrWaveForm[spectrumIdx]->Deconvolution(dec,response[type],bucketmax,deconvrep[type],deconviter[type],deconvboost[type]);
+    }else if(fDeconvolutionMethod==1){
+        fDeconvolutionEngine.Deconvolve(type, fDeconvolutionWaveforms.data(), numWaveforms, bucketmax);
+    }else if(fDeconvolutionMethod==2){
+        // Gold results are kept, the FFT results are compared to them through the peak bucket used by GetEnergyTime
+        fDeconvolutionCopies.resize(numWaveforms*512);
+        fDeconvolutionCopyPtrs.resize(numWaveforms);
+        for(Int_t i=0;i<numWaveforms;i++){
+            fDeconvolutionCopyPtrs[i] = &fDeconvolutionCopies[i*512];
+            copy(fDeconvolutionWaveforms[i], fDeconvolutionWaveforms[i]+512, fDeconvolutionCopyPtrs[i]);
+            sCorrWaveForm[spectrumIdx]->Deconvolution(fDeconvolutionWaveforms[i],response[type],bucketmax,deconvrep[type],deconviter[type],deconvboost[type]);
+        }
+        fDeconvolutionEngine.Deconvolve(type, fDeconvolutionCopyPtrs.data(), numWaveforms, bucketmax);
+        UInt_t firstbuck = responsesample[type][6]*0.8+decayIdx*256;
+        for(Int_t i=0;i<numWaveforms;i++){
+            const Double_t *gold = fDeconvolutionWaveforms[i];
+            const Double_t *fft = fDeconvolutionCopyPtrs[i];
+            UInt_t goldbuck = firstbuck, fftbuck = firstbuck;
+            for(UInt_t buck=firstbuck;buck<bucketmax+decayIdx*256 && buck<512;buck++){
+                if(gold[buck]>gold[goldbuck]) goldbuck = buck;
+                if(fft[buck]>fft[fftbuck]) fftbuck = buck;
+            }
+            fNumDeconvolutionChecks++;
+            if(TMath::Abs((Int_t)goldbuck-(Int_t)fftbuck)<=2) fNumDeconvolutionAgreed++;
+            if(fNumDeconvolutionChecks%1000==0)
+                cout << "Deconvolution check: FFT peak within 2 buckets of Gold peak in " << fNumDeconvolutionAgreed << " of " << fNumDeconvolutionChecks << " waveforms" << endl;
+        }
+    }
+}
+
 /*
 Int_t LKFrameBuilder::GetEnergybyFitWaveform(Int_t type, Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan, Int_t maxAt, Int_t peakAt, Int_t *maxValuedec, Int_t *maxvalueBucketdec){
   Int_t bucketmin = peakAt - maxresponse[type];
@@ -2008,78 +2209,54 @@ Int_t LKFrameBuilder::GetEnergybyFitWaveform(Int_t type, Int_t decayIdx, Int_t c
 void LKFrameBuilder::GetEnergybyFitWaveform(Int_t type, Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan, Int_t peakAt)
 {
     Double_t tau, power;
-    TF1* fWaveform;
-    TH1D* hWaveform;
     Int_t bucketmin = peakAt - responsesigma[type]*1.5;
     Int_t bucketmax = peakAt + responsesigma[type]*1.5;
     Int_t baseline = rwaveforms[decayIdx][cobo]->baseline[asad*4+aget][chan];
     Int_t saturated = 0;
     Int_t minbuck = 0;
+    bool skip[512];
 
     if(type<3){
-        hWaveform = new TH1D("hWaveform","hWaveform",512,0,512);
         for(int buck=0;buck<512;buck++){
-            hWaveform->Fill(buck,rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan][buck]);
-            if(rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck]==0){
-                hWaveform->SetBinError(buck,0.0);
-                if(saturated==0) minbuck = buck;
-                saturated++;
-            }else if(rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck]==4095){
-                hWaveform->SetBinError(buck,0.0);
+            Int_t sample = rwaveforms[decayIdx][cobo]->waveform[asad*4+aget][chan][buck];
+            bool const isSaturated = (sample==0 || sample==4095);
+            skip[buck] = fFitSkipSaturated && isSaturated;
+            if(isSaturated){
                 if(saturated==0) minbuck = buck;
                 saturated++;
             }
         }
+        if(saturated>0) peakAt = minbuck + saturated/2;
 
+        const Int_t *corrwaveform = rwaveforms[decayIdx][cobo]->corrwaveform[asad*4+aget][chan].data();
         if(type==0){
-            //fWaveform = new TF1("fWaveform", this, &LKFrameBuilder::ShaperF_GET1, bucketmin, bucketmax, 6);
-            fWaveform = new TF1("fWaveform", this, &LKFrameBuilder::ShaperF_GET1, 0, 512, 6);
-            fWaveform->SetParNames("offset", "amplitude", "peakAt", "sigma", "power", "p2");
-            fWaveform->SetParameters(baseline, 500, peakAt, responsesigma[type], 3, 0.2);
-            if(saturated>0){
-                peakAt = minbuck + saturated/2;
-                fWaveform->SetParameter(2, peakAt);
-            }
-            fWaveform->FixParameter(3, responsesigma[type]);
-            fWaveform->SetParLimits(1, 0, 10000);
+            LKPulseFitter<LKPulseShapeGET1> fitter;
+            Double_t par[6] = {(Double_t) baseline, 500, (Double_t) peakAt, (Double_t) responsesigma[type], 3, 0.2};
+            fitter.SetParameters(par);
+            fitter.FixParameter(3, responsesigma[type]);
+            fitter.SetParLimits(1, 0, 10000);
+            FitWaveform(fitter, corrwaveform, skip, 0, 512);
         }else if(type==1) {
-            fWaveform = new TF1("fWaveform", this, &LKFrameBuilder::ShaperF_MSCF, bucketmin, bucketmax, 6);
-            fWaveform->SetParNames("offset", "amplitude", "peakAt", "sigma", "power", "p2");
-            fWaveform->SetParameters(baseline, 2000, peakAt, responsesigma[type], 3, 0.2);
-            if(saturated>0){
-                peakAt = minbuck + saturated/2;
-                fWaveform->SetParameter(2, peakAt);
-            }
-            fWaveform->FixParameter(3, responsesigma[type]);
-            fWaveform->SetParLimits(1, 0, 10000);
+            LKPulseFitter<LKPulseShapeMSCF> fitter;
+            Double_t par[6] = {(Double_t) baseline, 2000, (Double_t) peakAt, (Double_t) responsesigma[type], 3, 0.2};
+            fitter.SetParameters(par);
+            fitter.FixParameter(3, responsesigma[type]);
+            fitter.SetParLimits(1, 0, 10000);
+            FitWaveform(fitter, corrwaveform, skip, bucketmin, bucketmax);
         }else if(type==2){
-            //fWaveform = new TF1("fWaveform", this, &LKFrameBuilder::ShaperF_GET2, bucketmin, bucketmax, 5);
-            fWaveform = new TF1("fWaveform", this, &LKFrameBuilder::ShaperF_GET2, 0, 512, 5);
-            fWaveform->SetParNames("offset", "amplitude", "peakAt", "sigma", "power");
+            LKPulseFitter<LKPulseShapeGET2> fitter;
             if(cobo==0){
                 tau = 4.5; power = 2.3e-3;
             }else if(cobo==0){
                 tau = 15.5; power = 3.2e-4;
             }
-            fWaveform->SetParameters(baseline, 500, peakAt, tau, power);
-            if(saturated>0){
-                peakAt = minbuck + saturated/2;
-                fWaveform->SetParameter(2, peakAt);
-            }
-            fWaveform->SetParLimits(1, 0, 10000);
-            fWaveform->SetParLimits(3, tau*0.96, tau*1.04);
-            fWaveform->SetParLimits(4, power*0.96, power*1.1);
+            Double_t par[5] = {(Double_t) baseline, 500, (Double_t) peakAt, tau, power};
+            fitter.SetParameters(par);
+            fitter.SetParLimits(1, 0, 10000);
+            fitter.SetParLimits(3, tau*0.96, tau*1.04);
+            fitter.SetParLimits(4, power*0.96, power*1.1);
+            FitWaveform(fitter, corrwaveform, skip, 0, 512);
         }
-
-        hWaveform->Fit("fWaveform","WWQN+"); //Q=Quiet and N=Do not draw
-        maxValuefit = fWaveform->GetMaximum();
-        maxValueBucketfit = fWaveform->GetMaximumX();
-        for(int buck=0;buck<512;buck++){
-            corrwaveformfit[buck] = fWaveform->Eval(buck);
-            //if(reventIdx==104970&&cobo==0&&asad==0&&aget==0&&chan==64) cout << cobo << " " << asad << " " << aget << " " << chan << " " << corrwaveformfit[buck] << " " << maxValuefit << " " << maxValueBucketfit << " " << maxValueBucket << endl;
-        }
-        delete hWaveform;
-        delete fWaveform;
     }else{
         cout << Form("No wavefunction type defined: %d",type) << endl;
         maxValuefit = 0;
@@ -2087,6 +2264,19 @@ void LKFrameBuilder::GetEnergybyFitWaveform(Int_t type, Int_t decayIdx, Int_t co
     }
 }
 
+/// Fits corrwaveform in [first, last) with unit weights, as the former "WW" histogram fit, without the skipped buckets and fills maxValuefit, maxValueBucketfit and corrwaveformfit
+template <class Shape>
+void LKFrameBuilder::FitWaveform(LKPulseFitter<Shape> &fitter, const Int_t *corrwaveform, const bool *skip, Int_t first, Int_t last)
+{
+    first = TMath::Max(first, 0);
+    last = TMath::Min(last, 512);
+    fitter.Fit(corrwaveform, first, last, skip);
+    maxValuefit = fitter.GetMaximum(first, last, maxValueBucketfit);
+    for(int buck=0;buck<512;buck++){
+        corrwaveformfit[buck] = fitter.Eval(buck);
+    }
+}
+
 void LKFrameBuilder::ResetHitPattern() {
     hGET_THitPattern[goodevtcounter%16]->Reset();
     hGET_EHitPattern[goodevtcounter%16]->Reset();
@@ -2122,9 +2312,7 @@ void LKFrameBuilder::DrawHitPattern(Int_t decayIdx, UInt_t cobo)
         for(UInt_t aget=0; aget<4; aget++) {
 
             if(rwaveforms[decayIdx][cobo]->hasHit[asad*4+aget]){
-                for(UInt_t chan=0; chan<68; chan++) {
-
-                    if(!rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget][chan]) continue; // skip signals that did not fire
+                for(UInt_t chan : rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget]) { // fired channels only
 
                     if(rwaveforms[decayIdx][cobo]->energy[asad*4+aget][chan]>4095) rwaveforms[decayIdx][cobo]->energy[asad*4+aget][chan] = 4095;
                     if(readmode==2){
@@ -2277,9 +2465,7 @@ void LKFrameBuilder::WaveletFilter(Int_t decayIdx, UInt_t cobo)
     for(UInt_t asad=0; asad<maxasad; asad++) {
         for(UInt_t aget=0; aget<4; aget++) {
             if(!rwaveforms[decayIdx][cobo]->hasHit[asad*4+aget]) continue; // skip aget that did not fire
-            for(UInt_t chan=0; chan<68; chan++) {
-                if(chan==11 || chan==22 || chan==45 || chan==56) continue; // We want to skip the FPN channels.
-                if(!rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget][chan]) continue; // skip signals that did not fire
+            for(UInt_t chan : rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget].WithoutFPN()) { // fired channels other than the FPN ones
                 //if(cobo>0)
                 if(cobo==0 && rwaveforms[decayIdx][cobo]->energy[asad*4+aget][chan]>mm_minenergy && rwaveforms[decayIdx][cobo]->energy[asad*4+aget][chan]<mm_maxenergy)
                 {
@@ -2375,9 +2561,7 @@ void LKFrameBuilder::WaveformShapeFilter(Int_t decayIdx, UInt_t cobo)
                 bin2 = hGET_THitPattern[goodevtcounter%16]->ProjectionY("projy",projybegin,projyend)->GetXaxis()->FindBin(tmeansh+tlimitsh);
                 tintegralsh = hGET_THitPattern[goodevtcounter%16]->ProjectionY("projy",projybegin,projyend)->Integral(bin1,bin2);
             }
-            for(UInt_t chan=0; chan<68; chan++) {
-                if(chan==11 || chan==22 || chan==45 || chan==56) continue; // We want to skip the FPN channels.
-                if(!rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget][chan]) continue; // skip signals that did not fire
+            for(UInt_t chan : rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget].WithoutFPN()) { // fired channels other than the FPN ones
 
                 maxValue = rwaveforms[decayIdx][cobo]->energy[asad*4+aget][chan];
                 maxValueBucket = rwaveforms[decayIdx][cobo]->time[asad*4+aget][chan];
@@ -2436,9 +2620,7 @@ void LKFrameBuilder::DrawPSDFilter(Int_t decayIdx, UInt_t cobo)
     for(UInt_t asad=0; asad<maxasad; asad++) {
         for(UInt_t aget=0; aget<4; aget++) {
             if(!rwaveforms[decayIdx][cobo]->hasHit[asad*4+aget]) continue; // skip aget that did not fire
-            for(UInt_t chan=0; chan<68; chan++) {
-                if(chan==11 || chan==22 || chan==45 || chan==56) continue; // We want to skip the FPN channels.
-                if(!rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget][chan]) continue; // skip signals that did not fire
+            for(UInt_t chan : rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget].WithoutFPN()) { // fired channels other than the FPN ones
 
                 if((asad==2||asad==3)&&(aget==0||aget==1)&&(rwaveforms[decayIdx][cobo]->hasOverflow)){
                     maxValue = rwaveforms[decayIdx][cobo]->energy[asad*4+aget][chan];
@@ -2491,9 +2673,7 @@ void LKFrameBuilder::FillTrack()
                 for(UInt_t aget=0; aget<4; aget++) {
                     if(rwaveforms[decayIdx][cobo]->isRejected) continue; // skip a bad event from saturated Si det signals
                     if(!rwaveforms[decayIdx][cobo]->hasHit[asad*4+aget]) continue; // skip agets that did not have any fire
-                    for(UInt_t chan=0; chan<68; chan++) {
-                        if(chan==11 || chan==22 || chan==45 || chan==56) continue; // We want to skip the FPN channels.
-                        if(!rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget][chan]) continue; // skip signals that did not fire
+                    for(UInt_t chan : rwaveforms[decayIdx][cobo]->hasSignal[asad*4+aget].WithoutFPN()) { // fired channels other than the FPN ones
 
                         //cout << "Good ones: " << reventIdx << " " << cobo << " " << asad << " " << aget << " " << chan << endl;
                         if(cobo==0
@@ -4489,52 +4669,73 @@ void LKFrameBuilder::RootWConvert()
     //header -> SetDecayIdx(decayIdx);
 
 
-    int countPad = 0;
-    for(UInt_t asad=0; asad<maxasad; asad++) {
-        for(UInt_t aget=0; aget<4; aget++) {
-            if(!waveforms->hasHit[asad*4+aget]) continue; // Skip no fired agets.
-            for(UInt_t chan=0; chan<68; chan++) {
-
-                if(!waveforms->hasSignal[asad*4+aget][chan]) continue; // Skip no fired channels.
-                if(coboIdx>=0){
-                    if(readmode==1){
-
-                        auto channel = (GETChannel *) fChannelArray -> ConstructedAt(countPad++);
-                        channel -> SetCobo(coboIdx);
-                        channel -> SetAsad(asad);
-                        channel -> SetAget(aget);
-                        channel -> SetChan(chan);
-                        channel -> SetTime(0);
-                        channel -> SetEnergy(0);
-                        channel -> SetWaveform(waveforms->waveform[asad*4+aget][chan]);
+    // Channels of all frames of the event are appended to the array
+    // Only the fired channels are visited, in (asad, aget, chan) order as before
+    int countPad = fChannelArray -> GetEntriesFast();
+    LKWaveformArena &arena = waveforms->arena;
+    arena.SortFired();
+    for(size_t iFired=0; iFired<arena.GetNumFired(); iFired++) {
+        const UInt_t asad = arena.GetFiredAgetSlot(iFired)/4;
+        const UInt_t aget = arena.GetFiredAgetSlot(iFired)%4;
+        const UInt_t chan = arena.GetFiredChannel(iFired);
+        const uint16_t *row = arena.GetFiredRow(iFired);
+        if(!waveforms->hasHit[asad*4+aget]) continue; // Skip no fired agets.
+        if(coboIdx>=0){
+            if(readmode==1){
+
+                auto channel = (GETChannel *) fChannelArray -> ConstructedAt(countPad++);
+                channel -> SetCobo(coboIdx);
+                channel -> SetAsad(asad);
+                channel -> SetAget(aget);
+                channel -> SetChan(chan);
+                channel -> SetTime(0);
+                channel -> SetEnergy(0);
+                fWaveformBuffer.assign(row, row+bucketmax);
+                channel -> SetWaveform(fWaveformBuffer);
 
-                        /*
-                        wGETFrameNo[wGETMul] = frameIdx;
-                        wGETDecayNo[wGETMul] = decayIdx;
-                        wGETTime[wGETMul] = 0;
-                        wGETEnergy[wGETMul] = 0;
-                        wGETCobo[wGETMul] = coboIdx;
-                        wGETAsad[wGETMul] = asad;
-                        wGETAget[wGETMul] = aget;
-                        wGETChan[wGETMul] = chan;
-                        for(int i=0;i<bucketmax;i++){
-                            wGETWaveformX[wGETMul][i] = i;
-                            wGETWaveformY[wGETMul][i] = waveforms->waveform[asad*4+aget][chan][i];
-                        }
-                        //cout << weventIdx << " " << wGETMul << " " << coboIdx << " " << asad << " " << aget << " " << chan << endl;
-                        //if(weventIdx==1412) cout << wGETMul << " " << wGETFrameNo[wGETMul] << " " << wGETCobo[wGETMul] << " " << wGETAsad[wGETMul] << " " << wGETAget[wGETMul] << " " << wGETChan[wGETMul] << endl;
-                        */
-                        wGETMul++;
-                        if(chan!=11&&chan!=22&&chan!=45&&chan!=56) wGETHit++;
-                    }
+                /*
+                wGETFrameNo[wGETMul] = frameIdx;
+                wGETDecayNo[wGETMul] = decayIdx;
+                wGETTime[wGETMul] = 0;
+                wGETEnergy[wGETMul] = 0;
+                wGETCobo[wGETMul] = coboIdx;
+                wGETAsad[wGETMul] = asad;
+                wGETAget[wGETMul] = aget;
+                wGETChan[wGETMul] = chan;
+                for(int i=0;i<bucketmax;i++){
+                    wGETWaveformX[wGETMul][i] = i;
+                    wGETWaveformY[wGETMul][i] = row[i];
                 }
+                //cout << weventIdx << " " << wGETMul << " " << coboIdx << " " << asad << " " << aget << " " << chan << endl;
+                //if(weventIdx==1412) cout << wGETMul << " " << wGETFrameNo[wGETMul] << " " << wGETCobo[wGETMul] << " " << wGETAsad[wGETMul] << " " << wGETAget[wGETMul] << " " << wGETChan[wGETMul] << endl;
+                */
+                wGETMul++;
+                if(chan!=11&&chan!=22&&chan!=45&&chan!=56) wGETHit++;
             }
         }
     }
 }
 
 void LKFrameBuilder::RootWriteEvent(){
+    // Without the event buffer the hit pattern filter decides once the whole event is built
+    bool const passed = !fHitPatternFilter.IsActive() || fEventBuffer.IsActive() || fEventHitPatternPassed;
+    fEventHitPatternPassed = false;
+    if(wGETMul>0 && !passed){
+        ++fNumFilteredEvents;
+        if(fChannelArray!=nullptr) fChannelArray->Clear("C");
+        wGETMul = 0;
+        wGETHit = 0;
+        return;
+    }
     if(wGETMul>0){
+        if(fEventCallback) fEventCallback(wGETEventIdx);
+        if(fChannelArray!=nullptr) fChannelArray->Clear("C");
+        if(fOutputTree==nullptr){
+            framecounter++;
+            wGETMul = 0;
+            wGETHit = 0;
+            return;
+        }
         //cout << "Writing data: " << wGETEventIdx << " " << wGETMul << endl;
         fOutputFile->cd();
         fOutputTree->Fill();
@@ -4573,6 +4774,53 @@ void LKFrameBuilder::RootWriteEvent(){
     }
 }
 
+/**
+ * The event is written when the first frame of the next event arrives, so the conversion can be
+ * resumed from the first byte of the frame being processed. Inside a layered frame this only holds
+ * for the first sub frame, and the events written by FlushEvent have no frame after them.
+ */
+bool LKFrameBuilder::GetRestartOffset(size_t &offset){
+    if(fInputEnded || waveforms->frameIdx!=0) return false;
+    offset = frameOffset_B();
+    return true;
+}
+
+/// Unpacks the events left in the reorder buffer at the end of the input
+void LKFrameBuilder::FlushEventBuffer(){
+    try{
+        fEventBuffer.Flush();
+    }catch (const std::exception& e){
+        cout << e.what() << endl;
+    }
+}
+
+/// Emits the events of the reorder buffer which timed out while no frame arrived, the last one is written at once
+void LKFrameBuilder::PollEventBuffer(){
+    uint64_t const numEvents = fEventBuffer.GetNumEvents();
+    try{
+        fEventBuffer.Poll();
+    }catch (const std::exception& e){
+        cout << e.what() << endl;
+    }
+    // No frame of an emitted event can follow, it is complete
+    if(fEventBuffer.GetNumEvents()!=numEvents && readmode==1 && wGETMul>0){
+        wGETEventIdx = weventIdx;
+        RootWriteEvent();
+        RootWReset();
+    }
+}
+
+/// Writes the event which is still being built, at the end of the input
+void LKFrameBuilder::FlushEvent(){
+    fInputEnded = true;
+    FlushEventBuffer();
+    if(readmode==1 && wGETMul>0){
+        wGETEventIdx = weventIdx;
+        RootWriteEvent();
+        RootWReset();
+    }
+}
+
 void LKFrameBuilder::RootWCloseFile(){
     //fOutputFile->cd();
     fOutputFile->Close();
@@ -4707,7 +4955,6 @@ void LKFrameBuilder::RootRInitWaveforms() {
             rwaveforms[decayIdx][cobo]->PSDRatio.resize(maxasad*4);
             for(int i=0;i<maxasad;i++){
                 for(int j=0;j<4;j++){
-                    rwaveforms[decayIdx][cobo]->hasSignal[i*4+j].resize(68);
                     rwaveforms[decayIdx][cobo]->isOverflow[i*4+j].resize(68);
                     rwaveforms[decayIdx][cobo]->isDecay[i*4+j].resize(68);
                     rwaveforms[decayIdx][cobo]->waveform[i*4+j].resize(68);
@@ -4741,9 +4988,8 @@ void LKFrameBuilder::RootRResetWaveforms() {
             for(int i=0;i<maxasad;i++){
                 for(int j=0;j<4;j++){
                     if(rwaveforms[decayIdx][cobo]->hasHit[i*4+j] || rwaveforms[decayIdx][cobo]->hasFPN[i*4+j]){
-                        for(int k=0;k<68;k++){
-                            if(!rwaveforms[decayIdx][cobo]->hasSignal[i*4+j][k]) continue;
-                            rwaveforms[decayIdx][cobo]->hasSignal[i*4+j][k] = false;
+                        for(int k : rwaveforms[decayIdx][cobo]->hasSignal[i*4+j]){
+                            rwaveforms[decayIdx][cobo]->hasSignal[i*4+j].Reset(k);
                             rwaveforms[decayIdx][cobo]->isOverflow[i*4+j][k] = false;
                             rwaveforms[decayIdx][cobo]->isDecay[i*4+j][k] = 0;
                             rwaveforms[decayIdx][cobo]->energy[i*4+j][k] = 0.0;
@@ -4959,7 +5205,6 @@ void LKFrameBuilder::RootRHInitWaveforms() {
             rwaveforms[decayIdx][cobo]->time.resize(maxasad*4);
             for(int i=0;i<maxasad;i++){
                 for(int j=0;j<4;j++){
-                    rwaveforms[decayIdx][cobo]->hasSignal[i*4+j].resize(68);
                     rwaveforms[decayIdx][cobo]->isOverflow[i*4+j].resize(68);
                     rwaveforms[decayIdx][cobo]->isDecay[i*4+j].resize(68);
                     rwaveforms[decayIdx][cobo]->energy[i*4+j].resize(68);
@@ -4983,9 +5228,8 @@ void LKFrameBuilder::RootRHResetWaveforms()
             for(int i=0;i<maxasad;i++){
                 for(int j=0;j<4;j++){
                     if(rwaveforms[decayIdx][cobo]->hasHit[i*4+j] || rwaveforms[decayIdx][cobo]->hasFPN[i*4+j]){
-                        for(int k=0;k<68;k++){
-                            if(!rwaveforms[decayIdx][cobo]->hasSignal[i*4+j][k]) continue;
-                            rwaveforms[decayIdx][cobo]->hasSignal[i*4+j][k] = false;
+                        for(int k : rwaveforms[decayIdx][cobo]->hasSignal[i*4+j]){
+                            rwaveforms[decayIdx][cobo]->hasSignal[i*4+j].Reset(k);
                             rwaveforms[decayIdx][cobo]->isOverflow[i*4+j][k] = false;
                             rwaveforms[decayIdx][cobo]->isDecay[i*4+j][k] = 0;
                             rwaveforms[decayIdx][cobo]->energy[i*4+j][k] = 0.0;
@@ -5175,6 +5419,28 @@ void LKFrameBuilder::SetEnergyMethod(int flag){
     energymethod = flag;
 }
 
+void LKFrameBuilder::SetBaselineMethod(int flag){
+    if(!fBaselineEstimator.SetMethod(flag)) cout << "Unknown baseline method " << flag << ", using " << fBaselineEstimator.GetMethod() << endl;
+}
+
+void LKFrameBuilder::SetDeconvolutionMethod(int flag){
+    fDeconvolutionMethod = flag;
+}
+
+void LKFrameBuilder::AddDeconvolutionChecks(const LKFrameBuilder &other){
+    fNumDeconvolutionChecks += other.fNumDeconvolutionChecks;
+    fNumDeconvolutionAgreed += other.fNumDeconvolutionAgreed;
+}
+
+void LKFrameBuilder::SetDeconvolutionRegularization(double regularization){
+    fDeconvolutionEngine.SetRegularization(regularization);
+    fDeconvolutionEngine.ClearResponses();
+}
+
+void LKFrameBuilder::SetFitSkipSaturated(bool skip){
+    fFitSkipSaturated = skip;
+}
+
 void LKFrameBuilder::SetReadRF(int flag){
     readrw = flag;
 }
@@ -5299,6 +5565,7 @@ void LKFrameBuilder::SetResponseWaveform(){
 
 void LKFrameBuilder::GetMaxResponseWaveform(){
     Int_t maxamplitude;
+    fDeconvolutionEngine.ClearResponses();
     for(int i=0;i<=maxrespsample;i++){
         maxamplitude=-10000;
         for(int buck=0;buck<512;buck++){
@@ -5343,24 +5610,13 @@ void LKFrameBuilder::GetSigmaResponseWaveform(){
 }
 
 Double_t LKFrameBuilder::ShaperF_GET1(Double_t *x, Double_t *p) {
-    Double_t semiGaus = p[1]*22.68113723*TMath::Exp(-3.0*(x[0] - p[2])/p[3])*sin((x[0] - p[2])/p[3])*pow((x[0] - p[2])/p[3], p[4]);
-    return (x[0] >= p[2]) ? p[0] + x[0]*p[5] + semiGaus : p[0] + x[0]*p[5];
-    /*
-       Double_t val=0.;
-       for(int i=0; i<(p[0]-2)/2; i++) {
-       if(!(x[0]<p[2*i+2+1] || x[0]>1000000.))
-       val += p[2*i+2] * 22.68113723 * exp(-3.*(x[0]-p[2*i+2+1])/p[1]) * sin((x[0]-p[2*i+2+1])/p[1]) * pow((x[0]-p[2*i+2+1])/p[1], 3);
-       }
-       return(val);
-     */
+    return LKPulseShapeGET1().Eval(x[0], p);
 }
 
 Double_t LKFrameBuilder::ShaperF_MSCF(Double_t *x, Double_t *p) {
-    Double_t semiGaus = p[1]*21.928*TMath::Exp(-3.0*(x[0] - p[2])/p[3])*sin((x[0] - p[2])/p[3])*pow((x[0] - p[2])/p[3], p[4]);
-    return (x[0] >= p[2]) ? p[0] + x[0]*p[5] + semiGaus : p[0] + x[0]*p[5];
+    return LKPulseShapeMSCF().Eval(x[0], p);
 }
 
 Double_t LKFrameBuilder::ShaperF_GET2(Double_t *x, Double_t *p) {
-    Double_t semiGaus = p[0] + 0.5*p[1]*(1.0 + TMath::TanH( (x[0]-p[2])/p[3])) * TMath::Exp(-p[4]*((x[0]-p[2])*(x[0]-p[2])));
-    return semiGaus;
+    return LKPulseShapeGET2().Eval(x[0], p);
 }
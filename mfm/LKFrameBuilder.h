@@ -1,7 +1,16 @@
 #ifndef LKFRAMEBUILDER_H
 #define LKFRAMEBUILDER_H
 
-#include "mfm/FrameBuilder.h"
+#include "mfm/SlabFrameBuilder.h"
+#include "mfm/LKCoBoFrameRouter.h"
+#include "mfm/LKCoBoHitPatternFilter.h"
+#include "mfm/LKWaveformArena.h"
+#include "mfm/LKChannelMask.h"
+#include "mfm/LKEventReorderBuffer.h"
+#include "mfm/LKBaselineEstimator.h"
+#include "mfm/LKPulseFitter.h"
+#include "mfm/LKDeconvolutionEngine.h"
+#include "mfm/LKChannelKernel.h"
 #include <map>
 #include <vector>
 #include <TFile.h>
@@ -21,6 +30,7 @@
 #include <string.h>
 #include <TError.h>
 #include <fstream>
+#include <functional>
 
 using namespace std;
 class GSpectra;
@@ -31,7 +41,7 @@ class WaveForms {
         WaveForms();
         ~WaveForms();
         Bool_t isRejected;
-        vector<vector<Bool_t>> hasSignal; // To let us know if there was a signal that fired
+        vector<LKChannelMask> hasSignal; // To let us know which channels of each Aget fired
         vector<Bool_t> hasHit; // To let us know if there was any signal other than FPNs
         vector<Bool_t> hasFPN; // To let us know if there was any FPN signal
         vector<Bool_t> doneFPN; // To let us know if there was any FPN signal averaged
@@ -51,7 +61,8 @@ class WaveForms {
         UInt_t EstripR;
         UInt_t coboIdx;
         UInt_t asadIdx;
-        vector<vector<vector<UInt_t>>> waveform; // To save the waveform for each Aget, Channel and Bucket
+        vector<vector<vector<UInt_t>>> waveform; // To save the waveform for each Aget, Channel and Bucket (histogram modes)
+        LKWaveformArena arena; // Waveforms of the fired channels of the frame being converted
         vector<vector<vector<Int_t>>> corrwaveform; // To save the corrected waveform by the averaged FPN waveform
         vector<vector<UInt_t>> fpnwaveform; // To save the waveform for each Aget, FPN Channel and Bucket
         vector<vector<UInt_t>> energy; // Digitized energy value
@@ -166,12 +177,65 @@ class MapChanToX6 {
         UInt_t CsI_X6ud[4][4][68];
 };
 
-class LKFrameBuilder : public mfm::FrameBuilder {
+class LKFrameBuilder : public mfm::SlabFrameBuilder {
     public:
         void SetChannelArray(TClonesArray *channelArray) { fChannelArray = channelArray; }
+        /// Called with the event index each time a complete event has been filled into the channel array
+        void SetEventCallback(std::function<void(Int_t)> callback) { fEventCallback = callback; }
+        void FlushEvent();
+        /// Called from the event callback: input offset (as frameOffset_B) from which a conversion restarts
+        /// with the next event, false if it cannot restart there
+        bool GetRestartOffset(size_t &offset);
+        /// Frames to drop or divert before their items are decoded
+        LKCoBoFrameRouter &GetFrameRouter() { return fFrameRouter; }
+        /// Called with every frame the router diverts
+        void SetDivertCallback(std::function<void(mfm::Frame &)> callback) { fDivertCallback = callback; }
+        /// Events none of whose frames pass the hit pattern filter are not written. Event-built (layered) frames
+        /// and events of the event buffer are not even unpacked, other per-AsAd frames are unpacked before the decision
+        LKCoBoHitPatternFilter &GetHitPatternFilter() { return fHitPatternFilter; }
+        uint64_t GetNumFilteredEvents() const { return fNumFilteredEvents; }
+        /// Frames of one eventIdx from all CoBos, unpacked together once the event is complete
+        LKEventReorderBuffer &GetEventBuffer() { return fEventBuffer; }
+        void FlushEventBuffer();
+        void PollEventBuffer();
+        /// Hit whose energy and time are found, kept from QueueEnergyTime until its AGET is flushed
+        struct EnergyTimeChannel {
+            Int_t index = 0; ///< position of the hit in the lists of the caller
+            Int_t decayIdx = 0, cobo = 0, asad = 0, aget = 0, chan = 0;
+            bool prepared = false; ///< false for the FPN channels, which have no energy
+            Int_t mintime = 0, maxtime = 0;
+            Int_t maxValue = 0, maxValueBucket = 0, baseline = 0, rftype = 0;
+            Long64_t sum = 0;
+            Double_t dec[512]; ///< input, then result of the deconvolution
+        };
 
     private:
+        bool RouteFrame(mfm::Frame &frame);
+
         TClonesArray *fChannelArray = nullptr;
+        std::function<void(Int_t)> fEventCallback;
+        bool fInputEnded = false; ///< FlushEvent was called
+        LKCoBoFrameRouter fFrameRouter;
+        std::function<void(mfm::Frame &)> fDivertCallback;
+        LKCoBoHitPatternFilter fHitPatternFilter;
+        bool fHitPatternPassed = false; ///< a (sub) frame of the current frame passed the hit pattern filter
+        bool fEventHitPatternPassed = false; ///< a frame of the event being built passed the hit pattern filter
+        uint64_t fNumFilteredEvents = 0;
+        LKEventReorderBuffer fEventBuffer;
+        UInt_t fReadOldBucketMax = 0; ///< bucketmax before RootReadBegin
+        LKBaselineEstimator fBaselineEstimator;
+        Int_t fCorrPolarity[3][16]; ///< [cobo][asad*4+aget] LKChannelKernel::Polarity
+        LKDeconvolutionEngine fDeconvolutionEngine;
+        int fDeconvolutionMethod = 0;
+        bool fFitSkipSaturated = false; ///< EnergyFindingMethod 2 leaves saturated buckets out of the fit
+        Long64_t fNumDeconvolutionChecks = 0;
+        Long64_t fNumDeconvolutionAgreed = 0;
+        vector<EnergyTimeChannel> fEnergyTimeChannels; ///< queued hits of one AGET, see QueueEnergyTime
+        size_t fNumEnergyTimeChannels = 0;
+        vector<Double_t*> fDeconvolutionWaveforms; ///< batch handed to the deconvolution
+        vector<Double_t> fDeconvolutionCopies; ///< FFT inputs of DeconvolutionMethod 2
+        vector<Double_t*> fDeconvolutionCopyPtrs;
+        vector<UInt_t> fWaveformBuffer; ///< waveform handed to GETChannel::SetWaveform
 
     public:
         LKFrameBuilder(int);
@@ -192,6 +256,18 @@ class LKFrameBuilder : public mfm::FrameBuilder {
         void RootRInitWaveforms();
         void RootFindEvent();
         void RootReadEvent();
+        /// RootReadEvent in steps, so that a range of entries can be read on a worker thread (LKParallelReplay)
+        void RootReadBegin();
+        void RootReadEntry(Long64_t entry);
+        /// State carried from entry to entry, as if the entries before the given one had been read
+        void RootReadSeed(Long64_t entry);
+        void RootReadEnd();
+        Long64_t GetNumEntries() const { return fNumberEvents; }
+        /// Histograms accumulated over all events (not the per-event displays), in the same order for every builder
+        void GetAccumulatedHistograms(vector<TH1*> &histograms);
+        /// Adds the accumulated histograms of another builder to the ones of this builder
+        void AddHistograms(LKFrameBuilder &other);
+        void ResetHistograms();
         void RootRResetWaveforms();
         void RootRReset();
         void RootRCloseFile();
@@ -216,6 +292,14 @@ class LKFrameBuilder : public mfm::FrameBuilder {
         void SetSkipEvents(int flag);
         void SetfirstEventNo(int flag);
         void SetEnergyMethod(int flag);
+        void SetBaselineMethod(int flag);
+        void SetDeconvolutionMethod(int flag); ///< 0: TSpectrum Gold, 1: FFT Wiener, 2: Gold checked against FFT
+        /// Waveforms compared by DeconvolutionMethod 2, and those whose FFT peak is within 2 buckets of the Gold peak
+        Long64_t GetNumDeconvolutionChecks() const { return fNumDeconvolutionChecks; }
+        Long64_t GetNumDeconvolutionAgreed() const { return fNumDeconvolutionAgreed; }
+        void AddDeconvolutionChecks(const LKFrameBuilder &other);
+        void SetDeconvolutionRegularization(double regularization);
+        void SetFitSkipSaturated(bool skip); ///< false (default): saturated buckets are fitted with unit weight like the other ones
         void SetReadRF(int flag);
         int  GetForceReadTree();
         void ValidateEvent(mfm::Frame & frame);
@@ -245,11 +329,21 @@ class LKFrameBuilder : public mfm::FrameBuilder {
         Double_t ShaperF_GET2(Double_t *x, Double_t *p);
         Double_t ShaperF_MSCF(Double_t *x, Double_t *p);
         void GetAverageFPN(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget);
+        void InitCorrPolarity();
+        void CorrectWaveform(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan, Int_t maxFirst, Int_t maxLast, LKChannelFeatures &features);
         void GetCorrWaveform(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan);
         Double_t GetBaseline(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan);
         void GetEnergyTime(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan);
+        /// Corrects the waveform of the hit and queues it. The queue is flushed first when the AGET changes, so that
+        /// the fired channels of an AGET are deconvolved in one call; done is called for each hit once it has its energy
+        void QueueEnergyTime(Int_t index, Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan, const std::function<void(const EnergyTimeChannel &)> &done);
+        void FlushEnergyTime(const std::function<void(const EnergyTimeChannel &)> &done);
+        void PrepareEnergyTime(EnergyTimeChannel &channel);
+        void FinishEnergyTime(EnergyTimeChannel &channel);
         //void GetEnergybyFitWaveform(Int_t type, Int_t cobo, Int_t asad, Int_t aget, Int_t chan, Int_t maxAt, Int_t peakAt, Int_t *maxValuedec, Int_t *maxValueBucketdec); //using ratio method
         void GetEnergybyFitWaveform(Int_t type, Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan, Int_t peakAt); //using ShaperF method
+        void DeconvolveWaveforms();
+        template <class Shape> void FitWaveform(LKPulseFitter<Shape> &fitter, const Int_t *corrwaveform, const bool *skip, Int_t first, Int_t last);
         void DrawWaveForm(Int_t decayIdx, Int_t cobo, Int_t asad, Int_t aget, Int_t chan);
         void FillTrack();
         void FindBoxCorner();
@@ -300,106 +394,106 @@ class LKFrameBuilder : public mfm::FrameBuilder {
         TH1D* hCorrWaveFormDec[64];
         TH1D* hCorrWaveFormFit[64];
         TH2D* hCorrWaveFormRDF[64];
-        TH2D* hFPNWaveFormAll[64];
+        TH2D* hFPNWaveFormAll[64] = {};
         TH2D* hWaveFormbyEvent[64];
         TH2D* hCorrWaveFormbyEvent[64];
-        TH2D* hWaveFormIC;
+        TH2D* hWaveFormIC = nullptr;
         TSpectrum* sCorrWaveForm[64];
-        TH2D* hMM_TrackAll;
-        TH2D* hMMICenergyvsMME;
-        TH2D* hMM_EstripL;
-        TH2D* hMM_EstripR;
-        TH2D* hMM_EstripAll;
+        TH2D* hMM_TrackAll = nullptr;
+        TH2D* hMMICenergyvsMME = nullptr;
+        TH2D* hMM_EstripL = nullptr;
+        TH2D* hMM_EstripR = nullptr;
+        TH2D* hMM_EstripAll = nullptr;
         TH2D* hMM_Track[64];
         TH2D* hMM_TrackDecay[64];
         TH2D* hMM_TrackDecay2[64];
         TGraph2D* gMM_TrackDecay[64];
         TH2D* hMM_TrackvsE[64];
-        TH2D* hMM_TrackPosAll;
+        TH2D* hMM_TrackPosAll = nullptr;
         TH2D* hMM_TrackPos[64];
         TGraph2D* gMM_TrackDecayPos[64];
-        TH2D* hMM_TrackdEvsEALL[3];
-        TH2D* hMM_TrackdE1vsSiE;
-        TH2D* hMM_TrackdE1vsdE2;
+        TH2D* hMM_TrackdEvsEALL[3] = {};
+        TH2D* hMM_TrackdE1vsSiE = nullptr;
+        TH2D* hMM_TrackdE1vsdE2 = nullptr;
         TH2D* hMM_TrackdEvsE[64][3];
         TH2D* hMM_TrackPosHough[64][3];
         TH2D* hMM_TrackXZ[64];
         TH2D* hMM_TrackYZ[64];
-        TH2D* hMM_TrackPosXYAll;
-        TH2D* hMM_TrackPosXYTAll;
-        TH2D* hMM_TrackPosXZAll;
-        TH2D* hMM_TrackPosYZAll;
+        TH2D* hMM_TrackPosXYAll = nullptr;
+        TH2D* hMM_TrackPosXYTAll = nullptr;
+        TH2D* hMM_TrackPosXZAll = nullptr;
+        TH2D* hMM_TrackPosYZAll = nullptr;
         TH2D* hMM_TrackPosXY[64];
         TH2D* hMM_TrackPosXZ[64];
         TH2D* hMM_TrackPosYZ[64];
         TH2D* hMM_TimevsPxIDX[64];
-        TH2D* hMM_TimevsPxIDXPosAll;
-        TH2D* hMM_TimevsPxIDYAll;
+        TH2D* hMM_TimevsPxIDXPosAll = nullptr;
+        TH2D* hMM_TimevsPxIDYAll = nullptr;
         TH2D* hMM_TimevsPxIDXPos[64];
         TH2D* hMM_TimevsPxIDXPosHough[64][3];
         TH2D* hMM_TimevsPxIDY[64];
-        TH2D* hMM_TimevsPxIDYPosAll;
+        TH2D* hMM_TimevsPxIDYPosAll = nullptr;
         TH2D* hMM_TimevsPxIDYPos[64];
         TH2D* hMM_TimevsPxIDYPosHough[64][3];
-        TH2D* hMM_EnergyvsPxIDYALL;
+        TH2D* hMM_EnergyvsPxIDYALL = nullptr;
         TH2D* hMM_EnergyvsPxIDY[64];
-        TH2D* hMM_SiEvsCsIEAll;
-        TH2D* hMM_SiEvsCsIE[10][11];
-        TH2D* hMM_X6EvsCsIEAll;
+        TH2D* hMM_SiEvsCsIEAll = nullptr;
+        TH2D* hMM_SiEvsCsIE[10][11] = {};
+        TH2D* hMM_X6EvsCsIEAll = nullptr;
         TH2D* hMM_X6EvsCsIE[30];
         TH1I* hMM_SumEnergyvsPxIDY[64];
-        TH1I* hMM_SumEnergyMaxIDY;
-        TH1I* hMM_SumEnergyLastIDY;
-        TH2D* hMM_PSDIntegralvsMax[64];
-        TH2D* hMM_PSDRatiovsMax[64];
-        TH2D* hMM_PSDRatio[64];
-        TH2D* hMM_Pa_vs_Energy2D;
-        TH2D* hMM_Pa_vs_Time2D;
-        TH2D* hSi_Pa_vs_Energy2D;
-        TH2D* hSi_Pa_vs_Time2D;
-        TH1D* hMM_D2PTime;
-        TH1D* hMM_Sum2pEnergy[4];
+        TH1I* hMM_SumEnergyMaxIDY = nullptr;
+        TH1I* hMM_SumEnergyLastIDY = nullptr;
+        TH2D* hMM_PSDIntegralvsMax[64] = {};
+        TH2D* hMM_PSDRatiovsMax[64] = {};
+        TH2D* hMM_PSDRatio[64] = {};
+        TH2D* hMM_Pa_vs_Energy2D = nullptr;
+        TH2D* hMM_Pa_vs_Time2D = nullptr;
+        TH2D* hSi_Pa_vs_Energy2D = nullptr;
+        TH2D* hSi_Pa_vs_Time2D = nullptr;
+        TH1D* hMM_D2PTime = nullptr;
+        TH1D* hMM_Sum2pEnergy[4] = {};
         TH1D* hMM_Time[64];
         TH1D* hMM_Energy[64];
-        TH1D* hGET_EALL[64];
-        TH1D* hGET_E[64][68];
+        TH1D* hGET_EALL[64] = {};
+        TH1D* hGET_E[64][68] = {};
         TH1I* hGET_HitPattern;
-        TH2I* hGET_EHitPattern2D;
-        TH2I* hGET_THitPattern2D;
-        TH2I* hGET_Si16x16HitPattern2D;
-        TH2I* hGET_SiForwardHitPattern2D;
-        TH1I* hGET_SiForwardMult;
-        TH2I* hGET_SivsCsIHitPattern2D;
-        TH2I* hGET_DecEHitPattern2D;
-        TH2I* hGET_DecTHitPattern2D;
-        TH2I* hGET_FitEHitPattern2D;
-        TH2I* hGET_FitTHitPattern2D;
-        TH2I* hGET_DecdEMaxvsEMax2D;
-        TH2I* hGET_DecdTMaxvsTMax2D;
-        TH2I* hGET_FitdEMaxvsEMax2D;
-        TH2I* hGET_FitdTMaxvsTMax2D;
+        TH2I* hGET_EHitPattern2D = nullptr;
+        TH2I* hGET_THitPattern2D = nullptr;
+        TH2I* hGET_Si16x16HitPattern2D = nullptr;
+        TH2I* hGET_SiForwardHitPattern2D = nullptr;
+        TH1I* hGET_SiForwardMult = nullptr;
+        TH2I* hGET_SivsCsIHitPattern2D = nullptr;
+        TH2I* hGET_DecEHitPattern2D = nullptr;
+        TH2I* hGET_DecTHitPattern2D = nullptr;
+        TH2I* hGET_FitEHitPattern2D = nullptr;
+        TH2I* hGET_FitTHitPattern2D = nullptr;
+        TH2I* hGET_DecdEMaxvsEMax2D = nullptr;
+        TH2I* hGET_DecdTMaxvsTMax2D = nullptr;
+        TH2I* hGET_FitdEMaxvsEMax2D = nullptr;
+        TH2I* hGET_FitdTMaxvsTMax2D = nullptr;
         TH2D* hGET_EHitPattern[64];
         TH2D* hGET_THitPattern[64];
         TH2D* hGET_ERHitPattern[64];
-        TH1D* hMM_a0[4];
-        TH1D* hMM_a1[4];
-        TH1D* hMM_b0[4];
-        TH1D* hMM_b1[4];
-        TH2D* hBM_LR;
-        TH2D* hBM_Esum1vsPos;
-        TH2D* hBM_Esum2vsEsum1;
-        TH2D* hX6_LRAll;
-        TH2D* hX6_EsumvsPosAll;
-        TH2D* hX6_EsumvsPosAllLeft;
-        TH2D* hX6_EsumvsPosAllRight;
-        TH1D* hX6_EbackAll;
-        TH2D* hX6_LR[48][8];
-        TH2D* hX6_EsumvsPos[48][8];
-        TH1D* hX6_Eback[48][4];
-        TH2D* hX6_LeftHitPattern;
-        TH2D* hX6_BottomHitPattern;
-        TH2D* hX6_RightHitPattern;
-        TH2D* hX6_OhmicHitPattern;
+        TH1D* hMM_a0[4] = {};
+        TH1D* hMM_a1[4] = {};
+        TH1D* hMM_b0[4] = {};
+        TH1D* hMM_b1[4] = {};
+        TH2D* hBM_LR = nullptr;
+        TH2D* hBM_Esum1vsPos = nullptr;
+        TH2D* hBM_Esum2vsEsum1 = nullptr;
+        TH2D* hX6_LRAll = nullptr;
+        TH2D* hX6_EsumvsPosAll = nullptr;
+        TH2D* hX6_EsumvsPosAllLeft = nullptr;
+        TH2D* hX6_EsumvsPosAllRight = nullptr;
+        TH1D* hX6_EbackAll = nullptr;
+        TH2D* hX6_LR[48][8] = {};
+        TH2D* hX6_EsumvsPos[48][8] = {};
+        TH1D* hX6_Eback[48][4] = {};
+        TH2D* hX6_LeftHitPattern = nullptr;
+        TH2D* hX6_BottomHitPattern = nullptr;
+        TH2D* hX6_RightHitPattern = nullptr;
+        TH2D* hX6_OhmicHitPattern = nullptr;
         TRandom* rpos;
         TCutG* cut_pinSiEvsCsIE;
         TCutG* cut_pinX6EvsCsIE;
@@ -511,9 +605,9 @@ class LKFrameBuilder : public mfm::FrameBuilder {
         UInt_t si_maxtime;
         TFile* fInputFile;
         TTree* fInputTree;
-        TFile* fOutputFile;
+        TFile* fOutputFile = nullptr;
         UInt_t fInputFileSize;
-        TTree* fOutputTree;
+        TTree* fOutputTree = nullptr;
         Int_t fNumberEvents;
         Float_t fTimePerBin;
         Int_t wGETMul;
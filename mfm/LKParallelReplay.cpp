@@ -0,0 +1,117 @@
+#include "LKParallelReplay.h"
+#include "LKFrameBuilder.h"
+
+#include <TROOT.h>
+#include <TFile.h>
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+using namespace std;
+
+LKParallelReplay::LKParallelReplay(LKFrameBuilder *target, std::function<LKFrameBuilder*()> newBuilder)
+    : fTarget(target), fNewBuilder(newBuilder)
+{
+}
+
+LKParallelReplay::~LKParallelReplay()
+{
+    for (auto worker : fWorkers) {
+        delete worker->builder;
+        delete worker;
+    }
+}
+
+bool LKParallelReplay::Run(std::string inputFileName, std::string inputTreeName)
+{
+    {
+        TFile file(inputFileName.c_str(), "read");
+        if (file.IsZombie()) {
+            cerr << "LKParallelReplay: could not open " << inputFileName << endl;
+            return false;
+        }
+    }
+
+    // Every worker reads the tree through its own TFile
+    ROOT::EnableThreadSafety();
+    int numThreads = fNumThreads;
+    if (numThreads <= 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    // Trees and response waveforms are set up one builder after the other
+    for (int i=0; i<numThreads; ++i) {
+        auto worker = new Worker();
+        worker->builder = fNewBuilder();
+        string fileName = inputFileName;
+        string treeName = inputTreeName;
+        worker->builder -> RootROpenFile(fileName, treeName);
+        worker->builder -> RootReadBegin();
+        fWorkers.push_back(worker);
+    }
+
+    fNumEntries = fWorkers[0]->builder -> GetNumEntries();
+    Long64_t const numEntriesPerWorker = (fNumEntries + numThreads - 1) / numThreads;
+    for (int i=0; i<numThreads; ++i) {
+        fWorkers[i]->firstEntry = std::min(fNumEntries, i * numEntriesPerWorker);
+        fWorkers[i]->endEntry = std::min(fNumEntries, (i+1) * numEntriesPerWorker);
+    }
+    cout << "LKParallelReplay: " << fNumEntries << " entries on " << numThreads << " threads" << endl;
+
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    int numRunning = numThreads;
+    vector<std::thread> threads;
+    for (auto worker : fWorkers) {
+        threads.emplace_back([worker, &doneMutex, &doneCondition, &numRunning]() {
+            // Duplicates of a recovered file, first event and 2p decay pairing depend on the entries before the range
+            worker->builder -> RootReadSeed(worker->firstEntry);
+            for (Long64_t entry=worker->firstEntry; entry<worker->endEntry; ++entry) {
+                std::lock_guard<std::mutex> lock(worker->mutex);
+                worker->builder -> RootReadEntry(entry);
+            }
+            worker->builder -> RootReadEnd();
+            std::lock_guard<std::mutex> lock(doneMutex);
+            --numRunning;
+            doneCondition.notify_one();
+        });
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(doneMutex);
+        auto const finished = [&numRunning]() { return numRunning == 0; };
+        while (!finished()) {
+            if (fSnapshotInterval <= 0) {
+                doneCondition.wait(lock, finished);
+                break;
+            }
+            if (!doneCondition.wait_for(lock, std::chrono::duration<double>(fSnapshotInterval), finished)) {
+                lock.unlock();
+                Snapshot();
+                lock.lock();
+            }
+        }
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    Snapshot();
+    for (auto worker : fWorkers) {
+        fTarget -> AddDeconvolutionChecks(*worker->builder);
+        worker->builder -> RootRCloseFile();
+    }
+    return true;
+}
+
+/// Replaces the histograms of the target by the sum of the ones of the workers
+void LKParallelReplay::Snapshot()
+{
+    fTarget -> ResetHistograms();
+    for (auto worker : fWorkers) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        fTarget -> AddHistograms(*worker->builder);
+    }
+    if (fSnapshotCallback)
+        fSnapshotCallback();
+}
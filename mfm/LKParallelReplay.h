@@ -0,0 +1,59 @@
+#ifndef LKPARALLELREPLAY_H
+#define LKPARALLELREPLAY_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <Rtypes.h>
+
+class LKFrameBuilder;
+
+/*
+ * Replays a converted tree through LKFrameBuilder::RootReadEntry on several threads.
+ * The per-event state of the analysis (waveforms, maxValue, rftype, mm_tracks, ...) lives in the builder members,
+ * so every worker owns a complete builder made by the factory, opens the tree itself and reads its own contiguous
+ * range of entries, in order, from the state the entries before the range leave (LKFrameBuilder::RootReadSeed).
+ * Workers fill their own histograms, which are summed into the target builder (LKFrameBuilder::AddHistograms)
+ * at the end of the replay and at every snapshot, so the merged histograms are the ones of a sequential replay.
+ */
+class LKParallelReplay
+{
+    public:
+        /// newBuilder makes an initialized builder without histogram server, like the one of the target
+        LKParallelReplay(LKFrameBuilder *target, std::function<LKFrameBuilder*()> newBuilder);
+        virtual ~LKParallelReplay();
+
+        /// 0 for the number of cores
+        void SetNumThreads(int numThreads) { fNumThreads = numThreads; }
+        /// Histograms of the workers are summed into the target every interval [s] during the replay, 0 for never
+        void SetSnapshotInterval(double seconds) { fSnapshotInterval = seconds; }
+        /// Called after each snapshot and after the final merge, e.g. to redraw or save the target histograms
+        void SetSnapshotCallback(std::function<void()> callback) { fSnapshotCallback = callback; }
+
+        bool Run(std::string inputFileName, std::string inputTreeName);
+
+        Long64_t GetNumEntries() const { return fNumEntries; }
+
+    private:
+        struct Worker {
+            LKFrameBuilder *builder = nullptr;
+            Long64_t firstEntry = 0;
+            Long64_t endEntry = 0;
+            std::mutex mutex; ///< held while an entry is read, so that a snapshot sees complete events only
+        };
+
+        void Snapshot();
+
+        LKFrameBuilder *fTarget;
+        std::function<LKFrameBuilder*()> fNewBuilder;
+        int fNumThreads = 0;
+        double fSnapshotInterval = 0;
+        std::function<void()> fSnapshotCallback;
+
+        std::vector<Worker*> fWorkers;
+        Long64_t fNumEntries = 0;
+};
+
+#endif
@@ -0,0 +1,282 @@
+#ifndef LKPULSEFITTER_H
+#define LKPULSEFITTER_H
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+/*
+ * Pulse shapes of the GET and MSCF shapers (LKFrameBuilder::ShaperF_GET1, ShaperF_MSCF, ShaperF_GET2).
+ * Eval(x, p, grad) returns the shape at x and, if grad is not nullptr, its derivatives with respect to the parameters.
+ */
+class LKPulseShapeSemiGaus
+{
+    public:
+        /// offset, amplitude, peakAt, sigma, power, slope
+        static const int kNumPars = 6;
+
+        LKPulseShapeSemiGaus(double norm) : fNorm(norm) {}
+
+        double Eval(double x, const double *p, double *grad = nullptr) const {
+            double const norm = fNorm;
+            double const t = (x - p[2]) / p[3];
+            if (grad != nullptr) {
+                grad[0] = 1;
+                grad[5] = x;
+                grad[1] = grad[2] = grad[3] = grad[4] = 0;
+            }
+            if (x < p[2] || t <= 0)
+                return p[0] + x*p[5];
+
+            double const expSinPow = norm * std::exp(-3.0*t) * std::sin(t) * std::pow(t, p[4]);
+            double const semiGaus = p[1] * expSinPow;
+            if (grad != nullptr) {
+                // d(semiGaus)/dt = semiGaus * (-3 + cot(t) + power/t), written without dividing by sin(t)
+                double const dSdt = p[1] * norm * std::exp(-3.0*t) * std::pow(t, p[4]) * ((p[4]/t - 3.0)*std::sin(t) + std::cos(t));
+                grad[1] = expSinPow;
+                grad[2] = -dSdt / p[3];
+                grad[3] = -dSdt * t / p[3];
+                grad[4] = semiGaus * std::log(t);
+            }
+            return p[0] + x*p[5] + semiGaus;
+        }
+
+    private:
+        double fNorm;
+};
+
+class LKPulseShapeGET1 : public LKPulseShapeSemiGaus { public: LKPulseShapeGET1() : LKPulseShapeSemiGaus(22.68113723) {} };
+class LKPulseShapeMSCF : public LKPulseShapeSemiGaus { public: LKPulseShapeMSCF() : LKPulseShapeSemiGaus(21.928) {} };
+
+class LKPulseShapeGET2
+{
+    public:
+        /// offset, amplitude, peakAt, tau, power
+        static const int kNumPars = 5;
+
+        double Eval(double x, const double *p, double *grad = nullptr) const {
+            double const dx = x - p[2];
+            double const tanh = std::tanh(dx / p[3]);
+            double const gaus = std::exp(-p[4]*dx*dx);
+            double const step = 0.5 * (1.0 + tanh);
+            double const pulse = p[1] * step * gaus;
+            if (grad != nullptr) {
+                double const dStepdx = 0.5 * (1.0 - tanh*tanh) / p[3];
+                double const dPulsedx = p[1] * gaus * (dStepdx - 2.0*p[4]*dx*step);
+                grad[0] = 1;
+                grad[1] = step * gaus;
+                grad[2] = -dPulsedx;
+                grad[3] = -p[1] * gaus * dStepdx * dx / p[3];
+                grad[4] = -pulse * dx*dx;
+            }
+            return p[0] + pulse;
+        }
+};
+
+/*
+ * Levenberg-Marquardt least squares fit of a pulse shape to the buckets of a waveform.
+ * All buckets have unit weight and sit at the bin centers (bucket + 0.5), as in the former TH1::Fit("WW") of the
+ * waveform histogram. Parameters can be fixed or limited to a range, which is applied by clamping every step.
+ * The workspace is a few fixed-size arrays in the object and nothing is allocated, so independent fitters can be used
+ * concurrently from any number of threads.
+ */
+template <class Shape>
+class LKPulseFitter
+{
+    public:
+        static const int kNumPars = Shape::kNumPars;
+
+        LKPulseFitter() {
+            for (int i=0; i<kNumPars; ++i) {
+                fPar[i] = 0;
+                fFixed[i] = false;
+                fLow[i] = -std::numeric_limits<double>::infinity();
+                fHigh[i] = std::numeric_limits<double>::infinity();
+            }
+        }
+
+        void SetParameters(const double *par) { for (int i=0; i<kNumPars; ++i) fPar[i] = par[i]; }
+        void SetParameter(int i, double value) { fPar[i] = value; }
+        void FixParameter(int i, double value) { fPar[i] = value; fFixed[i] = true; }
+        void SetParLimits(int i, double low, double high) { fLow[i] = low; fHigh[i] = high; }
+        void SetMaxIterations(int numIterations) { fMaxIterations = numIterations; }
+        void SetTolerance(double tolerance) { fTolerance = tolerance; }
+
+        /// Fits samples[first, last), buckets with skip[bucket] set (e.g. saturated ones) are left out. Returns true if converged.
+        template <typename T>
+        bool Fit(const T *samples, int first, int last, const bool *skip = nullptr) {
+            fNumIterations = 0;
+            fNDF = 0;
+            int free[kNumPars];
+            int numFree = 0;
+            for (int i=0; i<kNumPars; ++i) {
+                fPar[i] = Clamp(i, fPar[i]);
+                if (!fFixed[i])
+                    free[numFree++] = i;
+            }
+
+            double alpha[kNumPars][kNumPars];
+            double beta[kNumPars];
+            fChi2 = Normal(samples, first, last, skip, free, numFree, alpha, beta);
+            for (int bucket=first; bucket<last; ++bucket)
+                if (skip == nullptr || !skip[bucket])
+                    ++fNDF;
+            fNDF -= numFree;
+            if (numFree == 0)
+                return true;
+
+            double lambda = 1.e-3;
+            while (fNumIterations < fMaxIterations)
+            {
+                ++fNumIterations;
+                double matrix[kNumPars][kNumPars];
+                double step[kNumPars];
+                for (int i=0; i<numFree; ++i) {
+                    for (int j=0; j<numFree; ++j)
+                        matrix[i][j] = alpha[i][j];
+                    matrix[i][i] += lambda * (alpha[i][i] > 0 ? alpha[i][i] : 1.);
+                    step[i] = beta[i];
+                }
+                if (!Solve(matrix, step, numFree)) {
+                    lambda *= 10;
+                    if (lambda > kMaxLambda) return false;
+                    continue;
+                }
+
+                double trial[kNumPars];
+                for (int i=0; i<kNumPars; ++i) trial[i] = fPar[i];
+                for (int i=0; i<numFree; ++i) trial[free[i]] = Clamp(free[i], fPar[free[i]] + step[i]);
+
+                double const chi2 = Chi2(samples, first, last, skip, trial);
+                if (chi2 < fChi2) {
+                    double const change = fChi2 - chi2;
+                    for (int i=0; i<kNumPars; ++i) fPar[i] = trial[i];
+                    fChi2 = Normal(samples, first, last, skip, free, numFree, alpha, beta);
+                    lambda = std::max(lambda * 0.1, 1.e-12);
+                    if (change <= fTolerance * (fChi2 + fTolerance))
+                        return true;
+                }
+                else {
+                    lambda *= 10;
+                    if (lambda > kMaxLambda)
+                        return true; // no step improves chi2 any more: at the minimum within the limits
+                }
+            }
+            return false;
+        }
+
+        double GetParameter(int i) const { return fPar[i]; }
+        const double *GetParameters() const { return fPar; }
+        double GetChi2() const { return fChi2; }
+        int GetNDF() const { return fNDF; }
+        int GetNumIterations() const { return fNumIterations; }
+
+        double Eval(double x) const { return fShape.Eval(x, fPar); }
+
+        /// Maximum of the fitted shape in [xmin, xmax]: coarse scan of the buckets refined by golden section search
+        double GetMaximum(double xmin, double xmax, double &xAtMax) const {
+            xAtMax = xmin;
+            double maximum = Eval(xmin);
+            for (double x=xmin+1; x<=xmax; x+=1) {
+                double const value = Eval(x);
+                if (value > maximum) { maximum = value; xAtMax = x; }
+            }
+            double a = std::max(xmin, xAtMax - 1);
+            double b = std::min(xmax, xAtMax + 1);
+            double const ratio = 0.5 * (std::sqrt(5.) - 1.);
+            double c = b - ratio * (b - a);
+            double d = a + ratio * (b - a);
+            double fc = Eval(c), fd = Eval(d);
+            for (int i=0; i<40 && b-a>1.e-6; ++i) {
+                if (fc > fd) { b = d; d = c; fd = fc; c = b - ratio * (b - a); fc = Eval(c); }
+                else         { a = c; c = d; fc = fd; d = a + ratio * (b - a); fd = Eval(d); }
+            }
+            double const x = 0.5 * (a + b);
+            double const value = Eval(x);
+            if (value > maximum) { maximum = value; xAtMax = x; }
+            return maximum;
+        }
+
+    private:
+        static constexpr double kMaxLambda = 1.e10;
+
+        double Clamp(int i, double value) const { return std::min(std::max(value, fLow[i]), fHigh[i]); }
+
+        template <typename T>
+        double Chi2(const T *samples, int first, int last, const bool *skip, const double *par) const {
+            double chi2 = 0;
+            for (int bucket=first; bucket<last; ++bucket) {
+                if (skip != nullptr && skip[bucket]) continue;
+                double const residual = samples[bucket] - fShape.Eval(bucket + 0.5, par);
+                chi2 += residual * residual;
+            }
+            return chi2;
+        }
+
+        /// chi2 at fPar, with the normal matrix alpha = J^T J and beta = J^T r of the free parameters
+        template <typename T>
+        double Normal(const T *samples, int first, int last, const bool *skip, const int *free, int numFree,
+                double alpha[][kNumPars], double *beta) const {
+            for (int i=0; i<numFree; ++i) {
+                beta[i] = 0;
+                for (int j=0; j<=i; ++j) alpha[i][j] = 0;
+            }
+            double chi2 = 0;
+            double grad[kNumPars];
+            for (int bucket=first; bucket<last; ++bucket) {
+                if (skip != nullptr && skip[bucket]) continue;
+                double const residual = samples[bucket] - fShape.Eval(bucket + 0.5, fPar, grad);
+                chi2 += residual * residual;
+                for (int i=0; i<numFree; ++i) {
+                    double const gi = grad[free[i]];
+                    beta[i] += gi * residual;
+                    for (int j=0; j<=i; ++j)
+                        alpha[i][j] += gi * grad[free[j]];
+                }
+            }
+            for (int i=0; i<numFree; ++i)
+                for (int j=0; j<i; ++j)
+                    alpha[j][i] = alpha[i][j];
+            return chi2;
+        }
+
+        /// Solves matrix * x = vector in place (Cholesky), false if the matrix is not positive definite
+        static bool Solve(double matrix[][kNumPars], double *vector, int n) {
+            for (int i=0; i<n; ++i) {
+                for (int j=0; j<=i; ++j) {
+                    double sum = matrix[i][j];
+                    for (int k=0; k<j; ++k)
+                        sum -= matrix[i][k] * matrix[j][k];
+                    if (i == j) {
+                        if (!(sum > 0)) return false;
+                        matrix[i][i] = std::sqrt(sum);
+                    }
+                    else
+                        matrix[i][j] = sum / matrix[j][j];
+                }
+            }
+            for (int i=0; i<n; ++i) {
+                for (int k=0; k<i; ++k) vector[i] -= matrix[i][k] * vector[k];
+                vector[i] /= matrix[i][i];
+            }
+            for (int i=n-1; i>=0; --i) {
+                for (int k=i+1; k<n; ++k) vector[i] -= matrix[k][i] * vector[k];
+                vector[i] /= matrix[i][i];
+            }
+            return true;
+        }
+
+        Shape fShape;
+        double fPar[kNumPars];
+        bool fFixed[kNumPars];
+        double fLow[kNumPars];
+        double fHigh[kNumPars];
+        int fMaxIterations = 200;
+        double fTolerance = 1.e-8;
+
+        double fChi2 = 0;
+        int fNDF = 0;
+        int fNumIterations = 0;
+};
+
+#endif
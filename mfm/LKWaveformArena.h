@@ -0,0 +1,72 @@
+#ifndef LKWAVEFORMARENA_H
+#define LKWAVEFORMARENA_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+/*
+ * Waveforms of the fired channels of one frame.
+ * A channel gets the next free row of uint16 samples the first time one of its samples is stored,
+ * and is appended to the fired channel list. All rows are allocated once by Init(), so a zero-suppressed
+ * frame only touches the few rows it fills, and Reset() only clears those rows.
+ * Channels are identified by their key (asadIdx*4+agetIdx)*numChannels+chanIdx.
+ */
+class LKWaveformArena
+{
+    public:
+        LKWaveformArena() {}
+
+        void Init(int numAgets, int numChannels, int numBuckets) {
+            fNumAgets = numAgets;
+            fNumChannels = numChannels;
+            fNumBuckets = numBuckets;
+            fSamples.assign((size_t) numAgets * numChannels * numBuckets, 0);
+            fRowOfKey.assign(numAgets * numChannels, -1);
+            fFiredKeys.clear();
+            fFiredKeys.reserve(numAgets * numChannels);
+        }
+
+        /// Row of the channel, taken from the arena if the channel did not fire yet. nullptr if out of range.
+        uint16_t *GetRow(uint32_t agetSlot, uint32_t chanIdx) {
+            if (agetSlot >= (uint32_t) fNumAgets || chanIdx >= (uint32_t) fNumChannels)
+                return nullptr;
+            int const key = agetSlot * fNumChannels + chanIdx;
+            int &row = fRowOfKey[key];
+            if (row < 0) {
+                row = fFiredKeys.size();
+                fFiredKeys.push_back(key);
+            }
+            return &fSamples[(size_t) row * fNumBuckets];
+        }
+
+        size_t GetNumFired() const { return fFiredKeys.size(); }
+        int GetFiredKey(size_t i) const { return fFiredKeys[i]; }
+        int GetFiredAgetSlot(size_t i) const { return fFiredKeys[i] / fNumChannels; }
+        int GetFiredChannel(size_t i) const { return fFiredKeys[i] % fNumChannels; }
+        const uint16_t *GetFiredRow(size_t i) const { return &fSamples[(size_t) fRowOfKey[fFiredKeys[i]] * fNumBuckets]; }
+        int GetNumBuckets() const { return fNumBuckets; }
+
+        /// Orders the fired channel list by (asad, aget, channel), rows stay where they are
+        void SortFired() { std::sort(fFiredKeys.begin(), fFiredKeys.end()); }
+
+        /// Clears the rows of the fired channels only
+        void Reset() {
+            for (int key : fFiredKeys) {
+                int &row = fRowOfKey[key];
+                std::fill_n(&fSamples[(size_t) row * fNumBuckets], fNumBuckets, 0);
+                row = -1;
+            }
+            fFiredKeys.clear();
+        }
+
+    private:
+        int fNumAgets = 0;
+        int fNumChannels = 0;
+        int fNumBuckets = 0;
+        std::vector<uint16_t> fSamples; ///< numAgets*numChannels rows of numBuckets samples
+        std::vector<int> fRowOfKey;     ///< row of each channel, -1 if it did not fire
+        std::vector<int> fFiredKeys;    ///< channels in the order they fired
+};
+
+#endif
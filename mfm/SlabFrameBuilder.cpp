@@ -0,0 +1,143 @@
+/*
+ * @file SlabFrameBuilder.cpp
+ * -----------------------------------------------------------------------------
+ */
+
+#include "mfm/SlabFrameBuilder.h"
+#include "mfm/PrimaryHeader.h"
+#include "mfm/Frame.h"
+#include "mfm/Exception.h"
+#include "utl/Logging.h"
+#include <algorithm>
+
+namespace mfm {
+//______________________________________________________________________
+/**
+ * Constructor.
+ * @param initialCapacity_B Size [Bytes] of the slab allocated upfront.
+ */
+SlabFrameBuilder::SlabFrameBuilder(size_t const initialCapacity_B)
+	: FrameBuilder(), slab_(0), capacity_(initialCapacity_B), head_(0), tail_(0), frameSize_(0), received_(0)
+{
+	slab_.setCapacity(capacity_);
+	slab_.set_size_B(capacity_);
+}
+//______________________________________________________________________
+SlabFrameBuilder::~SlabFrameBuilder()
+{
+}
+//______________________________________________________________________
+/**
+ * Appends a chunk of data to the slab and processes all the frames it completes.
+ */
+void SlabFrameBuilder::addDataChunk(const mfm::Byte* begin, const mfm::Byte* end)
+{
+	size_t const chunkSize_B = end - begin;
+	LOG_DEBUG() << "Adding chunk of " << chunkSize_B << " B to slab frame builder.";
+
+	reserve(chunkSize_B);
+	slab_.read(chunkSize_B, begin, tail_);
+	tail_ += chunkSize_B;
+	received_ += chunkSize_B;
+
+	buildFrames();
+}
+//______________________________________________________________________
+/**
+ * Processes the frames of a chunk which the caller keeps readable, e.g. a window of a memory mapped file.
+ * Each frame is appended to the slab on its own right before it is processed, so that its bytes are still
+ * in cache when they are decoded and the slab only ever holds one frame, instead of a copy of the whole chunk.
+ * When the chunk ends inside a frame, the bytes of that frame are kept in the slab as with addDataChunk.
+ */
+void SlabFrameBuilder::addMappedChunk(const mfm::Byte* begin, const mfm::Byte* end)
+{
+	while (begin < end)
+	{
+		// Primary header of the next frame first, then the rest of the frame
+		size_t const residual_B = tail_ - head_;
+		size_t const needed_B = (frameSize_ > 0) ? frameSize_ - residual_B : mfm::PrimaryHeader::SPEC_SIZE_B - residual_B;
+		size_t const chunkSize_B = std::min(needed_B, size_t(end - begin));
+		addDataChunk(begin, begin + chunkSize_B);
+		begin += chunkSize_B;
+	}
+}
+//______________________________________________________________________
+/**
+ * Makes room for a chunk of given size after the last byte received.
+ * The pending bytes are moved to the front of the slab when they do not overlap
+ * their destination; the slab is enlarged otherwise. It never shrinks.
+ */
+void SlabFrameBuilder::reserve(size_t const chunkSize_B)
+{
+	if (tail_ + chunkSize_B <= capacity_)
+		return;
+
+	size_t const residual_B = tail_ - head_;
+	if (head_ > 0 and residual_B <= head_ and residual_B + chunkSize_B <= capacity_)
+	{
+		LOG_DEBUG() << "Moving " << residual_B << " B of incomplete frame to front of slab.";
+		if (residual_B > 0)
+			slab_.read(residual_B, slab_.begin() + head_, 0u);
+		head_ = 0;
+		tail_ = residual_B;
+		return;
+	}
+
+	size_t newCapacity = (capacity_ > 0) ? capacity_ : chunkSize_B;
+	while (newCapacity < tail_ + chunkSize_B)
+		newCapacity *= 2;
+	LOG_DEBUG() << "Growing slab from " << capacity_ << " B to " << newCapacity << " B.";
+	slab_.setCapacity(newCapacity);
+	slab_.set_size_B(newCapacity);
+	capacity_ = newCapacity;
+}
+//______________________________________________________________________
+void SlabFrameBuilder::buildFrames()
+{
+	while (tail_ - head_ >= mfm::PrimaryHeader::SPEC_SIZE_B)
+	{
+		// Decode primary header and get frame size
+		if (frameSize_ <= 0)
+		{
+			std::auto_ptr<mfm::PrimaryHeader> headerPtr = mfm::PrimaryHeader::decodePrimaryHeader(slab_.inputStream(head_));
+			frameSize_ = headerPtr->frameSize_B();
+			if (frameSize_ < mfm::PrimaryHeader::SPEC_SIZE_B)
+				throw mfm::Exception("Invalid frame size in primary header!");
+			processHeader(*headerPtr);
+			LOG_DEBUG() << "Expecting frame of " << frameSize_ << " B.";
+		}
+
+		// Check if frame is complete
+		if (tail_ - head_ < frameSize_)
+		{
+			LOG_DEBUG() << "Still missing " << frameSize_ - (tail_ - head_) << " B out of " << frameSize_ << " B";
+			break;
+		}
+
+		// Process frame in place
+		mfm::Frame frame(mfm::Serializer(slab_, frameSize_, head_));
+		LOG_DEBUG() << "Processing frame of " << frameSize_ << " B.";
+		processFrame(frame);
+
+		head_ += frameSize_;
+		frameSize_ = 0;
+	}
+
+	// Rewind for free when everything was consumed
+	if (head_ == tail_)
+		head_ = tail_ = 0;
+}
+//______________________________________________________________________
+/**
+ * Drops pending data. The slab keeps its capacity.
+ */
+void SlabFrameBuilder::reset()
+{
+	LOG_DEBUG() << "Resetting slab frame builder.";
+	head_ = 0;
+	tail_ = 0;
+	frameSize_ = 0;
+	received_ = 0;
+}
+//______________________________________________________________________
+} /* namespace mfm */
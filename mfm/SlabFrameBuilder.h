@@ -0,0 +1,49 @@
+/*
+ * @file SlabFrameBuilder.h
+ * -----------------------------------------------------------------------------
+ */
+
+#ifndef mfm_SlabFrameBuilder_h_INCLUDED
+#define mfm_SlabFrameBuilder_h_INCLUDED
+
+#include "mfm/FrameBuilder.h"
+#include "mfm/Serializer.h"
+
+namespace mfm {
+//______________________________________________________________________
+/**
+ * A FrameBuilder variant reconstructing MFM frames in a grow-only slab buffer.
+ *
+ * Incoming chunks are appended once to the slab and complete frames are handed
+ * out as views on the slab, without being copied again. The slab is only
+ * reallocated when a chunk does not fit; the bytes of an incomplete frame are
+ * moved back to the front of the slab instead whenever possible.
+ * In steady state, reassembly therefore costs one copy per byte and no allocation.
+ * Chunks that stay readable in memory, like windows of a mapped file, can instead be
+ * handed over with addMappedChunk, which copies them one frame at a time.
+ */
+class SlabFrameBuilder : public FrameBuilder
+{
+public:
+	SlabFrameBuilder(size_t const initialCapacity_B = 1u << 20);
+	virtual ~SlabFrameBuilder();
+	virtual void addDataChunk(const mfm::Byte* begin, const mfm::Byte* end);
+	void addMappedChunk(const mfm::Byte* begin, const mfm::Byte* end);
+	virtual void reset();
+	size_t capacity_B() const { return capacity_; }
+	size_t residualSize_B() const { return tail_ - head_; }
+	/// Offset [Bytes] in the received data of the frame being processed, or of the first byte not processed yet.
+	size_t frameOffset_B() const { return received_ - (tail_ - head_); }
+private:
+	void reserve(size_t const chunkSize_B);
+	void buildFrames();
+	mfm::Serializer slab_; ///< Grow-only buffer storing chunks of frames
+	size_t capacity_; ///< Size [Bytes] allocated for the slab.
+	size_t head_; ///< Offset [Bytes] of the first byte not processed yet.
+	size_t tail_; ///< Offset [Bytes] after the last byte received.
+	size_t frameSize_; ///< Size [Bytes] of the frame being currently built.
+	size_t received_; ///< Number of bytes received since the last reset.
+};
+//______________________________________________________________________
+} /* namespace mfm */
+#endif /* mfm_SlabFrameBuilder_h_INCLUDED */
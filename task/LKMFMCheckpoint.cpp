@@ -0,0 +1,46 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+using namespace std;
+
+#include "LKMFMCheckpoint.h"
+
+bool LKMFMCheckpoint::Write(const std::string &fileName) const
+{
+    std::string const tempFileName = fileName + ".tmp";
+    {
+        ofstream file(tempFileName.c_str());
+        if (!file)
+            return false;
+        file << "input    " << inputFileName << endl;
+        file << "offset   " << inputOffset << endl;
+        file << "output   " << outputFileName << endl;
+        file << "events   " << numEvents << endl;
+        file.flush();
+        if (!file)
+            return false;
+    }
+    return rename(tempFileName.c_str(), fileName.c_str()) == 0;
+}
+
+bool LKMFMCheckpoint::Read(const std::string &fileName)
+{
+    ifstream file(fileName.c_str());
+    if (!file)
+        return false;
+
+    std::string key;
+    bool hasOffset = false;
+    while (file >> key)
+    {
+        if (key == "input") getline(file >> ws, inputFileName);
+        else if (key == "offset") { file >> inputOffset; hasOffset = true; }
+        else if (key == "output") getline(file >> ws, outputFileName);
+        else if (key == "events") file >> numEvents;
+        else {
+            cerr << "LKMFMCheckpoint: unknown entry " << key << " in " << fileName << endl;
+            return false;
+        }
+    }
+    return hasOffset && !inputFileName.empty();
+}
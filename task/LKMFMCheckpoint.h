@@ -0,0 +1,24 @@
+#ifndef LKMFMCHECKPOINT_HH
+#define LKMFMCHECKPOINT_HH
+
+#include <string>
+#include <cstdint>
+
+/*
+ * Restart point of a long conversion, written each time the output of the run is saved.
+ * The input offset is the first byte of the frame opening the first event which is not in the output yet,
+ * so a resumed conversion starts there with an empty frame builder.
+ * The file is replaced atomically (written aside, then renamed) so that a crash never leaves half a checkpoint.
+ */
+struct LKMFMCheckpoint
+{
+    std::string inputFileName;
+    uint64_t inputOffset = 0;   ///< [Bytes] where to resume reading
+    std::string outputFileName; ///< saved output holding the first numEvents events
+    int64_t numEvents = 0;      ///< events in the output when the checkpoint was written
+
+    bool Write(const std::string &fileName) const;
+    bool Read(const std::string &fileName);
+};
+
+#endif
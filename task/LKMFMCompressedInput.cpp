@@ -0,0 +1,432 @@
+#include <iostream>
+#include <fstream>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <algorithm>
+using namespace std;
+
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#ifdef LKMFM_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef LKMFM_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef LKMFM_WITH_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "LKMFMCompressedInput.h"
+#include "LKMFMMappedFile.h"
+
+extern char **environ;
+
+namespace {
+    size_t const kOutputBlockSize = 4*1024*1024; ///< decompressed bytes made per Decode() by the streaming decoders
+    size_t const kPrefetchSize = 64*1024*1024;
+    unsigned long long const kMaxFrameSize = 256*1024*1024; ///< larger zstd frames are streamed instead of decoded at once
+}
+
+/// State of the in process decompression, the compressed file is mapped and read from the front to the back
+struct LKMFMCompressedInput::Decoder
+{
+    LKMFMCompressedInput::Format format = kNone;
+    LKMFMMappedFile file;
+    size_t offset = 0; ///< next compressed byte not given to the decompressor
+    std::vector<char> output; ///< decompressed bytes of the last Decode()
+    size_t outputBegin = 0; ///< first byte of output not yet read
+    bool finished = false; ///< the last frame or member of the file was complete
+    bool failed = false;
+#ifdef LKMFM_WITH_ZLIB
+    z_stream gzip;
+    bool gzipInitialized = false;
+#endif
+#ifdef LKMFM_WITH_ZSTD
+    ZSTD_DCtx *zstd = nullptr; ///< streaming context for frames without content size
+    std::vector<ZSTD_DCtx*> zstdWorkers; ///< one-shot contexts of the threads
+    bool zstdInFrame = false; ///< a frame is being streamed
+#endif
+#ifdef LKMFM_WITH_LZ4
+    LZ4F_dctx *lz4 = nullptr;
+    size_t lz4Hint = 0; ///< 0 at a frame boundary
+#endif
+};
+
+LKMFMCompressedInput::~LKMFMCompressedInput()
+{
+    Close();
+}
+
+LKMFMCompressedInput::Format LKMFMCompressedInput::DetectFormat(const std::string &fileName)
+{
+    unsigned char magic[4] = {0, 0, 0, 0};
+    ifstream file(fileName.c_str(), std::ios::binary);
+    if (!file.read((char *) magic, sizeof(magic)))
+        return kNone;
+
+    if (magic[0] == 0x1f && magic[1] == 0x8b)
+        return kGzip;
+    if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+        return kZstd;
+    if (magic[0] == 0x04 && magic[1] == 0x22 && magic[2] == 0x4d && magic[3] == 0x18)
+        return kLZ4;
+    return kNone;
+}
+
+const char *LKMFMCompressedInput::GetFormatName(Format format)
+{
+    switch (format) {
+        case kGzip: return "gzip";
+        case kZstd: return "zstd";
+        case kLZ4:  return "lz4";
+        default:    return "none";
+    }
+}
+
+bool LKMFMCompressedInput::HasDecoder(Format format)
+{
+    switch (format) {
+#ifdef LKMFM_WITH_ZLIB
+        case kGzip: return true;
+#endif
+#ifdef LKMFM_WITH_ZSTD
+        case kZstd: return true;
+#endif
+#ifdef LKMFM_WITH_LZ4
+        case kLZ4:  return true;
+#endif
+        default:    return false;
+    }
+}
+
+bool LKMFMCompressedInput::Open(const std::string &fileName, Format format)
+{
+    Close();
+    fTotalSize = 0;
+
+    if (HasDecoder(format)) {
+        fDecoder = new Decoder();
+        fDecoder->format = format;
+        if (!fDecoder->file.Open(fileName)) {
+            Close();
+            return false;
+        }
+        fDecoder->file.Prefetch(0, kPrefetchSize);
+#ifdef LKMFM_WITH_ZLIB
+        if (format == kGzip) {
+            memset(&fDecoder->gzip, 0, sizeof(z_stream));
+            // 16 + MAX_WBITS: gzip header and trailer
+            fDecoder->gzipInitialized = inflateInit2(&fDecoder->gzip, 16 + MAX_WBITS) == Z_OK;
+            fDecoder->failed = !fDecoder->gzipInitialized;
+        }
+#endif
+#ifdef LKMFM_WITH_ZSTD
+        if (format == kZstd) {
+            int numThreads = fNumThreads;
+            if (numThreads <= 0)
+                numThreads = std::max(1u, std::thread::hardware_concurrency());
+            fDecoder->zstd = ZSTD_createDCtx();
+            for (int i=0; i<numThreads; ++i)
+                fDecoder->zstdWorkers.push_back(ZSTD_createDCtx());
+        }
+#endif
+#ifdef LKMFM_WITH_LZ4
+        if (format == kLZ4)
+            fDecoder->failed = LZ4F_isError(LZ4F_createDecompressionContext(&fDecoder->lz4, LZ4F_VERSION));
+#endif
+        if (fDecoder->failed) {
+            cerr << "LKMFMCompressedInput: could not start the " << GetFormatName(format) << " decompression of " << fileName << endl;
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    // pigz decompresses gzip faster than gzip itself, by reading and checking on separate threads
+    bool spawned = false;
+    switch (format) {
+        case kGzip: spawned = Spawn("pigz", fileName) || Spawn("gzip", fileName); break;
+        case kZstd: spawned = Spawn("zstd", fileName); break;
+        case kLZ4:  spawned = Spawn("lz4", fileName); break;
+        default:    return false;
+    }
+    if (!spawned)
+        cerr << "LKMFMCompressedInput: no " << GetFormatName(format) << " decompressor found for " << fileName << endl;
+    return spawned;
+}
+
+/// Runs "tool -dc fileName" with its standard output connected to fPipeDescriptor
+bool LKMFMCompressedInput::Spawn(const char *tool, const std::string &fileName)
+{
+    int pipeDescriptors[2];
+    if (pipe(pipeDescriptors) != 0)
+        return false;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipeDescriptors[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, pipeDescriptors[0]);
+    posix_spawn_file_actions_addclose(&actions, pipeDescriptors[1]);
+
+    char *const argv[] = {(char *) tool, (char *) "-dc", (char *) fileName.c_str(), nullptr};
+    int const status = posix_spawnp(&fChild, tool, &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipeDescriptors[1]);
+
+    if (status != 0) {
+        close(pipeDescriptors[0]);
+        fChild = -1;
+        return false;
+    }
+    fPipeDescriptor = pipeDescriptors[0];
+    return true;
+}
+
+size_t LKMFMCompressedInput::Read(char *buffer, size_t size)
+{
+    size_t numRead = 0;
+    if (fDecoder != nullptr) {
+        auto &decoder = *fDecoder;
+        while (numRead < size)
+        {
+            if (decoder.outputBegin < decoder.output.size()) {
+                size_t const n = std::min(size - numRead, decoder.output.size() - decoder.outputBegin);
+                memcpy(buffer + numRead, decoder.output.data() + decoder.outputBegin, n);
+                decoder.outputBegin += n;
+                numRead += n;
+            }
+            else if (!Decode())
+                break;
+        }
+    }
+    while (fPipeDescriptor >= 0 && numRead < size)
+    {
+        ssize_t const n = read(fPipeDescriptor, buffer + numRead, size - numRead);
+        if (n > 0)
+            numRead += n;
+        else if (n == 0 || errno != EINTR)
+            break;
+    }
+    fTotalSize += numRead;
+    return numRead;
+}
+
+/// Replaces the output of the decoder by the next decompressed bytes. Returns false at the end of the file or after an error.
+bool LKMFMCompressedInput::Decode()
+{
+    auto &decoder = *fDecoder;
+    decoder.output.clear();
+    decoder.outputBegin = 0;
+    if (decoder.failed || decoder.offset >= decoder.file.GetSize())
+        return false;
+
+    // Compressed pages behind the decompressor are not read again
+    decoder.file.Prefetch(decoder.offset, kPrefetchSize);
+    decoder.file.Release(decoder.offset);
+
+    bool decoded = false;
+    switch (decoder.format) {
+        case kGzip: decoded = DecodeGzip(); break;
+        case kZstd: decoded = DecodeZstd(); break;
+        case kLZ4:  decoded = DecodeLZ4(); break;
+        default:    break;
+    }
+    if (!decoded && !decoder.finished)
+        decoder.failed = true;
+    return decoded;
+}
+
+/// Inflates the next block, concatenated gzip members included
+bool LKMFMCompressedInput::DecodeGzip()
+{
+#ifdef LKMFM_WITH_ZLIB
+    auto &decoder = *fDecoder;
+    auto &stream = decoder.gzip;
+    size_t const fileSize = decoder.file.GetSize();
+    decoder.output.resize(kOutputBlockSize);
+    stream.next_out = (Bytef *) decoder.output.data();
+    stream.avail_out = kOutputBlockSize;
+    decoder.finished = false;
+    while (stream.avail_out > 0 && decoder.offset < fileSize) {
+        // avail_in is 32 bit, the input is given in pieces of at most 1 GB
+        stream.next_in = (Bytef *) decoder.file.GetData() + decoder.offset;
+        stream.avail_in = std::min(fileSize - decoder.offset, size_t(1) << 30);
+        int const status = inflate(&stream, Z_NO_FLUSH);
+        decoder.offset = (const char *) stream.next_in - decoder.file.GetData();
+        if (status == Z_STREAM_END) {
+            decoder.finished = true;
+            if (decoder.offset < fileSize)
+                inflateReset(&stream);
+        }
+        else if (status == Z_OK)
+            decoder.finished = false;
+        else {
+            cerr << "LKMFMCompressedInput: gzip error " << status << " at compressed byte " << decoder.offset << endl;
+            decoder.failed = true;
+            break;
+        }
+    }
+    decoder.output.resize(kOutputBlockSize - stream.avail_out);
+    return !decoder.output.empty();
+#else
+    return false;
+#endif
+}
+
+/**
+ * Frames with a known content size are decompressed at once, up to one frame per thread in parallel.
+ * Frames without content size (zstd -c of a pipe) or larger than kMaxFrameSize are streamed block by block.
+ */
+bool LKMFMCompressedInput::DecodeZstd()
+{
+#ifdef LKMFM_WITH_ZSTD
+    auto &decoder = *fDecoder;
+    const char *data = decoder.file.GetData();
+    size_t const fileSize = decoder.file.GetSize();
+
+    if (!decoder.zstdInFrame) {
+        struct Frame { size_t offset, compressedSize, outputOffset, contentSize; };
+        vector<Frame> frames;
+        size_t offset = decoder.offset;
+        size_t outputSize = 0;
+        while (frames.size() < decoder.zstdWorkers.size() && offset < fileSize) {
+            size_t const compressedSize = ZSTD_findFrameCompressedSize(data + offset, fileSize - offset);
+            // A truncated or corrupted frame is streamed, which gives its bytes up to the error
+            if (ZSTD_isError(compressedSize))
+                break;
+            unsigned long long const contentSize = ZSTD_getFrameContentSize(data + offset, compressedSize);
+            if (contentSize == ZSTD_CONTENTSIZE_UNKNOWN || contentSize == ZSTD_CONTENTSIZE_ERROR || contentSize > kMaxFrameSize)
+                break;
+            frames.push_back({offset, compressedSize, outputSize, size_t(contentSize)});
+            outputSize += contentSize;
+            offset += compressedSize;
+        }
+
+        if (!frames.empty()) {
+            decoder.output.resize(outputSize);
+            vector<size_t> results(frames.size());
+            auto decompress = [&](size_t i) {
+                auto &frame = frames[i];
+                results[i] = ZSTD_decompressDCtx(decoder.zstdWorkers[i], decoder.output.data() + frame.outputOffset, frame.contentSize,
+                        data + frame.offset, frame.compressedSize);
+            };
+            vector<std::thread> threads;
+            for (size_t i=1; i<frames.size(); ++i)
+                threads.emplace_back(decompress, i);
+            decompress(0);
+            for (auto &thread : threads)
+                thread.join();
+            for (size_t i=0; i<frames.size(); ++i) {
+                if (ZSTD_isError(results[i]) || results[i] != frames[i].contentSize) {
+                    cerr << "LKMFMCompressedInput: zstd frame at compressed byte " << frames[i].offset << " is corrupted" << endl;
+                    decoder.failed = true;
+                    return false;
+                }
+            }
+            decoder.offset = offset;
+            decoder.finished = true;
+            // An empty (e.g. skippable) frame gives no bytes, Read() asks for the next ones
+            return true;
+        }
+
+        ZSTD_DCtx_reset(decoder.zstd, ZSTD_reset_session_only);
+        decoder.zstdInFrame = true;
+        decoder.finished = false;
+    }
+
+    decoder.output.resize(kOutputBlockSize);
+    ZSTD_outBuffer output = {decoder.output.data(), kOutputBlockSize, 0};
+    ZSTD_inBuffer input = {data + decoder.offset, fileSize - decoder.offset, 0};
+    while (output.pos < output.size) {
+        size_t const hint = ZSTD_decompressStream(decoder.zstd, &output, &input);
+        if (ZSTD_isError(hint)) {
+            cerr << "LKMFMCompressedInput: " << ZSTD_getErrorName(hint) << " at compressed byte " << decoder.offset + input.pos << endl;
+            decoder.failed = true;
+            break;
+        }
+        if (hint == 0) {
+            decoder.zstdInFrame = false;
+            decoder.finished = true;
+            break;
+        }
+        if (input.pos == input.size && output.pos < output.size)
+            break; // truncated frame
+    }
+    decoder.offset += input.pos;
+    decoder.output.resize(output.pos);
+    return !decoder.failed && (!decoder.output.empty() || !decoder.zstdInFrame);
+#else
+    return false;
+#endif
+}
+
+/// Decompresses the next block, concatenated lz4 frames included
+bool LKMFMCompressedInput::DecodeLZ4()
+{
+#ifdef LKMFM_WITH_LZ4
+    auto &decoder = *fDecoder;
+    size_t const fileSize = decoder.file.GetSize();
+    decoder.output.resize(kOutputBlockSize);
+    size_t outputSize = 0;
+    while (outputSize < kOutputBlockSize && decoder.offset < fileSize) {
+        size_t dstSize = kOutputBlockSize - outputSize;
+        size_t srcSize = fileSize - decoder.offset;
+        size_t const hint = LZ4F_decompress(decoder.lz4, decoder.output.data() + outputSize, &dstSize,
+                decoder.file.GetData() + decoder.offset, &srcSize, nullptr);
+        if (LZ4F_isError(hint)) {
+            cerr << "LKMFMCompressedInput: " << LZ4F_getErrorName(hint) << " at compressed byte " << decoder.offset << endl;
+            decoder.failed = true;
+            break;
+        }
+        decoder.offset += srcSize;
+        outputSize += dstSize;
+        decoder.lz4Hint = hint;
+        if (srcSize == 0 && dstSize == 0)
+            break;
+    }
+    decoder.finished = decoder.lz4Hint == 0;
+    decoder.output.resize(outputSize);
+    return !decoder.output.empty();
+#else
+    return false;
+#endif
+}
+
+bool LKMFMCompressedInput::Close()
+{
+    if (fDecoder != nullptr) {
+        bool const success = !fDecoder->failed && fDecoder->finished && fDecoder->offset >= fDecoder->file.GetSize();
+#ifdef LKMFM_WITH_ZLIB
+        if (fDecoder->gzipInitialized)
+            inflateEnd(&fDecoder->gzip);
+#endif
+#ifdef LKMFM_WITH_ZSTD
+        ZSTD_freeDCtx(fDecoder->zstd);
+        for (auto context : fDecoder->zstdWorkers)
+            ZSTD_freeDCtx(context);
+#endif
+#ifdef LKMFM_WITH_LZ4
+        if (fDecoder->lz4 != nullptr)
+            LZ4F_freeDecompressionContext(fDecoder->lz4);
+#endif
+        delete fDecoder;
+        fDecoder = nullptr;
+        return success;
+    }
+
+    if (fPipeDescriptor >= 0)
+        close(fPipeDescriptor);
+    fPipeDescriptor = -1;
+    if (fChild <= 0)
+        return true;
+
+    int status = 0;
+    waitpid(fChild, &status, 0);
+    fChild = -1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
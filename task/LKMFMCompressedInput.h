@@ -0,0 +1,60 @@
+#ifndef LKMFMCOMPRESSEDINPUT_HH
+#define LKMFMCOMPRESSEDINPUT_HH
+
+#include <string>
+#include <cstddef>
+#include <sys/types.h>
+
+/*
+ * Compressed MFM run read as a stream of decompressed bytes.
+ * The format is recognized from the magic number of the file (gzip, zstd or lz4 frame format).
+ * When the build found the library of the format (zlib, libzstd, liblz4, see CMakeLists.txt) the mapped file is
+ * decompressed in process, on the thread calling Read(). The frames of a multi-frame zstd file (pzstd, zstd --long
+ * with several frames, concatenated archives) whose content size is known are decompressed on several threads.
+ * Otherwise the matching command line tool (pigz or gzip, zstd, lz4) runs as a child process, without a copy on disk.
+ * Read() returns the decompressed bytes in order, as read() would for the uncompressed file.
+ */
+class LKMFMCompressedInput
+{
+    public:
+        enum Format { kNone, kGzip, kZstd, kLZ4 };
+
+        LKMFMCompressedInput() {}
+        virtual ~LKMFMCompressedInput();
+
+        /// Format of the file from its first 4 Bytes, kNone for an uncompressed (or unreadable) file
+        static Format DetectFormat(const std::string &fileName);
+        static const char *GetFormatName(Format format);
+        /// True if the format is decompressed in process, false if the command line tool is needed
+        static bool HasDecoder(Format format);
+
+        /// Threads decompressing the frames of a multi-frame zstd file, 0 for the number of cores
+        void SetNumThreads(int numThreads) { fNumThreads = numThreads; }
+
+        bool Open(const std::string &fileName, Format format);
+        /// Returns false if the decompression did not finish successfully
+        bool Close();
+        bool IsOpen() const { return fPipeDescriptor >= 0 || fDecoder != nullptr; }
+
+        /// Fills buffer with up to size decompressed bytes. Returns 0 at the end of the data.
+        size_t Read(char *buffer, size_t size);
+        size_t GetTotalSize() const { return fTotalSize; }
+
+    private:
+        struct Decoder;
+
+        bool Spawn(const char *tool, const std::string &fileName);
+        bool Decode();
+        bool DecodeGzip();
+        bool DecodeZstd();
+        bool DecodeLZ4();
+
+    private:
+        int fPipeDescriptor = -1;
+        pid_t fChild = -1;
+        Decoder *fDecoder = nullptr; ///< in process decompression
+        int fNumThreads = 0;
+        size_t fTotalSize = 0; ///< decompressed bytes read so far
+};
+
+#endif
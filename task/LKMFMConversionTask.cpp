@@ -1,7 +1,26 @@
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include <cstdio>
+#include <unistd.h>
+#include <cstdint>
 using namespace std;
 
+#include "TROOT.h"
+#include "TSystem.h"
+
 #include "LKMFMConversionTask.h"
+#include "LKMFMFrameSplitter.h"
+#include "mfm/Frame.h"
+#include "LKSPSCQueue.h"
+#include "LKMFMFrameIndex.h"
+#include "LKMFMShard.h"
+#include "LKMFMRunSummary.h"
+#include "LKMFMCheckpoint.h"
+#include "LKParallelReplay.h"
+#include "LKCoBoFrameDecoder.h"
 #include "MMChannel.h"
 
 #include "GSpectra.h"
@@ -36,22 +55,159 @@ bool LKMFMConversionTask::Init()
     //SkipEvents       = fPar -> GetParInt("SkipEvents");
     //firstEventNo     = fPar -> GetParInt("firstEventNo");
     //IgnoreMM         = fPar -> GetParBool("IgnoreMicromegas");
+    if (fPar -> CheckPar("IgnoreMicromegas")) fIgnoreMM = fPar -> GetParBool("IgnoreMicromegas");
+    if (fIgnoreMM)
+        fDropFrames.push_back("0:*:*"); // Micromegas is read by CoBo 0
     //mfmfilename      = fPar -> GetParString("MFMFileName");
     //watcherIP        = fPar -> GetParString("watcherIP");
     //mapChanToMM      = fPar -> GetParString("ChanToMMMapFileName");
     //mapChanToSi      = fPar -> GetParString("ChanToSiMapFileName");
     //rwfilename       = fPar -> GetParString("ResponseWaveformFileName");
     //supdatefast      = fPar -> GetParString("UpdateFast");
+    if (fPar -> CheckPar("MFMFileName"))       infname         = fPar -> GetParString("MFMFileName").Data();
+    if (fPar -> CheckPar("MFMMMapEnable"))     fUseMMap        = fPar -> GetParBool("MFMMMapEnable");
+    if (fPar -> CheckPar("MFMMMapWindowSize")) fMMapWindowSize = fPar -> GetParInt("MFMMMapWindowSize");
+    if (fPar -> CheckPar("MFMPipelineEnable"))    fUsePipeline       = fPar -> GetParBool("MFMPipelineEnable");
+    if (fPar -> CheckPar("MFMPipelineDepth"))     fPipelineDepth     = fPar -> GetParInt("MFMPipelineDepth");
+    if (fPar -> CheckPar("MFMPipelineChunkSize")) fPipelineChunkSize = fPar -> GetParInt("MFMPipelineChunkSize");
+    if (fPar -> CheckPar("MFMShards"))         fNumShards      = fPar -> GetParInt("MFMShards");
+    if (fPar -> CheckPar("MFMShardDirectory")) fShardDirectory = fPar -> GetParString("MFMShardDirectory").Data();
+    if (fPar -> CheckPar("MFMFrameIndexFile"))  fFrameIndexFileName = fPar -> GetParString("MFMFrameIndexFile").Data();
+    if (fPar -> CheckPar("MFMFrameIndexWrite")) fWriteFrameIndex    = fPar -> GetParBool("MFMFrameIndexWrite");
+    if (fPar -> CheckPar("MFMFirstEvent"))      fFirstEvent         = fPar -> GetParInt("MFMFirstEvent");
+    if (fPar -> CheckPar("MFMLastEvent"))       fLastEvent          = fPar -> GetParInt("MFMLastEvent");
+    if (fPar -> CheckPar("MFMRunSummary"))      fRunSummaryOnly     = fPar -> GetParBool("MFMRunSummary");
+    if (fPar -> CheckPar("MFMRunSummaryFile"))  fRunSummaryFileName = fPar -> GetParString("MFMRunSummaryFile").Data();
+    if (fPar -> CheckPar("MFMCheckpoint"))         fWriteCheckpoint    = fPar -> GetParBool("MFMCheckpoint");
+    if (fPar -> CheckPar("MFMCheckpointInterval")) fCheckpointInterval = fPar -> GetParInt("MFMCheckpointInterval");
+    if (fPar -> CheckPar("MFMCheckpointFile"))     fCheckpointFileName = fPar -> GetParString("MFMCheckpointFile").Data();
+    if (fPar -> CheckPar("MFMResume"))             fResume             = fPar -> GetParBool("MFMResume");
+    if (fPar -> CheckPar("MFMFollow"))             fFollow             = fPar -> GetParBool("MFMFollow");
+    if (fPar -> CheckPar("MFMFollowPollInterval")) fFollowPollInterval = fPar -> GetParInt("MFMFollowPollInterval");
+    if (fPar -> CheckPar("MFMFollowIdleTimeout"))  fFollowIdleTimeout  = fPar -> GetParInt("MFMFollowIdleTimeout");
+    if (fPar -> CheckPar("MFMReplayFile"))         fReplayFileName     = fPar -> GetParString("MFMReplayFile").Data();
+    if (fPar -> CheckPar("MFMReplayTree"))         fReplayTreeName     = fPar -> GetParString("MFMReplayTree").Data();
+    if (fPar -> CheckPar("MFMReplayThreads"))      fReplayThreads      = fPar -> GetParInt("MFMReplayThreads");
+    if (fPar -> CheckPar("MFMReplayHistFile"))     fReplayHistFileName = fPar -> GetParString("MFMReplayHistFile").Data();
+    if (fPar -> CheckPar("MFMDropFrames"))
+        for (int i=0; i<fPar -> GetParN("MFMDropFrames"); ++i)
+            fDropFrames.push_back(fPar -> GetParString("MFMDropFrames",i).Data());
+    if (fPar -> CheckPar("MFMDivertFrames"))
+        for (int i=0; i<fPar -> GetParN("MFMDivertFrames"); ++i)
+            fDivertFrames.push_back(fPar -> GetParString("MFMDivertFrames",i).Data());
+    if (fPar -> CheckPar("MFMHitPatternFilter"))
+        for (int i=0; i<fPar -> GetParN("MFMHitPatternFilter"); ++i)
+            fHitPatternRules.push_back(fPar -> GetParString("MFMHitPatternFilter",i).Data());
+    if (fPar -> CheckPar("MFMDivertFile"))      fDivertFileName     = fPar -> GetParString("MFMDivertFile").Data();
+    if (fPar -> CheckPar("MFMEventWindow"))     fEventWindow        = fPar -> GetParInt("MFMEventWindow");
+    if (fPar -> CheckPar("MFMEventTimeout"))    fEventTimeout       = fPar -> GetParDouble("MFMEventTimeout");
+    if (fPar -> CheckPar("MFMEventCoBoAsAds"))
+        for (int i=0; i<fPar -> GetParN("MFMEventCoBoAsAds"); ++i)
+            fEventCoBoAsAds.push_back(fPar -> GetParString("MFMEventCoBoAsAds",i).Data());
+    if (fPar -> CheckPar("BaselineMethod"))     fBaselineMethod     = fPar -> GetParInt("BaselineMethod");
+    if (fPar -> CheckPar("DeconvolutionMethod"))         fDeconvolutionMethod         = fPar -> GetParInt("DeconvolutionMethod");
+    if (fPar -> CheckPar("DeconvolutionRegularization")) fDeconvolutionRegularization = fPar -> GetParDouble("DeconvolutionRegularization");
+    if (fPar -> CheckPar("EnergyFitSkipSaturated"))      fFitSkipSaturated            = fPar -> GetParBool("EnergyFitSkipSaturated");
+    if (fFrameIndexFileName.empty())
+        fFrameIndexFileName = infname + ".idx";
+    if (fRunSummaryFileName.empty())
+        fRunSummaryFileName = infname + ".summary.txt";
+    if (fCheckpointFileName.empty())
+        fCheckpointFileName = infname + ".ckpt";
+    if (fDivertFileName.empty())
+        fDivertFileName = infname + ".diverted.dat";
+
+    if (!fReplayFileName.empty())
+        return InitReplay();
+
+    lk_info << "CoBo frame items are decoded with " << LKCoBoFrameDecoder::GetInstructionSet() << " instructions" << endl;
+
+    if (!fDivertFrames.empty() && !fRunSummaryOnly) {
+        fDivertFile.open(fDivertFileName.c_str(), std::ios::binary);
+        if (!fDivertFile) {
+            lk_error << "Could not open " << fDivertFileName << " for the diverted frames" << endl;
+            return false;
+        }
+        lk_info << "Frames matching MFMDivertFrames are written to " << fDivertFileName << endl;
+    }
+
+    // Compressed runs can only be read once from the beginning to the end
+    if (fReadtype != kReadList)
+        fCompressedFormat = LKMFMCompressedInput::DetectFormat(infname);
+    if (fCompressedFormat != LKMFMCompressedInput::kNone) {
+        if (fRunSummaryOnly || fFollow || fNumShards > 1 || fFirstEvent >= 0 || fLastEvent >= 0) {
+            lk_error << infname << " is " << LKMFMCompressedInput::GetFormatName(fCompressedFormat)
+                << " compressed: run summary, follow mode, shards and event ranges need the uncompressed file" << endl;
+            return false;
+        }
+        if (fWriteCheckpoint || fResume) {
+            lk_warning << "Checkpoints are not available for compressed input" << endl;
+            fWriteCheckpoint = fResume = false;
+        }
+    }
+
+    // Frames waiting in the reorder buffer are before the restart point of the frame builder
+    if (fEventWindow > 0 && (fWriteCheckpoint || fResume)) {
+        lk_warning << "Checkpoints are not available with MFMEventWindow" << endl;
+        fWriteCheckpoint = fResume = false;
+    }
+
+    if (fRunSummaryOnly) {
+        if (!fMappedFile.Open(infname)) {
+            lk_error << "Could not map input file!" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // An event range is read by seeking in the mapped file
+    if (fFirstEvent >= 0 || fLastEvent >= 0)
+        fUseMMap = true;
 
-    fFrameBuilder = new LKFrameBuilder(fConverterPort);
-    fFrameBuilder -> SetBucketSize(fBucketSize);
-    fFrameBuilder -> Init(fMode,fD2pMode);
-    fFrameBuilder -> SetReadMode(fMode);
-    fFrameBuilder -> SetReadType(fReadtype);
-    fFrameBuilder -> SetScaler(fScalerMode);
-    fFrameBuilder -> Set2pMode(fD2pMode);
-    fFrameBuilder -> SetUpdateSpeed(fUpdatefast);
-    fFrameBuilder -> SetChannelArray(fChannelArray);
+    if (fFollow)
+        return InitFollow();
+
+    // Shards are converted by frame builders of their own, without histogram server
+    if (fReadtype == kReadList)
+        return InitSegments();
+    if (fNumShards > 1)
+        return InitShards();
+
+    InitEventQueue();
+
+    if (fCompressedFormat != LKMFMCompressedInput::kNone) {
+        if (!fCompressedInput.Open(infname, fCompressedFormat))
+            return false;
+        lk_info << "Decompressing " << LKMFMCompressedInput::GetFormatName(fCompressedFormat) << " input through the pipeline"
+            << (LKMFMCompressedInput::HasDecoder(fCompressedFormat) ? "" : " by the command line tool") << endl;
+        fUseMMap = false;
+        fUsePipeline = true;
+        return true;
+    }
+
+    if (fUseMMap) {
+        lk_info << "Mapping input file to memory." << endl;
+        if (!fMappedFile.Open(infname)) {
+            lk_error << "Could not map input file!" << std::endl;
+            return false;
+        }
+        lk_info << "Mapped " << fMappedFile.GetSize() << " bytes, window size is " << fMMapWindowSize << endl;
+        fInputBegin = 0;
+        fInputEnd = fMappedFile.GetSize();
+        if (fFirstEvent >= 0 || fLastEvent >= 0) {
+            LKMFMFrameIndex frameIndex;
+            size_t beginFrame, endFrame;
+            if (!LoadFrameIndex(frameIndex) || !SelectEventRange(frameIndex, beginFrame, endFrame))
+                return false;
+            fInputBegin = frameIndex.GetEntry(beginFrame).offset;
+            fInputEnd = frameIndex.GetEntry(endFrame-1).offset + frameIndex.GetEntry(endFrame-1).size;
+        }
+        if (!InitCheckpoint())
+            return false;
+        fInputOffset = fInputBegin;
+        fMappedFile.Prefetch(fInputOffset, fMMapWindowSize);
+        return true;
+    }
 
     fBuffer = (char *) malloc (matrixSize);
     lk_info << "Opening file stream." << endl;
@@ -62,49 +218,960 @@ bool LKMFMConversionTask::Init()
     }
     lk_info << "Reading block size is " << matrixSize << endl;
 
+    return InitCheckpoint();
+}
+
+/**
+ * MFMResume: continues from the checkpoint of an interrupted conversion of the same file.
+ * The events saved in the output of the interrupted conversion are handed to the run first,
+ * so the new output holds the whole conversion.
+ * MFMCheckpoint: saves the output of the run and writes a checkpoint every fCheckpointInterval events.
+ * Checkpoints need the frame builder to receive the input itself, i.e. the stream or memory mapped reader.
+ */
+bool LKMFMConversionTask::InitCheckpoint()
+{
+    if ((fWriteCheckpoint || fResume) && fUsePipeline) {
+        lk_warning << "Checkpoints are not available with MFMPipelineEnable, the pipeline is not used" << endl;
+        fUsePipeline = false;
+    }
+    if ((fWriteCheckpoint || fResume) && fRun -> GetOutputTree() == nullptr) {
+        lk_error << "Checkpoints need the output tree of the run" << endl;
+        return false;
+    }
+
+    if (fResume) {
+        LKMFMCheckpoint checkpoint;
+        if (!checkpoint.Read(fCheckpointFileName)) {
+            lk_error << "Could not read checkpoint " << fCheckpointFileName << endl;
+            return false;
+        }
+        if (checkpoint.inputFileName != infname) {
+            lk_error << "Checkpoint " << fCheckpointFileName << " was written for " << checkpoint.inputFileName << endl;
+            return false;
+        }
+        if (fUseMMap) {
+            if (checkpoint.inputOffset >= fInputEnd) {
+                lk_error << "Checkpoint offset " << checkpoint.inputOffset << " is after the end of the input" << endl;
+                return false;
+            }
+            fInputBegin = std::max<size_t>(fInputBegin, checkpoint.inputOffset);
+            fInputBase = fInputBegin;
+        }
+        else {
+            fFileStream.seekg(checkpoint.inputOffset);
+            fInputBase = checkpoint.inputOffset;
+        }
+
+        if (checkpoint.numEvents > 0) {
+            // A crashed output is recovered by ROOT up to its last save, i.e. at least up to the checkpoint
+            fResumeFile = new TFile(checkpoint.outputFileName.c_str(), "read");
+            if (!fResumeFile -> IsZombie())
+                fResumeTree = (TTree *) fResumeFile -> Get(fRun -> GetOutputTree() -> GetName());
+            if (fResumeTree == nullptr || fResumeTree -> GetEntries() < checkpoint.numEvents) {
+                lk_error << "Output " << checkpoint.outputFileName << " of the interrupted conversion does not hold the "
+                    << checkpoint.numEvents << " events of checkpoint " << fCheckpointFileName << endl;
+                return false;
+            }
+            fResumeArray = new TClonesArray("MMChannel", 1000);
+            fResumeTree -> SetBranchAddress("RawData", &fResumeArray);
+            fNumResumeEvents = fCheckpointEvents = checkpoint.numEvents;
+        }
+        lk_info << "Resuming at byte " << checkpoint.inputOffset << " after the " << checkpoint.numEvents
+            << " events of " << checkpoint.outputFileName << endl;
+    }
+    else if (fUseMMap)
+        fInputBase = fInputBegin;
+
+    if (fWriteCheckpoint)
+        lk_info << "Writing checkpoints to " << fCheckpointFileName << " every " << fCheckpointInterval << " events" << endl;
     return true;
 }
 
+/**
+ * Saves the output of the run with the events handed to it so far (all of them filled by now),
+ * then records where the conversion restarts after them.
+ * The output is hard linked next to the checkpoint: when a run is resumed, LKRun recreates its output
+ * file by removing the old one, which takes away the file name but not the linked data.
+ */
+void LKMFMConversionTask::WriteCheckpoint()
+{
+    TTree *outputTree = fRun -> GetOutputTree();
+    if (fCheckpointOutputName.empty()) {
+        string const outputName = outputTree -> GetCurrentFile() -> GetName();
+        string const linkName = fCheckpointFileName + ".root";
+        string const tempName = linkName + ".tmp";
+        remove(tempName.c_str());
+        if (link(outputName.c_str(), tempName.c_str()) == 0 && rename(tempName.c_str(), linkName.c_str()) == 0)
+            fCheckpointOutputName = linkName;
+        else {
+            lk_warning << "Could not link " << outputName << " to " << linkName
+                << ", a resumed conversion must write to another output file" << endl;
+            fCheckpointOutputName = outputName;
+        }
+    }
+
+    outputTree -> AutoSave("SaveSelf FlushBaskets");
+
+    LKMFMCheckpoint checkpoint;
+    checkpoint.inputFileName = infname;
+    checkpoint.inputOffset = fLastRestart;
+    checkpoint.outputFileName = fCheckpointOutputName;
+    checkpoint.numEvents = outputTree -> GetEntries();
+    if (checkpoint.numEvents != fNumEventsHanded)
+        lk_warning << "Output has " << checkpoint.numEvents << " events, " << fNumEventsHanded << " were converted" << endl;
+    if (!checkpoint.Write(fCheckpointFileName))
+        lk_warning << "Could not write checkpoint " << fCheckpointFileName << endl;
+    fCheckpointEvents = fNumEventsHanded;
+}
+
+/// The checkpoint of a conversion which reached the end of its input is not needed anymore
+void LKMFMConversionTask::FinishCheckpoint()
+{
+    if (!fWriteCheckpoint && !fResume)
+        return;
+    remove(fCheckpointFileName.c_str());
+    remove((fCheckpointFileName + ".root").c_str());
+}
+
+/// Fills the channel array with the next saved event of the interrupted conversion
+void LKMFMConversionTask::NextResumedEvent()
+{
+    fResumeTree -> GetEntry(fNumEventsHanded);
+    for (int i=0; i<fResumeArray -> GetEntriesFast(); ++i)
+        *(MMChannel *) fChannelArray -> ConstructedAt(i) = *(MMChannel *) fResumeArray -> At(i);
+    if (++fNumEventsHanded == fNumResumeEvents) {
+        lk_info << fNumResumeEvents << " events copied from the interrupted conversion" << endl;
+        fResumeFile -> Close();
+        delete fResumeFile;
+        fResumeFile = nullptr;
+        fResumeTree = nullptr;
+    }
+}
+
+LKFrameBuilder* LKMFMConversionTask::NewFrameBuilder(int port, TClonesArray *channelArray)
+{
+    auto builder = new LKFrameBuilder(port);
+    builder -> SetBucketSize(fBucketSize);
+    builder -> Init(fMode,fD2pMode);
+    builder -> SetReadMode(fMode);
+    builder -> SetReadType(fReadtype);
+    builder -> SetScaler(fScalerMode);
+    builder -> Set2pMode(fD2pMode);
+    builder -> SetUpdateSpeed(fUpdatefast);
+    builder -> SetChannelArray(channelArray);
+    builder -> SetIgnoreMM(fIgnoreMM ? 1 : 0);
+    builder -> SetBaselineMethod(fBaselineMethod);
+    builder -> SetDeconvolutionMethod(fDeconvolutionMethod);
+    builder -> SetFitSkipSaturated(fFitSkipSaturated);
+    if (fDeconvolutionRegularization > 0)
+        builder -> SetDeconvolutionRegularization(fDeconvolutionRegularization);
+
+    for (auto &pattern : fDropFrames)
+        if (!builder -> GetFrameRouter().AddRule(pattern, LKCoBoFrameRouter::kDrop))
+            lk_error << "Bad frame pattern " << pattern << ", expected cobo:asad:frameType" << endl;
+    for (auto &pattern : fDivertFrames)
+        if (!builder -> GetFrameRouter().AddRule(pattern, LKCoBoFrameRouter::kDivert))
+            lk_error << "Bad frame pattern " << pattern << ", expected cobo:asad:frameType" << endl;
+    for (auto &rule : fHitPatternRules)
+        if (!builder -> GetHitPatternFilter().AddRule(rule))
+            lk_error << "Bad hit pattern rule " << rule << ", expected cobo:asad:aget:mask with a 72 bit hexadecimal mask" << endl;
+    if (fEventWindow > 0) {
+        builder -> GetEventBuffer().SetWindow(fEventWindow);
+        builder -> GetEventBuffer().SetTimeout(fEventTimeout);
+        for (auto &pattern : fEventCoBoAsAds)
+            if (!builder -> GetEventBuffer().AddExpected(pattern))
+                lk_error << "Bad CoBo/AsAd pattern " << pattern << ", expected cobo:asad" << endl;
+    }
+    if (!fDivertFrames.empty()) {
+        // Each diverted frame (also a sub frame of a layered frame) is a complete MFM frame of its own
+        builder -> SetDivertCallback([this](mfm::Frame &frame) {
+            std::lock_guard<std::mutex> lock(fDivertMutex);
+            fDivertFile.write((const char *) frame.data(), frame.header().frameSize_B());
+        });
+    }
+    return builder;
+}
+
+/**
+ * The frame builder fills its own channel array. Every complete event is copied aside,
+ * so that one event can be handed to the run per Exec even when a part of the input completes several.
+ */
+void LKMFMConversionTask::InitEventQueue()
+{
+    fBuilderArray = new TClonesArray("MMChannel", 1000);
+    fFrameBuilder = NewFrameBuilder(fConverterPort, fBuilderArray);
+    fFrameBuilder -> SetEventCallback([this](Int_t) {
+        TClonesArray *event;
+        if (fFreeEvents.empty())
+            event = new TClonesArray("MMChannel", 1000);
+        else {
+            event = fFreeEvents.back();
+            fFreeEvents.pop_back();
+        }
+        for (int i=0; i<fBuilderArray -> GetEntriesFast(); ++i)
+            *(MMChannel *) event -> ConstructedAt(i) = *(MMChannel *) fBuilderArray -> At(i);
+        fEvents.push_back(event);
+        size_t offset;
+        fEventRestarts.push_back(fFrameBuilder -> GetRestartOffset(offset) ? Long64_t(fInputBase + offset) : -1);
+    });
+}
+
+/// Fills the channel array with the oldest queued event
+void LKMFMConversionTask::NextEvent()
+{
+    TClonesArray *event = fEvents.front();
+    fEvents.pop_front();
+    for (int i=0; i<event -> GetEntriesFast(); ++i)
+        *(MMChannel *) fChannelArray -> ConstructedAt(i) = *(MMChannel *) event -> At(i);
+    event -> Clear("C");
+    fFreeEvents.push_back(event);
+    fLastRestart = fEventRestarts.front();
+    fEventRestarts.pop_front();
+    ++fNumEventsHanded;
+}
+
 void LKMFMConversionTask::Exec(Option_t*)
 {
-    if (fFileStream.eof()) {
-        lk_warning << "end of MFM file!" << endl;
+    if (!fReplayFileName.empty()) {
+        ExecReplay();
+        return;
+    }
+
+    if (fRunSummaryOnly) {
+        ExecRunSummary();
+        return;
+    }
+
+    if (fUseShards) {
+        ExecShards();
+        return;
+    }
+
+    fChannelArray -> Clear("C");
+
+    if (fNumEventsHanded < fNumResumeEvents) {
+        NextResumedEvent();
+        return;
+    }
+
+    if (fWriteCheckpoint && fLastRestart >= 0 && fNumEventsHanded - fCheckpointEvents >= fCheckpointInterval)
+        WriteCheckpoint();
+
+    while (fEvents.empty() && !fEndOfInput)
+        fEndOfInput = !ReadInput();
+
+    if (fEvents.empty()) {
+        if (!fInputFailed)
+            FinishCheckpoint();
         fRun -> SignalEndOfRun();
         return;
     }
+    NextEvent();
+}
 
-    int filebuffer = 0;
-    while (true)
-    {
-        fFileStream.seekg(filebuffer, std::ios_base::cur);
-        fFileStream.read(fBuffer,matrixSize);
-        filebuffer += matrixSize;
+/// Gives the next part of the input to the frame builder. Returns false at the end of the input or after an error.
+bool LKMFMConversionTask::ReadInput()
+{
+    if (fFollow)
+        return ReadFollow();
+    if (fUsePipeline)
+        return ReadPipeline();
+    if (fUseMMap)
+        return ReadMappedFile();
+    return ReadStream();
+}
 
-        if(!fFileStream.eof()) {
-            try {
-                ++fCountAddDataChunk;
-                fFrameBuilder -> addDataChunk(fBuffer,fBuffer+matrixSize);
-            }catch (const std::exception& e){
-                lk_error << "Error occured from " << fCountAddDataChunk << "-th addDataChunk()" << endl;
-                e_cout << e.what() << endl;
-                fRun -> SignalEndOfRun();
-                return;
+/// Blocks are read back to back so that the frame builder sees the input bytes in order and without gaps
+bool LKMFMConversionTask::ReadStream()
+{
+    fFileStream.read(fBuffer,matrixSize);
+    size_t const size = fFileStream.gcount();
+    if (size > 0) {
+        try {
+            ++fCountAddDataChunk;
+            fFrameBuilder -> addDataChunk(fBuffer,fBuffer+size);
+        }catch (const std::exception& e){
+            lk_error << "Error occured from " << fCountAddDataChunk << "-th addDataChunk()" << endl;
+            e_cout << e.what() << endl;
+            fInputFailed = true;
+            return false;
+        }
+    }
+    if (fFileStream)
+        return true;
+
+    fFrameBuilder -> FlushEvent();
+    lk_info << "end of MFM file" << endl;
+    return false;
+}
+
+/**
+ * Hands the next window of the mapped run file to the frame builder, which takes its frames one at a time
+ * (SlabFrameBuilder::addMappedChunk). The window after it is read ahead while it is being decoded,
+ * so no read() call or intermediate copy is made on this side.
+ */
+bool LKMFMConversionTask::ReadMappedFile()
+{
+    if (fInputOffset >= fInputEnd) {
+        lk_info << "end of mapped MFM file (" << fInputOffset << " bytes)" << endl;
+        fFrameBuilder -> FlushEvent();
+        fMappedFile.Close();
+        return false;
+    }
+
+    const char *data = fMappedFile.GetData();
+    size_t const windowSize = std::min(fMMapWindowSize, fInputEnd - fInputOffset);
+    fMappedFile.Prefetch(fInputOffset + windowSize, fMMapWindowSize);
+    try {
+        ++fCountAddDataChunk;
+        fFrameBuilder -> addMappedChunk(data + fInputOffset, data + fInputOffset + windowSize);
+    }catch (const std::exception& e){
+        lk_error << "Error occured from " << fCountAddDataChunk << "-th addDataChunk() at byte " << fInputOffset << endl;
+        e_cout << e.what() << endl;
+        fInputFailed = true;
+        fMappedFile.Close();
+        return false;
+    }
+    fInputOffset += windowSize;
+    // The incomplete frame at the end of the window is already copied to the frame builder
+    fMappedFile.Release(fInputOffset);
+    return true;
+}
+
+/**
+ * Conversion on three threads connected by bounded SPSC queues:
+ *   reader        : file stream (or memory map) -> chunk queue
+ *   frame builder : chunk queue -> LKMFMFrameSplitter -> frame queue
+ *   decoder       : frame queue -> LKFrameBuilder::processFrame (the thread calling Exec)
+ * Stream chunks are read into a fixed pool of buffers which the frame builder gives back to the reader.
+ * Frames stay in the slabs of the splitter, which the decoder gives back in the same way.
+ * The reorder buffer of the frame builder keeps the frames of its open events there too, as long as it can.
+ * Compressed input is read from its decompressor by the reader thread in the same way.
+ * There is a single decoder, as LKFrameBuilder keeps its event state in members and fills one channel array.
+ * After an error the downstream stages keep draining their queue so that every thread can finish.
+ */
+struct LKMFMConversionTask::Pipeline
+{
+    struct Chunk {
+        const char *data;
+        size_t size;
+        char *buffer; ///< pool buffer to give back, nullptr for memory mapped chunks
+    };
+
+    Pipeline(int depth, size_t chunkSize) : chunkQueue(depth), freeQueue(depth), frameQueue(depth), splitter(&frameQueue, 4*chunkSize, 4) {}
+
+    LKSPSCQueue<Chunk> chunkQueue;
+    LKSPSCQueue<char*> freeQueue;
+    LKSPSCQueue<LKMFMFrameSplitter::FrameSlice> frameQueue;
+    LKMFMFrameSplitter splitter; ///< its slabs hold the queued frames
+    LKMFMFrameSplitter::FrameSlice current; ///< frame being decoded
+    std::atomic<bool> failed{false};
+    vector<char*> bufferPool;
+    std::thread reader;
+    std::thread builder;
+    int countFrames = 0;
+};
+
+void LKMFMConversionTask::StartPipeline()
+{
+    fPipeline = new Pipeline(fPipelineDepth, fPipelineChunkSize);
+    auto &pipeline = *fPipeline;
+
+    // Frames of open events stay in their slab until the event is unpacked
+    fFrameBuilder -> GetEventBuffer().SetRetainCallback([&pipeline](mfm::Frame &) -> LKEventReorderBuffer::ReleaseHook {
+        LKMFMFrameSplitter::FrameSlice const slice = pipeline.current;
+        if (!pipeline.splitter.Retain(slice))
+            return nullptr;
+        return [&pipeline, slice]() { pipeline.splitter.ReleaseRetained(slice); };
+    });
+
+    if (!fUseMMap) {
+        for (int i=0; i<fPipelineDepth; ++i) {
+            pipeline.bufferPool.push_back(new char[fPipelineChunkSize]);
+            pipeline.freeQueue.Push(pipeline.bufferPool.back());
+        }
+    }
+
+    pipeline.reader = std::thread([this, &pipeline]() {
+        if (fUseMMap) {
+            const char *data = fMappedFile.GetData();
+            size_t const fileSize = fInputEnd;
+            fMappedFile.Prefetch(fInputBegin, fMMapWindowSize);
+            for (size_t offset=fInputBegin; offset<fileSize && !pipeline.failed; offset+=fPipelineChunkSize)
+                pipeline.chunkQueue.Push({data + offset, std::min(fPipelineChunkSize, fileSize - offset), nullptr});
+        }
+        else {
+            while (!pipeline.failed) {
+                char *buffer;
+                pipeline.freeQueue.Pop(buffer);
+                size_t size;
+                bool end;
+                if (fCompressedInput.IsOpen()) {
+                    size = fCompressedInput.Read(buffer, fPipelineChunkSize);
+                    end = size < fPipelineChunkSize;
+                }
+                else {
+                    fFileStream.read(buffer, fPipelineChunkSize);
+                    size = fFileStream.gcount();
+                    end = !fFileStream;
+                }
+                if (size > 0)
+                    pipeline.chunkQueue.Push({buffer, size, buffer});
+                if (end)
+                    break;
             }
         }
-        else if(fFileStream.gcount()>0) {
+        pipeline.chunkQueue.Push({nullptr, 0, nullptr});
+    });
+
+    pipeline.builder = std::thread([this, &pipeline]() {
+        auto &splitter = pipeline.splitter;
+        while (true) {
+            Pipeline::Chunk chunk;
+            pipeline.chunkQueue.Pop(chunk);
+            if (chunk.data == nullptr)
+                break;
+            if (!pipeline.failed) {
+                try {
+                    ++fCountAddDataChunk;
+                    splitter.addDataChunk(chunk.data, chunk.data + chunk.size);
+                }catch (const std::exception& e){
+                    lk_error << "Error occured from " << fCountAddDataChunk << "-th addDataChunk()" << endl;
+                    e_cout << e.what() << endl;
+                    pipeline.failed = true;
+                }
+                // The chunk was copied into the slab, its pages are not needed anymore
+                if (fUseMMap) {
+                    size_t const chunkEnd = chunk.data + chunk.size - fMappedFile.GetData();
+                    fMappedFile.Prefetch(chunkEnd, fMMapWindowSize);
+                    fMappedFile.Release(chunkEnd);
+                }
+            }
+            if (chunk.buffer != nullptr)
+                pipeline.freeQueue.Push(chunk.buffer);
+        }
+        pipeline.frameQueue.Push(LKMFMFrameSplitter::FrameSlice());
+    });
+}
+
+/// Decodes frames from the pipeline until one was decoded. After an error the rest of the frames is drained.
+bool LKMFMConversionTask::ReadPipeline()
+{
+    if (fPipeline == nullptr)
+        StartPipeline();
+
+    while (true) {
+        LKMFMFrameSplitter::FrameSlice slice;
+        fPipeline -> frameQueue.Pop(slice);
+        if (slice.slab == nullptr)
+            break;
+        if (!fPipeline -> failed) {
             try {
-                ++fCountAddDataChunk;
-                fFrameBuilder -> addDataChunk(fBuffer,fBuffer+fFileStream.gcount());
+                ++fPipeline -> countFrames;
+                // The frame is viewed where the splitter assembled it
+                fPipeline -> current = slice;
+                mfm::Frame frame(mfm::Serializer(slice.slab->data, slice.size, slice.offset));
+                fFrameBuilder -> processFrame(frame);
             }catch (const std::exception& e){
-                lk_error << "Error occured from LAST " << fCountAddDataChunk << "-th addDataChunk()" << endl;
+                lk_error << "Error occured from " << fPipeline -> countFrames << "-th frame" << endl;
                 e_cout << e.what() << endl;
-                return;
+                fPipeline -> failed = true;
             }
         }
+        fPipeline -> splitter.Release(slice);
+        if (!fPipeline -> failed)
+            return true;
     }
+
+    StopPipeline();
+    return false;
+}
+
+/// Joins the threads after the end of the frame queue was popped
+void LKMFMConversionTask::StopPipeline()
+{
+    auto &pipeline = *fPipeline;
+    pipeline.reader.join();
+    pipeline.builder.join();
+    if (pipeline.failed)
+        fInputFailed = true;
+    else
+        fFrameBuilder -> FlushEvent();
+    for (auto buffer : pipeline.bufferPool)
+        delete [] buffer;
+    if (fUseMMap)
+        fMappedFile.Close();
+    if (fCompressedInput.IsOpen()) {
+        lk_info << fCompressedInput.GetTotalSize() << " bytes decompressed" << endl;
+        if (!fCompressedInput.Close() && !pipeline.failed)
+            lk_error << "Decompression of " << infname << " failed, the end of the run may be missing" << endl;
+    }
+
+    lk_info << "end of MFM file, " << pipeline.countFrames << " frames decoded" << endl;
+    lk_info << "Pipeline queues (mean occupancy / depth, producer waits on full, consumer waits on empty):" << endl;
+    lk_info << "  reader  -> builder : " << pipeline.chunkQueue.GetMeanOccupancy() << " / " << pipeline.chunkQueue.GetDepth()
+        << ", " << pipeline.chunkQueue.GetNumFullWaits() << ", " << pipeline.chunkQueue.GetNumEmptyWaits() << endl;
+    lk_info << "  builder -> decoder : " << pipeline.frameQueue.GetMeanOccupancy() << " / " << pipeline.frameQueue.GetDepth()
+        << ", " << pipeline.frameQueue.GetNumFullWaits() << ", " << pipeline.frameQueue.GetNumEmptyWaits() << endl;
+    // Frames still held by the reorder buffer after an error are in the slabs of the splitter
+    fFrameBuilder -> GetEventBuffer().Clear();
+    fFrameBuilder -> GetEventBuffer().SetRetainCallback(nullptr);
+    delete fPipeline;
+    fPipeline = nullptr;
+}
+
+/**
+ * Reads the frame index of the mapped file from fFrameIndexFileName.
+ * If there is no valid index yet, the file is scanned and the index is written for the next time.
+ */
+bool LKMFMConversionTask::LoadFrameIndex(LKMFMFrameIndex &frameIndex)
+{
+    size_t const fileSize = fMappedFile.GetSize();
+    if (frameIndex.Read(fFrameIndexFileName, fileSize)) {
+        lk_info << "Read " << frameIndex.GetNumFrames() << " frames from index " << fFrameIndexFileName << endl;
+        return true;
+    }
+
+    frameIndex.Clear();
+    size_t const indexed = frameIndex.Build(fMappedFile.GetData(), fileSize);
+    if (indexed < fileSize)
+        lk_warning << "Last " << fileSize - indexed << " bytes do not form a complete frame" << endl;
+    lk_info << "Indexed " << frameIndex.GetNumFrames() << " frames" << endl;
+
+    if (fWriteFrameIndex && indexed == fileSize) {
+        if (frameIndex.Write(fFrameIndexFileName, fileSize))
+            lk_info << "Frame index written to " << fFrameIndexFileName << endl;
+        else
+            lk_warning << "Could not write frame index " << fFrameIndexFileName << endl;
+    }
+    return frameIndex.GetNumFrames() > 0;
+}
+
+/// Frames of the events from MFMFirstEvent to MFMLastEvent (all frames if neither is set)
+bool LKMFMConversionTask::SelectEventRange(LKMFMFrameIndex &frameIndex, size_t &beginFrame, size_t &endFrame)
+{
+    beginFrame = 0;
+    endFrame = frameIndex.GetNumFrames();
+    if (fFirstEvent < 0 && fLastEvent < 0)
+        return true;
+
+    uint32_t const firstEventIdx = fFirstEvent < 0 ? 0 : fFirstEvent;
+    uint32_t const lastEventIdx = fLastEvent < 0 ? UINT32_MAX : fLastEvent;
+    if (!frameIndex.FindEventRange(firstEventIdx, lastEventIdx, beginFrame, endFrame)) {
+        lk_error << "No event between " << firstEventIdx << " and " << lastEventIdx << " in " << infname << endl;
+        return false;
+    }
+    lk_info << "Events " << firstEventIdx << " to " << lastEventIdx << " are in frames " << beginFrame << " to " << endFrame-1 << endl;
+    return true;
+}
+
+/**
+ * Splits the mapped run file into fNumShards byte ranges of similar size.
+ * The frame index is used so that every shard starts with the first frame of an event.
+ * The frame builders (without histogram server) are created when the shards are converted.
+ */
+bool LKMFMConversionTask::InitShards()
+{
+    if (!fMappedFile.Open(infname)) {
+        lk_error << "Could not map input file!" << std::endl;
+        return false;
+    }
+
+    const char *data = fMappedFile.GetData();
+    LKMFMFrameIndex frameIndex;
+    size_t beginFrame, endFrame;
+    if (!LoadFrameIndex(frameIndex) || !SelectEventRange(frameIndex, beginFrame, endFrame))
+        return false;
+
+    auto boundaries = frameIndex.FindShardBoundaries(fNumShards, beginFrame, endFrame);
+    for (size_t i=0; i+1<boundaries.size(); ++i) {
+        auto fileName = Form("%s/lk_mfm_shard_%d_%d.root", fShardDirectory.c_str(), getpid(), (int) i);
+        auto shard = new LKMFMShard(i, fileName);
+        shard -> AddRange(data + boundaries[i], data + boundaries[i+1]);
+        fShards.push_back(shard);
+    }
+
+    lk_info << frameIndex.GetNumFrames() << " frames split into " << fShards.size() << " shards" << endl;
+    fUseShards = true;
+    return true;
+}
+
+/**
+ * ReadType 3: MFMFileName lists the segments of one run (run_XXXX.dat.N), one file per line and in order.
+ * Every segment becomes one shard. A frame cut at the end of a segment is completed by the first bytes
+ * of the next segment: the shard of the segment gets both ranges, and the next shard starts after them.
+ * Frames of one event written to two segments are put together when the shards are merged.
+ */
+bool LKMFMConversionTask::InitSegments()
+{
+    ifstream listFile(infname.c_str());
+    if (!listFile) {
+        lk_error << "Could not open list file " << infname << endl;
+        return false;
+    }
+    string line;
+    maxinfidx = 0;
+    while (getline(listFile, line) && maxinfidx < maxfileno) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        listinfname[maxinfidx++] = line;
+    }
+
+    for (infidx=0; infidx<maxinfidx; ++infidx) {
+        auto segment = new LKMFMMappedFile();
+        if (!segment -> Open(listinfname[infidx])) {
+            lk_error << "Could not map segment " << listinfname[infidx] << endl;
+            delete segment;
+            return false;
+        }
+        fSegmentFiles.push_back(segment);
+    }
+
+    // Bytes at the beginning of a segment which belong to the last frame of the previous segment
+    size_t carry = 0;
+    int numFrames = 0;
+    for (size_t iSegment=0; iSegment<fSegmentFiles.size(); ++iSegment)
+    {
+        const char *data = fSegmentFiles[iSegment] -> GetData();
+        size_t const size = fSegmentFiles[iSegment] -> GetSize();
+        if (carry > size) {
+            lk_error << "Frame spans more than one segment boundary at " << listinfname[iSegment] << endl;
+            return false;
+        }
+
+        LKMFMFrameIndex frameIndex;
+        size_t const end = frameIndex.Build(data, size, carry);
+        numFrames += frameIndex.GetNumFrames();
+
+        auto fileName = Form("%s/lk_mfm_shard_%d_%d.root", fShardDirectory.c_str(), getpid(), (int) iSegment);
+        auto shard = new LKMFMShard(iSegment, fileName);
+        shard -> AddRange(data + carry, data + size);
+        fShards.push_back(shard);
+
+        carry = 0;
+        if (end < size) {
+            if (iSegment+1 == fSegmentFiles.size()) {
+                lk_warning << "Last " << size - end << " bytes of the run do not form a complete frame" << endl;
+                break;
+            }
+            // The frame header itself may be cut
+            char header[4];
+            const char *next = fSegmentFiles[iSegment+1] -> GetData();
+            for (size_t i=0; i<4; ++i)
+                header[i] = (end + i < size) ? data[end + i] : next[end + i - size];
+            carry = LKMFMFrameIndex::DecodeFrameSize(header) - (size - end);
+            shard -> AddRange(next, next + std::min(carry, fSegmentFiles[iSegment+1] -> GetSize()));
+        }
+    }
+
+    if (fNumShards <= 1)
+        fNumShards = std::max(1u, std::thread::hardware_concurrency());
+    lk_info << maxinfidx << " segments, " << numFrames << " frames, converted on up to " << fNumShards << " threads" << endl;
+    fUseShards = true;
+    return true;
+}
+
+/**
+ * Converts the shards on a pool of up to fNumShards threads, then opens their outputs for merging.
+ * A frame builder holds more than 100 MB of arrays, so each shard gets a new one which is freed after its conversion:
+ * there are never more builders than threads, however many segments the run has.
+ */
+bool LKMFMConversionTask::ConvertShards()
+{
+    ROOT::EnableThreadSafety();
+
+    std::atomic<size_t> nextShard(0);
+    std::atomic<bool> good(true);
+    vector<std::thread> workers;
+    int const numWorkers = std::min<int>(fNumShards, fShards.size());
+    for (int i=0; i<numWorkers; ++i) {
+        workers.emplace_back([&]() {
+            for (size_t iShard=nextShard++; iShard<fShards.size(); iShard=nextShard++) {
+                TClonesArray *channelArray;
+                LKFrameBuilder *builder;
+                {
+                    std::lock_guard<std::mutex> lock(fShardBuilderMutex);
+                    channelArray = new TClonesArray("MMChannel", 1000);
+                    builder = NewFrameBuilder(0, channelArray);
+                }
+                if (!fShards[iShard] -> Convert(builder, channelArray, fMMapWindowSize))
+                    good = false;
+
+                std::lock_guard<std::mutex> lock(fShardBuilderMutex);
+                fBuilderStatistics.Add(builder);
+                delete builder;
+                delete channelArray;
+            }
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+    fMappedFile.Close();
+    for (auto segment : fSegmentFiles)
+        delete segment;
+    fSegmentFiles.clear();
+
+    for (auto shard : fShards) {
+        if (!shard -> OpenForRead()) {
+            lk_error << "Could not read back shard " << shard -> GetIndex() << endl;
+            good = false;
+        }
+        else
+            lk_info << "Shard " << shard -> GetIndex() << ": " << shard -> GetNumEvents() << " events" << endl;
+    }
+    return good;
+}
+
+/**
+ * Fills the channel array with the next event of the merged shards.
+ * Events are taken in eventIdx order; frames of one event found in more than one shard are put together.
+ */
+void LKMFMConversionTask::ExecShards()
+{
+    if (!fShardsConverted) {
+        fShardsConverted = true;
+        if (!ConvertShards())
+            lk_error << "Conversion of some shards failed, their events are incomplete" << endl;
+    }
+
+    fChannelArray -> Clear("C");
+
+    LKMFMShard *next = nullptr;
+    for (auto shard : fShards)
+        if (shard -> HasEvent() && (next == nullptr || shard -> GetEventIdx() < next -> GetEventIdx()))
+            next = shard;
+    if (next == nullptr) {
+        lk_info << "end of shards" << endl;
+        fRun -> SignalEndOfRun();
+        return;
+    }
+
+    Int_t const eventIdx = next -> GetEventIdx();
+    if (eventIdx <= fLastEventIdx)
+        lk_warning << "Event " << eventIdx << " comes after event " << fLastEventIdx << endl;
+    fLastEventIdx = eventIdx;
+
+    int countChannels = 0;
+    for (auto shard : fShards) {
+        while (shard -> HasEvent() && shard -> GetEventIdx() == eventIdx) {
+            TClonesArray *source = shard -> GetChannelArray();
+            for (int i=0; i<source -> GetEntriesFast(); ++i) {
+                auto channel = (MMChannel *) fChannelArray -> ConstructedAt(countChannels++);
+                *channel = *(MMChannel *) source -> At(i);
+            }
+            shard -> Next();
+        }
+    }
+}
+
+/**
+ * Walks the frame headers of the mapped file without decoding any item and writes the run summary.
+ */
+void LKMFMConversionTask::ExecRunSummary()
+{
+    LKMFMRunSummary summary;
+    fMappedFile.Prefetch(0, fMappedFile.GetSize());
+    size_t const scanned = summary.Scan(fMappedFile.GetData(), fMappedFile.GetSize());
+    if (scanned < fMappedFile.GetSize())
+        lk_warning << "Last " << fMappedFile.GetSize() - scanned << " bytes do not form a complete frame" << endl;
+
+    if (summary.Write(fRunSummaryFileName, infname))
+        lk_info << "Run summary written to " << fRunSummaryFileName << endl;
+    else
+        lk_error << "Could not write run summary " << fRunSummaryFileName << endl;
+
+    fMappedFile.Close();
+    fRun -> SignalEndOfRun();
+}
+
+/**
+ * Follow mode: the run file is read while the acquisition is still writing it.
+ */
+bool LKMFMConversionTask::InitFollow()
+{
+    fFollowReader.SetPollInterval(fFollowPollInterval);
+    fFollowReader.SetIdleTimeout(fFollowIdleTimeout);
+    if (!fFollowReader.Open(infname)) {
+        lk_error << "Could not open input file!" << std::endl;
+        return false;
+    }
+    lk_info << "Following " << infname << ", the run ends after " << fFollowIdleTimeout << " s without new data" << endl;
+    if (fWriteCheckpoint || fResume) {
+        lk_warning << "Checkpoints are not available in follow mode" << endl;
+        fWriteCheckpoint = fResume = false;
+    }
+
+    fFollowBuffer = new char[fFollowChunkSize];
+    InitEventQueue();
+
+    // Events open longer than MFMEventTimeout are emitted while the acquisition is quiet, not only when the next frame comes
+    if (fEventWindow > 0 && fEventTimeout > 0) {
+        fFollowReader.SetIdleCallback([this]() {
+            fFrameBuilder -> PollEventBuffer();
+            return !fEvents.empty();
+        });
+    }
+    return true;
+}
+
+/**
+ * Gives the bytes appended to the run to the frame builder, waiting for the acquisition when there is nothing new.
+ * At the end of the run the last events are flushed into the queue and handed out without waiting again.
+ */
+bool LKMFMConversionTask::ReadFollow()
+{
+    size_t const size = fFollowReader.Read(fFollowBuffer, fFollowChunkSize);
+    if (size == 0 && !fFollowReader.IsFinished())
+        return true; // events were emitted by PollEventBuffer
+    if (size == 0) {
+        fFrameBuilder -> FlushEvent();
+        lk_info << "no new data for " << fFollowIdleTimeout << " s, end of run after "
+            << fFollowReader.GetTotalSize() << " bytes in " << fFollowReader.GetNumSegments() << " segment(s)" << endl;
+        fFollowReader.Close();
+        return false;
+    }
+    try {
+        ++fCountAddDataChunk;
+        fFrameBuilder -> addDataChunk(fFollowBuffer, fFollowBuffer + size);
+    }catch (const std::exception& e){
+        lk_error << "Error occured from " << fCountAddDataChunk << "-th addDataChunk()" << endl;
+        e_cout << e.what() << endl;
+        fFollowReader.Close();
+        fInputFailed = true;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Replay mode: the converted tree is read again by the frame builder (RootReadEvent) to fill its histograms,
+ * the run gets no events. RunMode is the read mode of the frame builder and must be > 0.
+ */
+bool LKMFMConversionTask::InitReplay()
+{
+    if (fMode <= 0) {
+        lk_error << "MFMReplayFile needs RunMode > 0" << endl;
+        return false;
+    }
+    if (fReplayTreeName.empty()) {
+        lk_error << "MFMReplayTree is needed to replay " << fReplayFileName << endl;
+        return false;
+    }
+    if (gSystem -> AccessPathName(fReplayFileName.c_str())) {
+        lk_error << "Could not find " << fReplayFileName << endl;
+        return false;
+    }
+    fFrameBuilder = NewFrameBuilder(fConverterPort, nullptr);
+    return true;
+}
+
+/**
+ * Replays the whole tree in one Exec, sequentially or on fReplayThreads threads whose histograms are summed
+ * into the ones of fFrameBuilder, then writes the accumulated histograms to fReplayHistFileName.
+ */
+void LKMFMConversionTask::ExecReplay()
+{
+    string fileName = fReplayFileName;
+    string treeName = fReplayTreeName;
+    Long64_t numEntries = 0;
+    if (fReplayThreads == 1) {
+        fFrameBuilder -> RootROpenFile(fileName, treeName);
+        fFrameBuilder -> RootReadEvent();
+        fFrameBuilder -> RootRCloseFile();
+        numEntries = fFrameBuilder -> GetNumEntries();
+    }
+    else {
+        // Builders of the workers have no histogram server and no channel array
+        LKParallelReplay replay(fFrameBuilder, [this]() { return NewFrameBuilder(0, nullptr); });
+        replay.SetNumThreads(fReplayThreads);
+        if (!replay.Run(fileName, treeName)) {
+            fRun -> SignalEndOfRun();
+            return;
+        }
+        numEntries = replay.GetNumEntries();
+    }
+    lk_info << "Replayed " << numEntries << " entries of " << fReplayFileName << endl;
+    Long64_t numChecks = fFrameBuilder -> GetNumDeconvolutionChecks();
+    if (numChecks > 0)
+        lk_info << "DeconvolutionMethod 2: FFT peak within 2 buckets of the Gold peak in " << fFrameBuilder -> GetNumDeconvolutionAgreed()
+            << " of " << numChecks << " waveforms (" << 100. * fFrameBuilder -> GetNumDeconvolutionAgreed() / numChecks << "%)" << endl;
+
+    if (!fReplayHistFileName.empty()) {
+        vector<TH1*> histograms;
+        fFrameBuilder -> GetAccumulatedHistograms(histograms);
+        TFile file(fReplayHistFileName.c_str(), "recreate");
+        for (auto histogram : histograms)
+            if (histogram != nullptr)
+                histogram -> Write();
+        file.Close();
+        lk_info << "Accumulated histograms written to " << fReplayHistFileName << endl;
+    }
+    fRun -> SignalEndOfRun();
+}
+
+void LKMFMConversionTask::BuilderStatistics::Add(LKFrameBuilder *builder)
+{
+    auto &router = builder -> GetFrameRouter();
+    routerActive = routerActive || router.IsActive();
+    numKept += router.GetNumFrames(LKCoBoFrameRouter::kKeep);
+    numDropped += router.GetNumFrames(LKCoBoFrameRouter::kDrop);
+    numDiverted += router.GetNumFrames(LKCoBoFrameRouter::kDivert);
+
+    filterActive = filterActive || builder -> GetHitPatternFilter().IsActive();
+    numFiltered += builder -> GetNumFilteredEvents();
+
+    auto &eventBuffer = builder -> GetEventBuffer();
+    eventBufferActive = eventBufferActive || eventBuffer.IsActive();
+    numEvents += eventBuffer.GetNumEvents();
+    numIncomplete += eventBuffer.GetNumIncompleteEvents();
+    numLate += eventBuffer.GetNumLateFrames();
+    maxOpen = std::max(maxOpen, eventBuffer.GetMaxOpenEvents());
 }
 
 bool LKMFMConversionTask::EndOfRun()
 {
+    if (fPipeline != nullptr) {
+        // The run ended before the input: the frames still queued are dropped so that the threads can finish
+        fPipeline -> failed = true;
+        while (true) {
+            LKMFMFrameSplitter::FrameSlice slice;
+            fPipeline -> frameQueue.Pop(slice);
+            if (slice.slab == nullptr)
+                break;
+            fPipeline -> splitter.Release(slice);
+        }
+        StopPipeline();
+    }
+
+    // All frame builders have the same rules, the statistics of the shards were added up as their builders were freed
+    auto &stats = fBuilderStatistics;
+    if (fFrameBuilder != nullptr)
+        stats.Add(fFrameBuilder);
+    if (stats.routerActive)
+        lk_info << "Frames kept " << stats.numKept << ", dropped " << stats.numDropped << ", diverted " << stats.numDiverted << endl;
+    if (stats.filterActive)
+        lk_info << stats.numFiltered << " events failed the hit pattern filter and were skipped" << endl;
+    if (stats.eventBufferActive)
+        lk_info << "Events built " << stats.numEvents << " (incomplete " << stats.numIncomplete
+            << "), late frames dropped " << stats.numLate << ", at most " << stats.maxOpen << " events open" << endl;
+    if (fDivertFile.is_open())
+        fDivertFile.close();
+    if (fResumeFile != nullptr) {
+        fResumeFile -> Close();
+        delete fResumeFile;
+        fResumeFile = nullptr;
+    }
+    for (auto event : fEvents)
+        delete event;
+    for (auto event : fFreeEvents)
+        delete event;
+    fEvents.clear();
+    fFreeEvents.clear();
+    delete [] fFollowBuffer;
+    fFollowBuffer = nullptr;
+
+    for (auto shard : fShards)
+        delete shard;
+    fShards.clear();
     return true;
 }
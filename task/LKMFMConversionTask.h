@@ -4,6 +4,16 @@
 #include "LKRun.h"
 #include "LKTask.h"
 #include "LKFrameBuilder.h"
+#include "LKMFMMappedFile.h"
+#include "LKMFMFollowReader.h"
+#include "LKMFMCompressedInput.h"
+
+#include <vector>
+#include <deque>
+#include <mutex>
+
+class LKMFMShard;
+class LKMFMFrameIndex;
 
 /*
  * AT-TPC MFM conversion class
@@ -19,6 +29,35 @@ class LKMFMConversionTask : public LKTask
         void Exec(Option_t*);
         bool EndOfRun();
 
+    private:
+        bool ReadInput();
+        bool ReadStream();
+        bool ReadMappedFile();
+        bool ReadPipeline();
+        bool ReadFollow();
+        void StartPipeline();
+        void StopPipeline();
+
+        LKFrameBuilder* NewFrameBuilder(int port, TClonesArray *channelArray);
+        void InitEventQueue();
+        void NextEvent();
+        bool LoadFrameIndex(LKMFMFrameIndex &frameIndex);
+        bool SelectEventRange(LKMFMFrameIndex &frameIndex, size_t &beginFrame, size_t &endFrame);
+        bool InitShards();
+        bool InitSegments();
+        bool ConvertShards();
+        void ExecShards();
+        void ExecRunSummary();
+        bool InitFollow();
+        bool InitReplay();
+        void ExecReplay();
+        bool InitCheckpoint();
+        void WriteCheckpoint();
+        void FinishCheckpoint();
+        void NextResumedEvent();
+
+    public:
+
         const int kOnline = 0;
         const int kReadMFM = 1;
         const int kReadList = 3;
@@ -69,7 +108,7 @@ class LKMFMConversionTask : public LKTask
         //TString supdatefast;
         //TString goodEventList;
 
-        LKFrameBuilder* fFrameBuilder; // convServer
+        LKFrameBuilder* fFrameBuilder = nullptr; // convServer
 
         // global parameters in main.cc
         //static HistServer* histServer;
@@ -100,6 +139,121 @@ class LKMFMConversionTask : public LKTask
 
         ifstream fFileStream;
 
+        // memory-mapped input (MFMMMapEnable)
+        bool fUseMMap = false;
+        size_t fMMapWindowSize = 64*1024*1024;
+        LKMFMMappedFile fMappedFile;
+        size_t fInputBegin = 0; ///< first byte of the mapped file to convert
+        size_t fInputEnd = 0; ///< byte after the last one to convert
+        size_t fInputOffset = 0; ///< next byte to give to the frame builder
+
+        // frame index kept next to the run file, and range of events to convert (MFMFirstEvent, MFMLastEvent)
+        string fFrameIndexFileName;
+        bool fWriteFrameIndex = true;
+        int fFirstEvent = -1;
+        int fLastEvent = -1;
+
+        // header-only scan instead of the conversion (MFMRunSummary)
+        bool fRunSummaryOnly = false;
+        string fRunSummaryFileName;
+
+        // frames dropped or diverted from their header before decoding (IgnoreMicromegas, MFMDropFrames, MFMDivertFrames)
+        bool fIgnoreMM = false;
+        std::vector<string> fDropFrames;
+        std::vector<string> fDivertFrames;
+        string fDivertFileName;
+        ofstream fDivertFile;
+        std::mutex fDivertMutex;
+
+        // hit pattern pre-filter (MFMHitPatternFilter)
+        std::vector<string> fHitPatternRules;
+
+        // frames of an event collected across CoBos (MFMEventWindow, MFMEventTimeout, MFMEventCoBoAsAds)
+        int fEventWindow = 0;
+        double fEventTimeout = 0;
+        std::vector<string> fEventCoBoAsAds;
+
+        // baseline of the waveforms (BaselineMethod, see LKBaselineEstimator::Method)
+        int fBaselineMethod = 0;
+
+        // deconvolution of the waveforms (DeconvolutionMethod, DeconvolutionRegularization, see LKDeconvolutionEngine)
+        int fDeconvolutionMethod = 0;
+        double fDeconvolutionRegularization = 0; ///< 0 for the default of LKDeconvolutionEngine
+
+        // saturated buckets left out of the waveform fit of EnergyFindingMethod 2 (EnergyFitSkipSaturated)
+        bool fFitSkipSaturated = false;
+
+        // gzip, zstd or lz4 compressed run, decompressed while it is read by the pipeline
+        LKMFMCompressedInput::Format fCompressedFormat = LKMFMCompressedInput::kNone;
+        LKMFMCompressedInput fCompressedInput;
+
+        // restart points of the stream and memory mapped readers (MFMCheckpoint, MFMCheckpointInterval, MFMResume)
+        bool fWriteCheckpoint = false;
+        int fCheckpointInterval = 1000;
+        bool fResume = false;
+        string fCheckpointFileName;
+        string fCheckpointOutputName; ///< output of the run as named in the checkpoints
+        size_t fInputBase = 0; ///< input offset of the first byte given to the frame builder
+        std::deque<Long64_t> fEventRestarts; ///< input offset after each queued event, -1 if the conversion cannot restart there
+        Long64_t fLastRestart = -1; ///< input offset after the last event handed to the run
+        Long64_t fNumEventsHanded = 0; ///< events handed to the run, the copied ones of a resumed conversion included
+        Long64_t fCheckpointEvents = 0; ///< fNumEventsHanded at the last checkpoint
+        bool fInputFailed = false;
+        TFile *fResumeFile = nullptr; ///< output of the interrupted conversion
+        TTree *fResumeTree = nullptr;
+        TClonesArray *fResumeArray = nullptr;
+        Long64_t fNumResumeEvents = 0; ///< events copied from fResumeTree before the conversion continues
+
+        // conversion of a run which is still being written (MFMFollow)
+        bool fFollow = false;
+        int fFollowPollInterval = 500; ///< [ms]
+        int fFollowIdleTimeout = 60; ///< [s]
+        size_t fFollowChunkSize = 64*1024;
+        LKMFMFollowReader fFollowReader;
+        char *fFollowBuffer = nullptr;
+
+        // replay of a converted tree into the histograms of the frame builder (MFMReplayFile, MFMReplayTree, MFMReplayThreads, MFMReplayHistFile)
+        string fReplayFileName;
+        string fReplayTreeName;
+        int fReplayThreads = 1; ///< >1 (0: all cores) replays parts of the tree on parallel threads (LKParallelReplay)
+        string fReplayHistFileName; ///< accumulated histograms are written to it after the replay if set
+
+        // complete events of the stream, memory mapped, pipeline and follow readers, handed to the run one per Exec
+        TClonesArray *fBuilderArray = nullptr; ///< channel array filled by the frame builder
+        std::deque<TClonesArray*> fEvents; ///< complete events not yet handed to the run
+        std::vector<TClonesArray*> fFreeEvents;
+        bool fEndOfInput = false;
+
+        // reader / frame builder / decoder threads (MFMPipelineEnable)
+        struct Pipeline;
+        bool fUsePipeline = false;
+        int fPipelineDepth = 64;
+        size_t fPipelineChunkSize = 1024*1024;
+        Pipeline *fPipeline = nullptr; //! queues and threads, while the pipeline is running
+
+        // concurrent conversion of parts of the run (MFMShards, or one shard per segment with ReadType 3)
+        bool fUseShards = false;
+        int fNumShards = 1;
+        string fShardDirectory = ".";
+        bool fShardsConverted = false;
+        std::vector<LKMFMShard*> fShards;
+        std::vector<LKMFMMappedFile*> fSegmentFiles;
+        std::mutex fShardBuilderMutex; ///< builders of the shards are created and freed one at a time
+
+        // frame and event counts of the frame builders, added up as the builders of the shards are freed
+        struct BuilderStatistics {
+            bool routerActive = false;
+            bool filterActive = false;
+            bool eventBufferActive = false;
+            uint64_t numKept = 0, numDropped = 0, numDiverted = 0;
+            uint64_t numFiltered = 0;
+            uint64_t numEvents = 0, numIncomplete = 0, numLate = 0;
+            size_t maxOpen = 0;
+            void Add(LKFrameBuilder *builder);
+        };
+        BuilderStatistics fBuilderStatistics;
+        Int_t fLastEventIdx = -1;
+
         int fCountAddDataChunk = 0;
 
         TClonesArray *fChannelArray = nullptr;
@@ -0,0 +1,145 @@
+#include <iostream>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+using namespace std;
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "LKMFMFollowReader.h"
+
+LKMFMFollowReader::~LKMFMFollowReader()
+{
+    Close();
+}
+
+bool LKMFMFollowReader::Open(const std::string &fileName)
+{
+    Close();
+    if (!OpenSegment(fileName))
+        return false;
+
+#ifdef __linux__
+    // The directory is watched so that the creation of the next segment wakes the reader as well
+    size_t const slash = fileName.rfind('/');
+    std::string const directory = (slash == std::string::npos) ? "." : fileName.substr(0, slash+1);
+    fNotifyDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fNotifyDescriptor >= 0)
+        fNotifyWatch = inotify_add_watch(fNotifyDescriptor, directory.c_str(), IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE);
+    if (fNotifyWatch < 0)
+        cerr << "LKMFMFollowReader: could not watch " << directory << ", polling every " << fPollInterval << " ms" << endl;
+#endif
+
+    fNumSegments = 1;
+    fTotalSize = 0;
+    fFinished = false;
+    return true;
+}
+
+void LKMFMFollowReader::Close()
+{
+    if (fFileDescriptor >= 0)
+        close(fFileDescriptor);
+    if (fNotifyDescriptor >= 0)
+        close(fNotifyDescriptor);
+    fFileDescriptor = -1;
+    fNotifyDescriptor = -1;
+    fNotifyWatch = -1;
+}
+
+bool LKMFMFollowReader::OpenSegment(const std::string &fileName)
+{
+    int const fileDescriptor = open(fileName.c_str(), O_RDONLY);
+    if (fileDescriptor < 0) {
+        cerr << "LKMFMFollowReader: could not open " << fileName << endl;
+        return false;
+    }
+    if (fFileDescriptor >= 0)
+        close(fFileDescriptor);
+    fFileDescriptor = fileDescriptor;
+    fFileName = fileName;
+    return true;
+}
+
+std::string LKMFMFollowReader::NextSegmentName(const std::string &fileName)
+{
+    // The first segment may carry a date after .dat (run_XXXX.dat.24-03-23_22h05m35s), the next ones add .N
+    size_t const dot = fileName.rfind('.');
+    size_t const dat = fileName.rfind(".dat");
+    bool const numbered = dot != std::string::npos && dat != std::string::npos && dot > dat && dot+1 < fileName.size()
+        && fileName.find_first_not_of("0123456789", dot+1) == std::string::npos;
+    if (numbered)
+        return fileName.substr(0, dot+1) + std::to_string(atoi(fileName.c_str() + dot + 1) + 1);
+    return fileName + ".1";
+}
+
+size_t LKMFMFollowReader::Read(char *buffer, size_t size)
+{
+    fFinished = true;
+    if (fFileDescriptor < 0)
+        return 0;
+
+    auto idleSince = std::chrono::steady_clock::now();
+    while (true)
+    {
+        ssize_t const numRead = read(fFileDescriptor, buffer, size);
+        if (numRead > 0) {
+            fTotalSize += numRead;
+            fFinished = false;
+            return numRead;
+        }
+        if (numRead < 0 && errno != EINTR) {
+            cerr << "LKMFMFollowReader: read error on " << fFileName << endl;
+            return 0;
+        }
+
+        // Nothing new in this segment. The acquisition has moved on if the next segment exists:
+        // whatever was appended before the switch is read by the next turn of the loop.
+        std::string const nextName = NextSegmentName(fFileName);
+        struct stat nextStat;
+        if (stat(nextName.c_str(), &nextStat) == 0) {
+            ssize_t const numLeft = read(fFileDescriptor, buffer, size);
+            if (numLeft > 0) {
+                fTotalSize += numLeft;
+                fFinished = false;
+                return numLeft;
+            }
+            if (!OpenSegment(nextName))
+                return 0;
+            ++fNumSegments;
+            cout << "LKMFMFollowReader: continuing with segment " << fFileName << endl;
+            idleSince = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        std::chrono::duration<double> const idle = std::chrono::steady_clock::now() - idleSince;
+        if (idle.count() >= fIdleTimeout)
+            return 0;
+        WaitForChange();
+        if (fIdleCallback && fIdleCallback()) {
+            fFinished = false;
+            return 0;
+        }
+    }
+}
+
+/// Sleeps until something is written in the directory of the run, at most fPollInterval
+void LKMFMFollowReader::WaitForChange()
+{
+    if (fNotifyWatch < 0) {
+        usleep(fPollInterval * 1000);
+        return;
+    }
+
+    struct pollfd pollDescriptor = {fNotifyDescriptor, POLLIN, 0};
+    if (poll(&pollDescriptor, 1, fPollInterval) > 0) {
+        char events[4096];
+        while (read(fNotifyDescriptor, events, sizeof(events)) > 0) {}
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef LKMFMFOLLOWREADER_HH
+#define LKMFMFOLLOWREADER_HH
+
+#include <string>
+#include <cstddef>
+#include <functional>
+
+/*
+ * Reader for a MFM run which is still being written by the acquisition.
+ * Read() returns the bytes appended since the last call and waits for the file to grow
+ * when there are none (inotify on the directory of the run, plain polling where it is not available).
+ * When the next segment of the run appears (run_XXXX.dat -> run_XXXX.dat.1 -> run_XXXX.dat.2 ...),
+ * the rest of the current segment is read and the reader continues with the new one.
+ * The run is considered finished when nothing was written for the idle timeout.
+ * Frames cut at the end of a read or of a segment are completed by the frame builder, which keeps the partial frame.
+ */
+class LKMFMFollowReader
+{
+    public:
+        LKMFMFollowReader() {}
+        virtual ~LKMFMFollowReader();
+
+        bool Open(const std::string &fileName);
+        void Close();
+
+        void SetPollInterval(int milliseconds) { fPollInterval = milliseconds; }
+        void SetIdleTimeout(double seconds) { fIdleTimeout = seconds; }
+        /// Called every poll interval while Read() waits for data. Returning true makes Read() return 0 at once.
+        void SetIdleCallback(std::function<bool()> callback) { fIdleCallback = callback; }
+
+        /// Reads at most size bytes, waiting for new data if needed. Returns 0 at the end of the run or when the idle callback asked for it.
+        size_t Read(char *buffer, size_t size);
+        /// The last Read() returned 0 because the run ended (idle timeout or error), not because of the idle callback
+        bool IsFinished() const { return fFinished; }
+
+        const std::string &GetFileName() const { return fFileName; }
+        int GetNumSegments() const { return fNumSegments; }
+        size_t GetTotalSize() const { return fTotalSize; }
+
+        /// run_XXXX.dat -> run_XXXX.dat.1, run_XXXX.dat.N -> run_XXXX.dat.N+1 (also with a date after .dat)
+        static std::string NextSegmentName(const std::string &fileName);
+
+    private:
+        bool OpenSegment(const std::string &fileName);
+        void WaitForChange();
+
+    private:
+        std::string fFileName;
+        int fFileDescriptor = -1;
+        int fNotifyDescriptor = -1;
+        int fNotifyWatch = -1;
+        int fPollInterval = 500;    ///< [ms]
+        double fIdleTimeout = 60;   ///< [s]
+        int fNumSegments = 0;
+        size_t fTotalSize = 0;      ///< bytes read from all segments
+        bool fFinished = false;
+        std::function<bool()> fIdleCallback;
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+using namespace std;
+
+#include "LKMFMFrameIndex.h"
+
+namespace {
+
+const char kIndexMagic[8] = {'L','K','M','F','M','I','X','1'};
+static_assert(sizeof(LKMFMFrameEntry) == 32, "LKMFMFrameEntry is written to index files as it is");
+
+uint64_t LoadField(const unsigned char *p, int size, bool littleEndian)
+{
+    uint64_t value = 0;
+    for (int i=0; i<size; ++i)
+        value = (value << 8) | p[littleEndian ? size-1-i : i];
+    return value;
+}
+
+}
+
+/**
+ * Primary header: metaType (endianness in bit 7, blob flag in bit 6, log2 of the block size in bits 0-3),
+ * frameSize in blocks (3 Bytes), dataSource, frameType (2 Bytes) and revision.
+ * Basic and layered frames continue with headerSize, itemSize (0 for layered frames), nItems,
+ * eventTime (6 Bytes) at 16, eventIdx at 22, and for CoBo frames coboIdx and asadIdx at 26 and 27.
+ * MuTanT blob frames carry the event timestamp at 8 and the event number at 14.
+ */
+bool LKMFMFrameIndex::DecodeFrameHeader(const char *data, size_t size, LKMFMFrameEntry &entry)
+{
+    const unsigned char *header = (const unsigned char *) data;
+    if (size < 8)
+        return false;
+
+    uint8_t const metaType = header[0];
+    bool const littleEndian = (metaType & 0x80) != 0;
+    bool const isBlob = (metaType & 0x40) != 0;
+    uint32_t const blockSize = 1u << (metaType & 0x0f);
+
+    entry.size = LoadField(header+1, 3, littleEndian) * blockSize;
+    entry.eventIdx = 0;
+    entry.eventTime = 0;
+    entry.coboIdx = 0;
+    entry.asadIdx = 0;
+    entry.flags = 0;
+    entry.reserved = 0;
+
+    uint16_t const frameType = LoadField(header+5, 2, littleEndian);
+    if (isBlob) {
+        entry.flags |= kBlobFrame;
+        if (frameType == 0x8 && size >= 18 && entry.size >= 18) {
+            entry.eventTime = LoadField(header+8, 6, littleEndian);
+            entry.eventIdx = LoadField(header+14, 4, littleEndian);
+        }
+        return true;
+    }
+
+    if (size < 28)
+        return false;
+    if (LoadField(header+10, 2, littleEndian) == 0)
+        entry.flags |= kLayeredFrame;
+    entry.eventTime = LoadField(header+16, 6, littleEndian);
+    entry.eventIdx = LoadField(header+22, 4, littleEndian);
+    if (!(entry.flags & kLayeredFrame)) {
+        entry.coboIdx = header[26];
+        entry.asadIdx = header[27];
+    }
+    return true;
+}
+
+uint64_t LKMFMFrameIndex::DecodeFrameSize(const char *data)
+{
+    const unsigned char *header = (const unsigned char *) data;
+    return LoadField(header+1, 3, (header[0] & 0x80) != 0) << (header[0] & 0x0f);
+}
+
+size_t LKMFMFrameIndex::Build(const char *data, size_t size, size_t startOffset)
+{
+    size_t offset = startOffset;
+    while (offset < size)
+    {
+        LKMFMFrameEntry entry;
+        if (!DecodeFrameHeader(data + offset, size - offset, entry))
+            break;
+        if (entry.size < 8) {
+            cerr << "LKMFMFrameIndex: invalid frame size " << entry.size << " at byte " << offset << endl;
+            break;
+        }
+        if (offset + entry.size > size)
+            break;
+        entry.offset = offset;
+        fEntries.push_back(entry);
+        offset += entry.size;
+    }
+    return offset;
+}
+
+bool LKMFMFrameIndex::Write(const std::string &fileName, uint64_t mfmFileSize) const
+{
+    ofstream file(fileName.c_str(), std::ios::binary);
+    if (!file)
+        return false;
+    uint64_t const numEntries = fEntries.size();
+    file.write(kIndexMagic, sizeof(kIndexMagic));
+    file.write((const char *) &mfmFileSize, sizeof(mfmFileSize));
+    file.write((const char *) &numEntries, sizeof(numEntries));
+    file.write((const char *) fEntries.data(), numEntries * sizeof(LKMFMFrameEntry));
+    return bool(file);
+}
+
+bool LKMFMFrameIndex::Read(const std::string &fileName, uint64_t mfmFileSize)
+{
+    ifstream file(fileName.c_str(), std::ios::binary);
+    if (!file)
+        return false;
+
+    char magic[8];
+    uint64_t indexedFileSize = 0, numEntries = 0;
+    file.read(magic, sizeof(magic));
+    file.read((char *) &indexedFileSize, sizeof(indexedFileSize));
+    file.read((char *) &numEntries, sizeof(numEntries));
+    if (!file || memcmp(magic, kIndexMagic, sizeof(magic)) != 0) {
+        cerr << "LKMFMFrameIndex: " << fileName << " is not a frame index" << endl;
+        return false;
+    }
+    if (indexedFileSize != mfmFileSize) {
+        cerr << "LKMFMFrameIndex: " << fileName << " was made for a file of " << indexedFileSize << " bytes" << endl;
+        return false;
+    }
+
+    fEntries.resize(numEntries);
+    file.read((char *) fEntries.data(), numEntries * sizeof(LKMFMFrameEntry));
+    if (!file) {
+        fEntries.clear();
+        return false;
+    }
+    return true;
+}
+
+bool LKMFMFrameIndex::FindEventRange(uint32_t firstEventIdx, uint32_t lastEventIdx, size_t &beginFrame, size_t &endFrame) const
+{
+    beginFrame = endFrame = 0;
+    bool found = false;
+    for (size_t i=0; i<fEntries.size(); ++i)
+    {
+        const LKMFMFrameEntry &entry = fEntries[i];
+        if ((entry.flags & kBlobFrame) || entry.eventIdx < firstEventIdx || entry.eventIdx > lastEventIdx)
+            continue;
+        if (!found)
+            beginFrame = i;
+        endFrame = i + 1;
+        found = true;
+    }
+    return found;
+}
+
+std::vector<uint64_t> LKMFMFrameIndex::FindShardBoundaries(int numShards, size_t beginFrame, size_t endFrame) const
+{
+    std::vector<uint64_t> boundaries;
+    if (beginFrame >= endFrame || endFrame > fEntries.size())
+        return boundaries;
+
+    uint64_t const begin = fEntries[beginFrame].offset;
+    uint64_t const end = fEntries[endFrame-1].offset + fEntries[endFrame-1].size;
+    boundaries.push_back(begin);
+
+    size_t iFrame = beginFrame + 1;
+    uint32_t maxEventIdx = (fEntries[beginFrame].flags & kBlobFrame) ? 0 : fEntries[beginFrame].eventIdx;
+    bool seenEvent = !(fEntries[beginFrame].flags & kBlobFrame);
+    for (int iShard=1; iShard<numShards; ++iShard)
+    {
+        uint64_t const target = begin + (end - begin) * iShard / numShards;
+        for (; iFrame<endFrame; ++iFrame)
+        {
+            const LKMFMFrameEntry &entry = fEntries[iFrame];
+            if (entry.flags & kBlobFrame)
+                continue;
+            bool const opensEvent = seenEvent && entry.eventIdx > maxEventIdx;
+            if (!seenEvent || entry.eventIdx > maxEventIdx) {
+                maxEventIdx = entry.eventIdx;
+                seenEvent = true;
+            }
+            if (opensEvent && entry.offset >= target && entry.offset > boundaries.back()) {
+                boundaries.push_back(entry.offset);
+                ++iFrame;
+                break;
+            }
+        }
+    }
+
+    boundaries.push_back(end);
+    return boundaries;
+}
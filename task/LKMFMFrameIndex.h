@@ -0,0 +1,73 @@
+#ifndef LKMFMFRAMEINDEX_HH
+#define LKMFMFRAMEINDEX_HH
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+/// Position and identification of one top-level frame of a MFM file
+struct LKMFMFrameEntry
+{
+    uint64_t offset;    ///< [Bytes] from the beginning of the file
+    uint32_t size;      ///< [Bytes]
+    uint32_t eventIdx;
+    uint64_t eventTime;
+    uint8_t coboIdx;
+    uint8_t asadIdx;
+    uint8_t flags;      ///< kBlobFrame, kLayeredFrame
+    uint8_t reserved;
+};
+
+/*
+ * List of the top-level frames of a MFM file.
+ * The list is built by hopping from primary header to primary header,
+ * only the few header bytes of every frame are read.
+ * It can be kept next to the run file (run_XXXX.dat.idx) so that the next reader
+ * seeks straight to an event range or splits the run without scanning it again.
+ */
+class LKMFMFrameIndex
+{
+    public:
+        static const uint8_t kBlobFrame = 1;
+        static const uint8_t kLayeredFrame = 2;
+
+        LKMFMFrameIndex() {}
+        virtual ~LKMFMFrameIndex() {}
+
+        /// Indexes the frames found in [data, data+size) starting at byte startOffset.
+        /// Returns the offset after the last complete frame.
+        size_t Build(const char *data, size_t size, size_t startOffset = 0);
+        void Clear() { fEntries.clear(); }
+
+        /// Sidecar file: magic, size of the indexed MFM file, number of entries, then the entries as they are in memory
+        bool Write(const std::string &fileName, uint64_t mfmFileSize) const;
+        /// Returns false if the file does not exist, is not an index, or was made for a file of another size
+        bool Read(const std::string &fileName, uint64_t mfmFileSize);
+
+        size_t GetNumFrames() const { return fEntries.size(); }
+        const LKMFMFrameEntry &GetEntry(size_t i) const { return fEntries[i]; }
+        const std::vector<LKMFMFrameEntry> &GetEntries() const { return fEntries; }
+
+        /// Byte offsets splitting the indexed range into at most numShards parts of similar size.
+        /// Shards only start at a frame opening an event which is newer than all frames before it.
+        /// The first element is the first frame offset and the last one is the end of the last frame.
+        std::vector<uint64_t> FindShardBoundaries(int numShards) const { return FindShardBoundaries(numShards, 0, fEntries.size()); }
+        std::vector<uint64_t> FindShardBoundaries(int numShards, size_t beginFrame, size_t endFrame) const;
+
+        /// Frames [beginFrame, endFrame) holding the events firstEventIdx to lastEventIdx.
+        /// Blob frames (MuTanT, topology) in between are included. Returns false if no frame is in the range.
+        bool FindEventRange(uint32_t firstEventIdx, uint32_t lastEventIdx, size_t &beginFrame, size_t &endFrame) const;
+
+        /// Size [Bytes] of the frame starting at data, from the first 4 Bytes of its primary header
+        static uint64_t DecodeFrameSize(const char *data);
+
+        /// Reads the primary and CoBo header fields of the frame starting at data.
+        /// Returns false if less than a frame header is available.
+        static bool DecodeFrameHeader(const char *data, size_t size, LKMFMFrameEntry &entry);
+
+    private:
+        std::vector<LKMFMFrameEntry> fEntries;
+};
+
+#endif
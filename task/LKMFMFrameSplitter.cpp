@@ -0,0 +1,124 @@
+#include <algorithm>
+using namespace std;
+
+#include "mfm/PrimaryHeader.h"
+#include "mfm/Exception.h"
+
+#include "LKMFMFrameSplitter.h"
+
+LKMFMFrameSplitter::LKMFMFrameSplitter(LKSPSCQueue<FrameSlice> *frameQueue, size_t slabSize, int numSlabs)
+    : fFrameQueue(frameQueue), fSlabSize(slabSize), fMaxSlabs(std::max(2, numSlabs)), fFreeSlabs(std::max(2, numSlabs))
+{
+}
+
+void LKMFMFrameSplitter::addDataChunk(const mfm::Byte* begin, const mfm::Byte* end)
+{
+    while (begin < end)
+    {
+        if (fCurrent == nullptr || fTail == fCurrent->capacity)
+            NextSlab();
+        size_t const size = std::min(size_t(end - begin), fCurrent->capacity - fTail);
+        fCurrent->data.read(size, begin, fTail);
+        fTail += size;
+        begin += size;
+        BuildFrames();
+    }
+}
+
+/**
+ * Continues in another slab with the bytes of the incomplete frame. When none of the frames of the current slab
+ * is waiting to be decoded, these bytes are moved to its front instead, if they do not overlap their destination.
+ */
+void LKMFMFrameSplitter::NextSlab()
+{
+    size_t const residual = fTail - fHead;
+    size_t const size = std::max(fSlabSize, std::max(residual, fFrameSize) + 1);
+    if (fCurrent != nullptr && fCurrent->numUsers == 1 && fHead > 0 && residual <= fHead) {
+        if (residual > 0)
+            fCurrent->data.read(residual, fCurrent->data.begin() + fHead, 0u);
+        fHead = 0;
+        fTail = residual;
+        return;
+    }
+
+    Slab *slab = nullptr;
+    if (!fSpareSlabs.empty()) {
+        slab = fSpareSlabs.back();
+        fSpareSlabs.pop_back();
+    }
+    else if (!fFreeSlabs.TryPop(slab)) {
+        if (fSlabs.size() < fMaxSlabs) {
+            fSlabs.emplace_back(new Slab());
+            slab = fSlabs.back().get();
+        }
+        else
+            fFreeSlabs.Pop(slab);
+    }
+    if (slab->capacity < size) {
+        slab->data.setCapacity(size);
+        slab->data.set_size_B(size);
+        slab->capacity = size;
+    }
+    slab->numUsers = 1;
+
+    if (fCurrent != nullptr) {
+        if (residual > 0)
+            slab->data.read(residual, fCurrent->data.begin() + fHead, 0u);
+        if (fCurrent->numUsers.fetch_sub(1) == 1)
+            fSpareSlabs.push_back(fCurrent);
+    }
+    fCurrent = slab;
+    fHead = 0;
+    fTail = residual;
+}
+
+void LKMFMFrameSplitter::BuildFrames()
+{
+    while (fTail - fHead >= mfm::PrimaryHeader::SPEC_SIZE_B)
+    {
+        if (fFrameSize == 0)
+        {
+            std::auto_ptr<mfm::PrimaryHeader> headerPtr = mfm::PrimaryHeader::decodePrimaryHeader(fCurrent->data.inputStream(fHead));
+            fFrameSize = headerPtr->frameSize_B();
+            if (fFrameSize < mfm::PrimaryHeader::SPEC_SIZE_B)
+                throw mfm::Exception("Invalid frame size in primary header!");
+        }
+        if (fTail - fHead < fFrameSize)
+            break;
+
+        ++fCurrent->numUsers;
+        fFrameQueue -> Push({fCurrent, fHead, fFrameSize});
+        fHead += fFrameSize;
+        fFrameSize = 0;
+    }
+
+    // Rewind for free when everything was queued and decoded
+    if (fHead == fTail && fCurrent->numUsers == 1)
+        fHead = fTail = 0;
+}
+
+void LKMFMFrameSplitter::Release(const FrameSlice &slice)
+{
+    if (slice.slab -> numUsers.fetch_sub(1) == 1)
+        fFreeSlabs.Push(slice.slab);
+}
+
+bool LKMFMFrameSplitter::Retain(const FrameSlice &slice)
+{
+    Slab *slab = slice.slab;
+    if (slab -> numRetained == 0) {
+        if (fNumRetainingSlabs + 2 >= fMaxSlabs)
+            return false;
+        ++fNumRetainingSlabs;
+    }
+    ++slab -> numRetained;
+    ++slab -> numUsers;
+    return true;
+}
+
+void LKMFMFrameSplitter::ReleaseRetained(const FrameSlice &slice)
+{
+    if (--slice.slab -> numRetained == 0)
+        --fNumRetainingSlabs;
+    Release(slice);
+}
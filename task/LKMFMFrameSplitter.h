@@ -0,0 +1,70 @@
+#ifndef LKMFMFRAMESPLITTER_HH
+#define LKMFMFRAMESPLITTER_HH
+
+#include "mfm/Serializer.h"
+#include "LKSPSCQueue.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/*
+ * Frame builder stage of the conversion pipeline.
+ * Chunks are appended to a slab like in mfm::SlabFrameBuilder, but complete frames are not processed in place:
+ * their slab and position are queued for the decoding stage, which views the frame in the slab and gives it back
+ * with Release(). A slab is written only while none of its frames is waiting to be decoded, so the frames are
+ * never copied again. Full slabs are recycled through a small pool once all their frames were decoded.
+ */
+class LKMFMFrameSplitter
+{
+    public:
+        /// Buffer in which frames are reassembled
+        struct Slab {
+            mfm::Serializer data{0};
+            size_t capacity = 0;
+            std::atomic<int> numUsers{0}; ///< frames not yet released, +1 while the splitter appends to it
+            int numRetained = 0; ///< frames kept by Retain, used by the decoding thread only
+        };
+
+        /// Complete frame [offset, offset+size) of a slab, a null slab marks the end of the frames
+        struct FrameSlice {
+            Slab *slab = nullptr;
+            size_t offset = 0;
+            size_t size = 0;
+        };
+
+        /// Slabs of slabSize [Bytes] (larger for larger frames), at most numSlabs of them (at least 2)
+        LKMFMFrameSplitter(LKSPSCQueue<FrameSlice> *frameQueue, size_t slabSize, int numSlabs);
+        virtual ~LKMFMFrameSplitter() {}
+
+        /// Splitter thread: appends the chunk and queues the frames it completes. Waits for a slab if all are in use.
+        void addDataChunk(const mfm::Byte* begin, const mfm::Byte* end);
+        size_t residualSize_B() const { return fTail - fHead; }
+
+        /// Decoding thread: the frame of the slice is not used anymore
+        void Release(const FrameSlice &slice);
+        /// Decoding thread: keeps the frame of the slice after its Release, until ReleaseRetained. Fails when frames
+        /// are already kept in all slabs but two, so that the splitter always has slabs to go on with
+        bool Retain(const FrameSlice &slice);
+        void ReleaseRetained(const FrameSlice &slice);
+
+    private:
+        void NextSlab();
+        void BuildFrames();
+
+    private:
+        LKSPSCQueue<FrameSlice> *fFrameQueue;
+        size_t fSlabSize;
+        size_t fMaxSlabs;
+        std::vector<std::unique_ptr<Slab>> fSlabs;
+        LKSPSCQueue<Slab*> fFreeSlabs; ///< released by the decoding thread
+        std::vector<Slab*> fSpareSlabs; ///< released by the splitter itself
+
+        Slab *fCurrent = nullptr; ///< slab the chunks are appended to
+        size_t fHead = 0; ///< first byte of the current slab not queued yet
+        size_t fTail = 0; ///< byte after the last one received
+        size_t fFrameSize = 0; ///< size of the frame being built, 0 before its primary header is complete
+        size_t fNumRetainingSlabs = 0; ///< slabs with retained frames, used by the decoding thread only
+};
+
+#endif
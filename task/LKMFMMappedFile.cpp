@@ -0,0 +1,100 @@
+#include <iostream>
+#include <algorithm>
+using namespace std;
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "LKMFMMappedFile.h"
+
+LKMFMMappedFile::LKMFMMappedFile()
+{
+}
+
+LKMFMMappedFile::~LKMFMMappedFile()
+{
+    Close();
+}
+
+bool LKMFMMappedFile::Open(const std::string &fileName)
+{
+    Close();
+
+    fFileDescriptor = open(fileName.c_str(), O_RDONLY);
+    if (fFileDescriptor < 0) {
+        cerr << "LKMFMMappedFile: could not open " << fileName << endl;
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fFileDescriptor, &fileStat) != 0 || fileStat.st_size == 0) {
+        cerr << "LKMFMMappedFile: empty or unreadable file " << fileName << endl;
+        Close();
+        return false;
+    }
+    fSize = fileStat.st_size;
+
+    void *address = mmap(nullptr, fSize, PROT_READ, MAP_PRIVATE, fFileDescriptor, 0);
+    if (address == MAP_FAILED) {
+        cerr << "LKMFMMappedFile: mmap failed for " << fileName << endl;
+        Close();
+        return false;
+    }
+    fData = (char *) address;
+    fReleased = 0;
+
+    // The run file is read once from the front to the back
+    madvise(fData, fSize, MADV_SEQUENTIAL);
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fFileDescriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    return true;
+}
+
+void LKMFMMappedFile::Close()
+{
+    if (fData != nullptr)
+        munmap(fData, fSize);
+    if (fFileDescriptor >= 0)
+        close(fFileDescriptor);
+    fData = nullptr;
+    fSize = 0;
+    fReleased = 0;
+    fFileDescriptor = -1;
+}
+
+/**
+ * The range is aligned to the page size as required by madvise().
+ */
+void LKMFMMappedFile::Prefetch(size_t offset, size_t size)
+{
+    if (fData == nullptr || offset >= fSize)
+        return;
+
+    size_t const pageSize = sysconf(_SC_PAGESIZE);
+    size_t const alignedOffset = offset - offset % pageSize;
+    if (offset + size > fSize)
+        size = fSize - offset;
+
+    madvise(fData + alignedOffset, size + (offset - alignedOffset), MADV_WILLNEED);
+}
+
+/**
+ * Only whole pages before upTo are released, the page containing upTo stays mapped.
+ */
+void LKMFMMappedFile::Release(size_t upTo)
+{
+    if (fData == nullptr)
+        return;
+
+    size_t const pageSize = sysconf(_SC_PAGESIZE);
+    upTo = std::min(upTo, fSize);
+    size_t const alignedUpTo = upTo - upTo % pageSize;
+    if (alignedUpTo > fReleased) {
+        madvise(fData + fReleased, alignedUpTo - fReleased, MADV_DONTNEED);
+        fReleased = alignedUpTo;
+    }
+}
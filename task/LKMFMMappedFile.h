@@ -0,0 +1,38 @@
+#ifndef LKMFMMAPPEDFILE_HH
+#define LKMFMMAPPEDFILE_HH
+
+#include <string>
+#include <cstddef>
+
+/*
+ * Read-only memory map of a MFM run file.
+ * The whole file is mapped once and handed to the frame builder in large windows.
+ * Prefetch() reads the next window ahead, and Release() drops the pages the frame builder is done with
+ * (after it copied them into its slab), so that the resident size stays bounded even for multi-GB runs.
+ */
+class LKMFMMappedFile
+{
+    public:
+        LKMFMMappedFile();
+        virtual ~LKMFMMappedFile();
+
+        bool Open(const std::string &fileName);
+        void Close();
+
+        bool IsOpen() const { return fData != nullptr; }
+        const char* GetData() const { return fData; }
+        size_t GetSize() const { return fSize; }
+
+        /// Asks the kernel to start reading [offset, offset+size)
+        void Prefetch(size_t offset, size_t size);
+        /// Gives the pages before upTo back to the kernel, they must not be read anymore
+        void Release(size_t upTo);
+
+    private:
+        int fFileDescriptor = -1;
+        char *fData = nullptr;
+        size_t fSize = 0;
+        size_t fReleased = 0; ///< pages before this offset were already given back to the kernel
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+using namespace std;
+
+#include "LKMFMRunSummary.h"
+#include "LKMFMFrameIndex.h"
+#include "LKCoBoHeader.h"
+
+namespace {
+
+uint64_t LoadBigEndian(const unsigned char *p, int size)
+{
+    uint64_t value = 0;
+    for (int i=0; i<size; ++i)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+}
+
+size_t LKMFMRunSummary::Scan(const char *data, size_t size)
+{
+    size_t offset = 0;
+    while (offset + 8 <= size)
+    {
+        uint64_t const frameSize = LKMFMFrameIndex::DecodeFrameSize(data + offset);
+        if (frameSize < 8 || offset + frameSize > size)
+            break;
+        ++fNumTopFrames;
+        ScanFrame((const unsigned char *) data + offset, frameSize);
+        offset += frameSize;
+    }
+    fScannedSize = offset;
+    return offset;
+}
+
+void LKMFMRunSummary::ScanFrame(const unsigned char *frame, uint64_t frameSize)
+{
+    LKMFMFrameEntry entry;
+    if (!LKMFMFrameIndex::DecodeFrameHeader((const char *) frame, frameSize, entry))
+        return;
+
+    uint16_t const frameType = LoadBigEndian(frame+5, 2);
+    if (entry.flags & LKMFMFrameIndex::kBlobFrame) {
+        ++fNumBlobFrames;
+        if (frameType == 0x8)
+            ScanMuTanTFrame(frame, frameSize);
+        return;
+    }
+
+    if (entry.flags & LKMFMFrameIndex::kLayeredFrame) {
+        ++fNumLayeredFrames;
+        uint64_t const blockSize = 1u << (frame[0] & 0x0f);
+        uint64_t offset = LoadBigEndian(frame+8, 2) * blockSize;
+        uint32_t const numFrames = LoadBigEndian(frame+12, 4);
+        for (uint32_t i=0; i<numFrames && offset+8<=frameSize; ++i) {
+            uint64_t const subFrameSize = LKMFMFrameIndex::DecodeFrameSize((const char *) frame + offset);
+            if (subFrameSize < 8 || offset + subFrameSize > frameSize)
+                break;
+            ScanFrame(frame + offset, subFrameSize);
+            offset += subFrameSize;
+        }
+        return;
+    }
+
+    ++fNumCoBoFrames;
+    if (frame[7] == LKCoBoHeader::kRevision && frameSize >= 67)
+        ScanCoBoFrame(frame);
+    else {
+        ++fNumOtherRevision;
+        CountEvent(entry.eventIdx, entry.eventTime);
+    }
+}
+
+void LKMFMRunSummary::ScanCoBoFrame(const unsigned char *frame)
+{
+    LKCoBoHeader header(frame);
+    CountEvent(header.GetEventIdx(), header.GetEventTime());
+
+    AsAdSummary &asad = fAsAds[std::make_pair((int) header.GetCoboIdx(), (int) header.GetAsadIdx())];
+    ++asad.numFrames;
+    for (int aget=0; aget<4; ++aget) {
+        for (uint64_t bits=header.GetHitPatternLow(aget); bits!=0; bits&=bits-1)
+            ++asad.numHits[aget][__builtin_ctzll(bits)];
+        for (uint64_t bits=header.GetHitPatternHigh(aget); bits!=0; bits&=bits-1)
+            ++asad.numHits[aget][64 + __builtin_ctzll(bits)];
+    }
+}
+
+/// Same header fields as LKFrameBuilder::decodeMuTanTFrame
+void LKMFMRunSummary::ScanMuTanTFrame(const unsigned char *frame, uint64_t frameSize)
+{
+    if (frameSize < 64)
+        return;
+    static const int scalerPos[5] = {48, 52, 56, 40, 44};
+    for (int i=0; i<5; ++i) {
+        fLastScalers[i] = LoadBigEndian(frame + scalerPos[i], 4);
+        if (fNumMuTanTFrames == 0)
+            fFirstScalers[i] = fLastScalers[i];
+    }
+    fLastMuTanTEvent = LoadBigEndian(frame+14, 4);
+    fLastD2PTime = LoadBigEndian(frame+60, 4);
+    ++fNumMuTanTFrames;
+}
+
+void LKMFMRunSummary::CountEvent(uint32_t eventIdx, uint64_t eventTime)
+{
+    if (fNumEvents == 0) {
+        fNumEvents = 1;
+        fFirstEventIdx = fMaxEventIdx = eventIdx;
+        fFirstEventTime = fLastEventTime = eventTime;
+        return;
+    }
+    if (eventIdx <= fMaxEventIdx) {
+        if (eventIdx < fMaxEventIdx)
+            ++fNumLateFrames;
+        return;
+    }
+    if (eventIdx > fMaxEventIdx + 1) {
+        ++fNumGaps;
+        fNumMissingEvents += eventIdx - fMaxEventIdx - 1;
+        if (fGaps.size() < kMaxListedGaps)
+            fGaps.push_back(std::make_pair(fMaxEventIdx, eventIdx));
+    }
+    ++fNumEvents;
+    fMaxEventIdx = eventIdx;
+    fLastEventTime = eventTime;
+}
+
+bool LKMFMRunSummary::Write(const std::string &fileName, const std::string &mfmFileName) const
+{
+    ofstream out(fileName.c_str());
+    if (!out)
+        return false;
+
+    out << "# Header summary of " << mfmFileName << endl;
+    out << "scanned bytes      : " << fScannedSize << endl;
+    out << "top-level frames   : " << fNumTopFrames << " (layered " << fNumLayeredFrames << ", blob " << fNumBlobFrames << ")" << endl;
+    out << "CoBo frames        : " << fNumCoBoFrames << " (other header revision " << fNumOtherRevision << ")" << endl;
+    out << "events             : " << fNumEvents << " (eventIdx " << fFirstEventIdx << " to " << fMaxEventIdx << ")" << endl;
+    out << "eventIdx gaps      : " << fNumGaps << " gaps, " << fNumMissingEvents << " missing events" << endl;
+    for (auto &gap : fGaps)
+        out << "  " << gap.first << " -> " << gap.second << endl;
+    if (fNumGaps > fGaps.size())
+        out << "  ... (" << fNumGaps - fGaps.size() << " more)" << endl;
+    out << "late frames        : " << fNumLateFrames << " (eventIdx lower than an earlier frame)" << endl;
+    out << "eventTime          : first " << fFirstEventTime << ", last " << fLastEventTime
+        << ", span " << fLastEventTime - fFirstEventTime << endl;
+
+    out << endl << "# Hit pattern occupancy: fraction of the frames of each AsAd with the channel hit bit set" << endl;
+    for (auto &asadEntry : fAsAds) {
+        const AsAdSummary &asad = asadEntry.second;
+        out << "cobo " << asadEntry.first.first << " asad " << asadEntry.first.second << " : " << asad.numFrames << " frames" << endl;
+        for (int aget=0; aget<4; ++aget) {
+            uint64_t sum = 0;
+            for (int chan=0; chan<72; ++chan)
+                sum += asad.numHits[aget][chan];
+            out << "  aget " << aget << " mean hit channels " << fixed << setprecision(2) << double(sum) / asad.numFrames << endl;
+            out << "   ";
+            for (int chan=0; chan<72; ++chan)
+                out << " " << setprecision(3) << double(asad.numHits[aget][chan]) / asad.numFrames;
+            out << endl;
+        }
+    }
+
+    out << endl << "# MuTanT" << endl;
+    out << "frames             : " << fNumMuTanTFrames << endl;
+    if (fNumMuTanTFrames > 0) {
+        out << "last event         : " << fLastMuTanTEvent << endl;
+        out << "last D2P time      : " << fLastD2PTime*10 << endl;
+        for (int i=0; i<5; ++i)
+            out << "scaler " << i+1 << "           : " << fLastScalers[i] << " (" << fLastScalers[i] - fFirstScalers[i] << " during the run)" << endl;
+    }
+    return bool(out);
+}
@@ -0,0 +1,66 @@
+#ifndef LKMFMRUNSUMMARY_HH
+#define LKMFMRUNSUMMARY_HH
+
+#include <map>
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Quick look at a MFM run from the frame headers only.
+ * Frames are walked from primary header to primary header (into layered frames as well)
+ * and only the header bytes are read: event numbers and gaps, event times,
+ * hit pattern occupancy of every AsAd and the MuTanT scalers. Items are never touched.
+ */
+class LKMFMRunSummary
+{
+    public:
+        LKMFMRunSummary() {}
+        virtual ~LKMFMRunSummary() {}
+
+        /// Scans [data, data+size). Returns the offset after the last complete frame.
+        size_t Scan(const char *data, size_t size);
+        bool Write(const std::string &fileName, const std::string &mfmFileName) const;
+
+    private:
+        void ScanFrame(const unsigned char *frame, uint64_t frameSize);
+        void ScanCoBoFrame(const unsigned char *frame);
+        void ScanMuTanTFrame(const unsigned char *frame, uint64_t frameSize);
+        void CountEvent(uint32_t eventIdx, uint64_t eventTime);
+
+    private:
+        static const size_t kMaxListedGaps = 100;
+
+        struct AsAdSummary {
+            uint64_t numFrames = 0;
+            uint64_t numHits[4][72] = {}; ///< number of frames with the hit bit of each channel set
+        };
+
+        size_t fScannedSize = 0;
+        uint64_t fNumTopFrames = 0;
+        uint64_t fNumLayeredFrames = 0;
+        uint64_t fNumBlobFrames = 0;
+        uint64_t fNumCoBoFrames = 0;
+        uint64_t fNumOtherRevision = 0;
+
+        uint64_t fNumEvents = 0;
+        uint32_t fFirstEventIdx = 0;
+        uint32_t fMaxEventIdx = 0;
+        uint64_t fNumGaps = 0;
+        uint64_t fNumMissingEvents = 0;
+        uint64_t fNumLateFrames = 0;
+        std::vector<std::pair<uint32_t, uint32_t>> fGaps;
+        uint64_t fFirstEventTime = 0;
+        uint64_t fLastEventTime = 0;
+
+        std::map<std::pair<int,int>, AsAdSummary> fAsAds;
+
+        uint64_t fNumMuTanTFrames = 0;
+        uint32_t fFirstScalers[5] = {};
+        uint32_t fLastScalers[5] = {};
+        uint32_t fLastMuTanTEvent = 0;
+        uint32_t fLastD2PTime = 0;
+};
+
+#endif
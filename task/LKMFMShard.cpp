@@ -0,0 +1,101 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+using namespace std;
+
+#include "LKMFMShard.h"
+#include "LKFrameBuilder.h"
+
+LKMFMShard::LKMFMShard(int index, std::string fileName)
+: fIndex(index), fFileName(fileName)
+{
+}
+
+LKMFMShard::~LKMFMShard()
+{
+    Close();
+    remove(fFileName.c_str());
+    delete fChannelArray;
+}
+
+size_t LKMFMShard::GetSize() const
+{
+    size_t size = 0;
+    for (auto &range : fRanges)
+        size += range.end - range.begin;
+    return size;
+}
+
+bool LKMFMShard::Convert(LKFrameBuilder *builder, TClonesArray *channelArray, size_t windowSize)
+{
+    fFile = new TFile(fFileName.c_str(), "recreate");
+    fTree = new TTree("shard", "MFM conversion shard");
+    fTree -> Branch("EventIdx", &fEventIdx, "EventIdx/I");
+    fTree -> Branch("RawData", &channelArray);
+
+    builder -> SetEventCallback([this](Int_t eventIdx) {
+        fEventIdx = eventIdx;
+        fTree -> Fill();
+    });
+
+    bool good = true;
+    for (auto &range : fRanges)
+    {
+        for (const char *window=range.begin; window<range.end && good; window+=windowSize)
+        {
+            const char *windowEnd = window + std::min(windowSize, size_t(range.end - window));
+            try {
+                builder -> addMappedChunk(window, windowEnd);
+            }catch (const std::exception& e){
+                cerr << "LKMFMShard " << fIndex << ": error at byte " << (window - range.begin) << " of range: " << e.what() << endl;
+                good = false;
+            }
+        }
+    }
+    if (good)
+        builder -> FlushEvent();
+    builder -> SetEventCallback(nullptr);
+
+    fFile -> cd();
+    fTree -> Write();
+    fFile -> Close();
+    delete fFile;
+    fFile = nullptr;
+    fTree = nullptr;
+    return good;
+}
+
+bool LKMFMShard::OpenForRead()
+{
+    if (fChannelArray == nullptr)
+        fChannelArray = new TClonesArray("MMChannel", 1000);
+    fFile = new TFile(fFileName.c_str(), "read");
+    fTree = (TTree *) fFile -> Get("shard");
+    if (fTree == nullptr) {
+        Close();
+        return false;
+    }
+    fTree -> SetBranchAddress("EventIdx", &fEventIdx);
+    fTree -> SetBranchAddress("RawData", &fChannelArray);
+    fNumEntries = fTree -> GetEntries();
+    fEntry = 0;
+    if (fNumEntries > 0)
+        fTree -> GetEntry(0);
+    return true;
+}
+
+void LKMFMShard::Next()
+{
+    if (++fEntry < fNumEntries)
+        fTree -> GetEntry(fEntry);
+}
+
+void LKMFMShard::Close()
+{
+    if (fFile != nullptr) {
+        fFile -> Close();
+        delete fFile;
+        fFile = nullptr;
+        fTree = nullptr;
+    }
+}
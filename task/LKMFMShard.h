@@ -0,0 +1,57 @@
+#ifndef LKMFMSHARD_HH
+#define LKMFMSHARD_HH
+
+#include <vector>
+#include <string>
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TClonesArray.h"
+
+class LKFrameBuilder;
+
+/*
+ * One part of a MFM run converted on its own thread.
+ * The byte ranges of the shard are fed to the LKFrameBuilder given to Convert() and each event
+ * is written to a temporary tree, which is read back in event order when the shards are merged.
+ * The shard keeps only its ranges and file name: a frame builder is large, so one exists per running conversion.
+ * A shard may span several ranges, e.g. the end of a run segment and the frame which continues in the next one.
+ */
+class LKMFMShard
+{
+    public:
+        LKMFMShard(int index, std::string fileName);
+        virtual ~LKMFMShard();
+
+        void AddRange(const char *begin, const char *end) { fRanges.push_back({begin, end}); }
+        size_t GetSize() const;
+
+        /// Converts all ranges with a new builder filling channelArray (worker thread). Returns false if the frame builder failed.
+        bool Convert(LKFrameBuilder *builder, TClonesArray *channelArray, size_t windowSize);
+
+        bool OpenForRead();
+        bool HasEvent() const { return fEntry < fNumEntries; }
+        Int_t GetEventIdx() const { return fEventIdx; }
+        TClonesArray *GetChannelArray() { return fChannelArray; }
+        void Next();
+        void Close();
+
+        int GetIndex() const { return fIndex; }
+        Long64_t GetNumEvents() const { return fNumEntries; }
+
+    private:
+        struct Range { const char *begin; const char *end; };
+
+        int fIndex;
+        TClonesArray *fChannelArray = nullptr; ///< event read back by OpenForRead
+        std::string fFileName;
+        std::vector<Range> fRanges;
+
+        TFile *fFile = nullptr;
+        TTree *fTree = nullptr;
+        Int_t fEventIdx = 0;
+        Long64_t fEntry = 0;
+        Long64_t fNumEntries = 0;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef LKSPSCQUEUE_HH
+#define LKSPSCQUEUE_HH
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstddef>
+
+/*
+ * Bounded lock-free queue between exactly one producer thread and one consumer thread.
+ * Push() and Pop() wait (spin, then sleep shortly) while the queue is full or empty.
+ * The queue keeps statistics to tell which side of it is the bottleneck:
+ * a queue which is mostly full with many producer waits has a slow consumer,
+ * a queue which is mostly empty with many consumer waits has a slow producer.
+ */
+template <typename T>
+class LKSPSCQueue
+{
+    public:
+        LKSPSCQueue(size_t depth) : fSlots(depth + 1) {}
+
+        bool TryPush(const T &value)
+        {
+            size_t const tail = fTail.load(std::memory_order_relaxed);
+            size_t const next = Next(tail);
+            if (next == fHead.load(std::memory_order_acquire))
+                return false;
+            fSlots[tail] = value;
+            fTail.store(next, std::memory_order_release);
+            fNumPushed++;
+            fSumOccupancy += Size();
+            return true;
+        }
+
+        bool TryPop(T &value)
+        {
+            size_t const head = fHead.load(std::memory_order_relaxed);
+            if (head == fTail.load(std::memory_order_acquire))
+                return false;
+            value = fSlots[head];
+            fHead.store(Next(head), std::memory_order_release);
+            return true;
+        }
+
+        void Push(const T &value)
+        {
+            if (TryPush(value))
+                return;
+            fNumFullWaits++;
+            for (int i=0; !TryPush(value); ++i)
+                Wait(i);
+        }
+
+        void Pop(T &value)
+        {
+            if (TryPop(value))
+                return;
+            fNumEmptyWaits++;
+            for (int i=0; !TryPop(value); ++i)
+                Wait(i);
+        }
+
+        size_t Size() const
+        {
+            size_t const head = fHead.load(std::memory_order_acquire);
+            size_t const tail = fTail.load(std::memory_order_acquire);
+            return (tail + fSlots.size() - head) % fSlots.size();
+        }
+        size_t GetDepth() const { return fSlots.size() - 1; }
+
+        /// Mean number of queued elements seen by the producer after each push
+        double GetMeanOccupancy() const { return fNumPushed>0 ? double(fSumOccupancy)/fNumPushed : 0.; }
+        size_t GetNumPushed() const { return fNumPushed; }
+        size_t GetNumFullWaits() const { return fNumFullWaits; }
+        size_t GetNumEmptyWaits() const { return fNumEmptyWaits; }
+
+    private:
+        size_t Next(size_t index) const { return (index + 1 == fSlots.size()) ? 0 : index + 1; }
+
+        static void Wait(int iteration)
+        {
+            if (iteration < 64) std::this_thread::yield();
+            else std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+
+    private:
+        std::vector<T> fSlots;
+        alignas(64) std::atomic<size_t> fHead{0}; ///< written by the consumer only
+        alignas(64) std::atomic<size_t> fTail{0}; ///< written by the producer only
+
+        // producer side statistics
+        alignas(64) size_t fNumPushed = 0;
+        size_t fSumOccupancy = 0;
+        size_t fNumFullWaits = 0;
+        // consumer side statistics
+        alignas(64) size_t fNumEmptyWaits = 0;
+};
+
+#endif